@@ -0,0 +1,436 @@
+// Microbenchmarks of the renderer's hot kernels: the box and sphere tests,
+// each material's scatter(), camera rays, Perlin noise, the random number
+// helpers, Sobol' sampling and pixel output.
+//
+// Every kernel runs over a fixed table of 1024 inputs made from a fixed seed,
+// so runs are comparable. Each benchmark is first sized until one batch takes
+// --min-time milliseconds, then timed --repetitions times; the median time per
+// call is the figure of record, with the interquartile spread beside it as a
+// measure of how stable the machine was.
+//
+//   kernel_benchmarks [--filter TEXT] [--min-time MS] [--repetitions N]
+//                     [--json FILE] [--baseline FILE [--tolerance FRACTION]]
+//
+// --json writes the results; a saved --json file is a baseline. With
+// --baseline, every kernel slower than its baseline median by more than
+// --tolerance (default 0.15) is listed and the exit code is 1.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "camera.h"
+#include "color.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "perlin.h"
+#include "rtweekend.h"
+#include "sobol.h"
+#include "sphere.h"
+#include "vec3.h"
+
+namespace
+{
+
+constexpr size_t input_count = 1024; // a power of two, indexed with & (input_count - 1)
+
+// Runs a kernel `iterations` times and returns a value that depends on every
+// result, so the compiler cannot drop the work.
+using kernel = std::function<double(size_t iterations)>;
+
+struct benchmark
+{
+    std::string name;
+    kernel run;
+};
+
+struct benchmark_result
+{
+    std::string name;
+    double median_ns{ 0 };
+    double min_ns{ 0 };
+    double spread{ 0 }; // interquartile range over the median
+    size_t iterations{ 0 }; // per repetition
+};
+
+volatile double sink;
+
+double time_batch(const kernel& run, size_t iterations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    sink = run(iterations);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+benchmark_result measure(const benchmark& b, double min_ms, int repetitions)
+{
+    // Grow the batch until it is long enough to time; this doubles as warm-up.
+    size_t iterations = 16;
+    double elapsed = time_batch(b.run, iterations);
+    while (elapsed < min_ms * 1e6)
+    {
+        const double factor = elapsed > 0 ? std::clamp(1.2 * min_ms * 1e6 / elapsed, 2.0, 100.0) : 100.0;
+        iterations = static_cast<size_t>(static_cast<double>(iterations) * factor);
+        elapsed = time_batch(b.run, iterations);
+    }
+
+    std::vector<double> per_call;
+    for (int r = 0; r < repetitions; ++r)
+        per_call.push_back(time_batch(b.run, iterations) / static_cast<double>(iterations));
+    std::sort(per_call.begin(), per_call.end());
+
+    auto quantile = [&](double q) { return per_call[static_cast<size_t>(q * static_cast<double>(per_call.size() - 1) + 0.5)]; };
+    benchmark_result result;
+    result.name = b.name;
+    result.median_ns = quantile(0.5);
+    result.min_ns = per_call.front();
+    result.spread = result.median_ns > 0 ? (quantile(0.75) - quantile(0.25)) / result.median_ns : 0.0;
+    result.iterations = iterations;
+    return result;
+}
+
+// Rays from a shell of radius 4 around the origin towards points in
+// [-1.5, 1.5]^3, so about half of them hit the unit sphere and box.
+std::vector<ray> make_rays()
+{
+    std::vector<ray> rays;
+    for (size_t i = 0; i < input_count; ++i)
+    {
+        const point3 origin = 4.0 * random_unit_vector();
+        const point3 target = vec3::random(-1.5, 1.5);
+        rays.emplace_back(origin, target - origin, random_double());
+    }
+    return rays;
+}
+
+// Streams characters to nowhere, so write_color() is timed without file I/O.
+class null_buffer final : public std::streambuf
+{
+protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+// perlin::noise or perlin::turb, N points per call, over a table of points;
+// each iteration is one point.
+template <int N>
+kernel perlin_kernel(const shared_ptr<perlin>& noise, const shared_ptr<std::vector<double>>& points, bool turbulence)
+{
+    return [noise, points, turbulence](size_t iterations) {
+        double sum = 0;
+        double results[N];
+        for (size_t i = 0; i < iterations; i += N)
+        {
+            const double* p = &(*points)[3 * (i & (input_count - 1))];
+            if (turbulence)
+                noise->turb_batch<N>(p, p + 1, p + 2, 3, results);
+            else
+                noise->noise_batch<N>(p, p + 1, p + 2, 3, results);
+            for (const double r : results)
+                sum += r;
+        }
+        return sum;
+    };
+}
+
+std::vector<benchmark> make_benchmarks()
+{
+    seed_random(2022);
+    const auto rays = std::make_shared<std::vector<ray>>(make_rays());
+
+    std::vector<double> uvs(2 * input_count);
+    for (double& value : uvs)
+        value = random_double();
+
+    std::vector<benchmark> benchmarks;
+
+    const aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+    benchmarks.push_back({ "aabb_hit", [rays, box](size_t iterations) {
+        double hits = 0;
+        for (size_t i = 0; i < iterations; ++i)
+            hits += box.hit((*rays)[i & (input_count - 1)], 0.001, infinity);
+        return hits;
+    } });
+
+    auto inverse_directions = std::make_shared<std::vector<vec3>>();
+    for (const ray& r : *rays)
+        inverse_directions->push_back(vec3(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z()));
+    benchmarks.push_back({ "aabb_hit_precomputed_inverse", [rays, inverse_directions, box](size_t iterations) {
+        double hits = 0;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const size_t k = i & (input_count - 1);
+            hits += box.hit((*rays)[k].orig, (*inverse_directions)[k], 0.001, infinity);
+        }
+        return hits;
+    } });
+
+    auto diffuse = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto ball = std::make_shared<sphere>(point3(0, 0, 0), 1.0, diffuse);
+    benchmarks.push_back({ "sphere_hit", [rays, ball](size_t iterations) {
+        double sum = 0;
+        hit_record record;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            if (ball->hit((*rays)[i & (input_count - 1)], 0.001, infinity, record))
+                sum += record.t_of_ray;
+        }
+        return sum;
+    } });
+
+    auto moving_ball = std::make_shared<moving_sphere>(point3(0, -0.25, 0), point3(0, 0.25, 0), 0.0, 1.0, 1.0, diffuse);
+    benchmarks.push_back({ "moving_sphere_hit", [rays, moving_ball](size_t iterations) {
+        double sum = 0;
+        hit_record record;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            if (moving_ball->hit((*rays)[i & (input_count - 1)], 0.001, infinity, record))
+                sum += record.t_of_ray;
+        }
+        return sum;
+    } });
+
+    // Materials scatter at real hits: the rays above that hit the sphere.
+    struct shading_input
+    {
+        ray in;
+        hit_record record;
+    };
+    auto hits = std::make_shared<std::vector<shading_input>>();
+    for (size_t i = 0; hits->size() < input_count; ++i)
+    {
+        shading_input input{ (*rays)[i & (input_count - 1)], {} };
+        if (ball->hit(input.in, 0.001, infinity, input.record))
+        {
+            input.record.finish_shading(input.in);
+            hits->push_back(input);
+        }
+    }
+    const std::pair<const char*, shared_ptr<material>> materials[] = {
+        { "lambertian_scatter", diffuse },
+        { "metal_scatter", make_shared<metal>(color(0.7, 0.6, 0.5), 0.1) },
+        { "dielectric_scatter", make_shared<dielectric>(1.5) },
+    };
+    for (const auto& [name, m] : materials)
+    {
+        benchmarks.push_back({ name, [hits, m = m](size_t iterations) {
+            double sum = 0;
+            color attenuation;
+            ray scattered;
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                const shading_input& input = (*hits)[i & (input_count - 1)];
+                if (m->scatter(input.in, input.record, attenuation, scattered))
+                    sum += scattered.direction().x() + attenuation.x();
+            }
+            return sum;
+        } });
+    }
+
+    camera cam(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 16.0 / 9.0, 0.1, 10.0, 0.0, 1.0);
+    cam.set_image_size(400, 225, 100);
+    benchmarks.push_back({ "camera_get_ray", [cam, uvs](size_t iterations) {
+        double sum = 0;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const size_t k = 2 * (i & (input_count - 1));
+            sum += cam.get_ray(uvs[k], uvs[k + 1]).direction().x();
+        }
+        return sum;
+    } });
+
+    // Noise and turbulence one point at a time and through the 4- and 8-wide
+    // batch entry points; times are per point, so the widths compare directly.
+    auto noise = std::make_shared<perlin>();
+    auto points = std::make_shared<std::vector<double>>();
+    for (size_t i = 0; i < 3 * input_count; ++i)
+        points->push_back(random_double(-100, 100));
+    for (const bool turbulence : { false, true })
+    {
+        const std::string name = turbulence ? "perlin_turb" : "perlin_noise";
+        benchmarks.push_back({ name + "_x1", perlin_kernel<1>(noise, points, turbulence) });
+        benchmarks.push_back({ name + "_x4", perlin_kernel<4>(noise, points, turbulence) });
+        benchmarks.push_back({ name + "_x8", perlin_kernel<8>(noise, points, turbulence) });
+    }
+
+    benchmarks.push_back({ "random_double", [](size_t iterations) {
+        double sum = 0;
+        for (size_t i = 0; i < iterations; ++i)
+            sum += random_double();
+        return sum;
+    } });
+
+    benchmarks.push_back({ "random_in_unit_sphere", [](size_t iterations) {
+        double sum = 0;
+        for (size_t i = 0; i < iterations; ++i)
+            sum += random_in_unit_sphere().x();
+        return sum;
+    } });
+
+    benchmarks.push_back({ "sobol_sample", [](size_t iterations) {
+        double sum = 0;
+        for (size_t i = 0; i < iterations; ++i)
+            sum += sobol::sample(i, static_cast<unsigned>(i & 7));
+        return sum;
+    } });
+
+    auto colors = std::make_shared<std::vector<color>>();
+    for (size_t i = 0; i < input_count; ++i)
+        colors->push_back(100.0 * vec3::random());
+    benchmarks.push_back({ "write_color", [colors](size_t iterations) {
+        null_buffer buffer;
+        std::ostream out(&buffer);
+        for (size_t i = 0; i < iterations; ++i)
+            write_color(out, (*colors)[i & (input_count - 1)], 100);
+        return static_cast<double>(out.good());
+    } });
+
+    return benchmarks;
+}
+
+void write_json(std::ostream& out, const std::vector<benchmark_result>& results)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(4);
+    out << std::fixed << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const benchmark_result& r = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    { \"name\": \"" << r.name << "\", \"median_ns\": " << r.median_ns
+            << ", \"min_ns\": " << r.min_ns << ", \"spread\": " << r.spread << ", \"iterations\": " << r.iterations << " }";
+    }
+    out << "\n  ]\n}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// Reads the name and median of every benchmark in a file written by write_json().
+bool read_baseline(const std::string& path, std::map<std::string, double>& medians)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not read baseline '" << path << "'.\n";
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    const std::string json = text.str();
+
+    const std::string name_key = "\"name\": \"";
+    const std::string median_key = "\"median_ns\": ";
+    for (size_t at = json.find(name_key); at != std::string::npos; at = json.find(name_key, at))
+    {
+        at += name_key.size();
+        const size_t name_end = json.find('"', at);
+        const size_t median_at = json.find(median_key, name_end);
+        if (name_end == std::string::npos || median_at == std::string::npos)
+            break;
+        medians[json.substr(at, name_end - at)] = std::atof(json.c_str() + median_at + median_key.size());
+        at = median_at;
+    }
+    if (medians.empty())
+    {
+        std::cerr << "ERROR: No benchmarks in baseline '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+const char* usage =
+    " [--filter TEXT] [--min-time MS] [--repetitions N] [--json FILE] [--baseline FILE [--tolerance FRACTION]]\n";
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::string filter;
+    double min_ms = 20.0;
+    int repetitions = 15;
+    std::string json_path;
+    std::string baseline_path;
+    double tolerance = 0.15;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            min_ms = std::max(1.0, std::atof(argv[++i]));
+        else if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            repetitions = std::max(3, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = std::atof(argv[++i]);
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << usage;
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty() && !read_baseline(baseline_path, baseline))
+        return 1;
+
+    std::vector<benchmark_result> results;
+    std::vector<std::string> regressions;
+    std::cout << std::fixed << std::setprecision(2);
+    for (const benchmark& b : make_benchmarks())
+    {
+        if (!filter.empty() && b.name.find(filter) == std::string::npos)
+            continue;
+        const benchmark_result r = measure(b, min_ms, repetitions);
+        results.push_back(r);
+        std::cout << std::left << std::setw(30) << r.name << std::right << std::setw(9) << r.median_ns << " ns  (min "
+                  << r.min_ns << ", spread " << 100.0 * r.spread << "%)";
+
+        const auto known = baseline.find(r.name);
+        if (known != baseline.end() && known->second > 0)
+        {
+            const double ratio = r.median_ns / known->second;
+            std::cout << "  x" << ratio << " of baseline";
+            if (ratio > 1.0 + tolerance)
+            {
+                std::cout << "  REGRESSION";
+                regressions.push_back(r.name);
+            }
+        }
+        std::cout << "\n";
+    }
+
+    if (!json_path.empty())
+    {
+        std::ofstream out(json_path);
+        write_json(out, results);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write '" << json_path << "'.\n";
+            return 1;
+        }
+    }
+
+    if (!regressions.empty())
+    {
+        std::cerr << regressions.size() << " kernel(s) slower than the baseline by more than " << 100.0 * tolerance << "%:";
+        for (const std::string& name : regressions)
+            std::cerr << " " << name;
+        std::cerr << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -29,6 +29,30 @@ public:
         return true;
     }
 
+    // Slab test with the reciprocal direction precomputed once per ray, for
+    // traversals that test many boxes against the same ray.
+    [[nodiscard]] bool hit(const point3& origin, const vec3& inverse_direction, double t_min, double t_max) const
+    {
+        for (const int dim : {0, 1, 2})
+        {
+            auto t0 = (minimum.e[dim] - origin.e[dim]) * inverse_direction.e[dim];
+            auto t1 = (maximum.e[dim] - origin.e[dim]) * inverse_direction.e[dim];
+            if (inverse_direction.e[dim] < 0.0)
+                std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min) // boxes of flat, axis-aligned primitives have t_max == t_min
+                return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] double surface_area() const
+    {
+        const vec3 extent = maximum - minimum;
+        return 2.0 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+    }
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
     point3 minimum;
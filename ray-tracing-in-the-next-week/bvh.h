@@ -5,6 +5,8 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "parallel.h"
+#include "render_stats.h"
 
 
 class bvh_node : public hittable
@@ -16,9 +18,11 @@ public:
     //    : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
     //{}
 
+    // Builds over src_objects[start, end). The top levels fork their two
+    // halves onto separate threads (thread_count 0 = one per hardware thread).
     bvh_node(
         const std::vector<shared_ptr<hittable>>& src_objects,
-        size_t start, size_t end, double time0, double time1
+        size_t start, size_t end, double time0, double time1, unsigned thread_count = 0
     );
 
     bool hit(
@@ -27,11 +31,26 @@ public:
 
     bool bounding_box(double time0, double time1, aabb& output_box)const override;
 
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb box;
+
+private:
+    // An object and the box it is sorted by, queried once rather than on
+    // every comparison.
+    struct build_item
+    {
+        shared_ptr<hittable> object;
+        aabb sort_box;
+    };
+
+    // Sorts items[start, end) in place; one shared array for the whole build
+    // instead of a copy of the object list per node.
+    bvh_node(std::vector<build_item>& items, size_t start, size_t end, double time0, double time1, int fork_depth);
 };
 
 
@@ -64,42 +83,67 @@ inline bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittabl
 
 inline bvh_node::bvh_node(
     const std::vector<shared_ptr<hittable>>& src_objects,
-    size_t start, size_t end, double time0, double time1
+    size_t start, size_t end, double time0, double time1, unsigned thread_count
 )
 {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
+    std::vector<build_item> items(end - start);
+    parallel_for(items.size(), [&](size_t i) {
+        items[i].object = src_objects[start + i];
+        if (!items[i].object->bounding_box(0, 0, items[i].sort_box))
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+    }, thread_count);
+
+    // Fork while there are fewer running subtrees than threads.
+    if (thread_count == 0)
+        thread_count = hardware_threads();
+    int fork_depth = 0;
+    while ((1u << fork_depth) < thread_count && fork_depth < 16)
+        ++fork_depth;
+
+    *this = bvh_node(items, 0, items.size(), time0, time1, fork_depth);
+}
 
+inline bvh_node::bvh_node(std::vector<build_item>& items, size_t start, size_t end, double time0, double time1,
+    int fork_depth)
+{
     const int axis = random_int(0, 2);
-    const auto comparator = (axis == 0) ? box_x_compare
-	                            : (axis == 1) ? box_y_compare
-	                            : box_z_compare;
+    const auto comparator = [axis](const build_item& a, const build_item& b) {
+        return a.sort_box.min().e[axis] < b.sort_box.min().e[axis];
+    };
 
     const size_t object_span = end - start;
 
     if (object_span == 1)
     {
-        left = right = objects[start];
+        left = right = items[start].object;
     }
     else if (object_span == 2)
     {
-        if (comparator(objects[start], objects[start + 1]))
+        if (comparator(items[start], items[start + 1]))
         {
-            left = objects[start];
-            right = objects[start + 1];
+            left = items[start].object;
+            right = items[start + 1].object;
         }
         else
         {
-            left = objects[start + 1];
-            right = objects[start];
+            left = items[start + 1].object;
+            right = items[start].object;
         }
     }
     else
     {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+        std::sort(items.begin() + start, items.begin() + end, comparator);
 
         auto mid = start + object_span / 2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        auto build_left = [&] { left = make_shared<bvh_node>(bvh_node(items, start, mid, time0, time1, fork_depth - 1)); };
+        auto build_right = [&] { right = make_shared<bvh_node>(bvh_node(items, mid, end, time0, time1, fork_depth - 1)); };
+        if (fork_depth > 0 && object_span >= 4096)
+            fork_join(build_left, build_right);
+        else
+        {
+            build_left();
+            build_right();
+        }
     }
     aabb box_left, box_right;
 
@@ -113,6 +157,7 @@ inline bvh_node::bvh_node(
 
 inline bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 {
+    RT_COUNT(bvh_nodes);
     if (!box.hit(r, t_min, t_max))
         return false;
 
@@ -122,6 +167,14 @@ inline bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record&
     return hit_left || hit_right;
 }
 
+inline bool bvh_node::occluded(const ray& r, double t_min, double t_max) const
+{
+    RT_COUNT(bvh_nodes);
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
 inline bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
 {
     output_box = box;
@@ -0,0 +1,307 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "flat_bvh.h"
+#include "mapped_file.h"
+
+// Built BVHs kept on disk between runs. A tree depends only on its input
+// boxes (and shutter and build options), so the cache key is a hash of
+// exactly those; a scene whose geometry has not changed finds its tree under
+// the same key on the next launch, maps the file and copies the node and
+// index arrays in, instead of building. Files are named <key>.bvh in the
+// cache directory and are only ever added, never updated in place.
+struct bvh_cache_report
+{
+    std::uint64_t hits{ 0 };
+    std::uint64_t misses{ 0 };
+    double hash_ms{ 0 };  // hashing the input boxes
+    double load_ms{ 0 };  // mapping and copying cached trees
+    double build_ms{ 0 }; // building the trees that were not cached
+    double save_ms{ 0 };
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_cache_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(2);
+    out << std::fixed << "bvh cache: " << report.hits << " hits, " << report.misses << " misses (hash "
+        << report.hash_ms << " ms, load " << report.load_ms << " ms, build " << report.build_ms << " ms, save "
+        << report.save_ms << " ms)";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+class bvh_cache
+{
+public:
+    static bvh_cache& global()
+    {
+        static bvh_cache cache;
+        return cache;
+    }
+
+    // An empty directory (the default) turns the cache off.
+    void set_directory(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        directory = path;
+    }
+    [[nodiscard]] bool enabled() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !directory.empty();
+    }
+
+    // flat_bvh::build() and build_motion(), through the cache when it is on.
+    void build(flat_bvh& bvh, const std::vector<aabb>& boxes, const bvh_build_options& options = {});
+    void build_motion(flat_bvh& bvh, const std::vector<aabb>& open_boxes, const std::vector<aabb>& close_boxes,
+        double time0, double time1, const bvh_build_options& options = {});
+
+    [[nodiscard]] bvh_cache_report report() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totals;
+    }
+
+private:
+    bvh_cache() = default;
+
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t has_motion;
+        std::uint64_t key;
+        std::uint64_t primitive_count;
+        std::uint64_t node_count;
+        double time0;
+        double time1;
+    };
+    static constexpr char magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', '0', '1' };
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::uint64_t section_alignment = 64;
+
+    static std::uint64_t hash_bytes(const void* data, size_t size, std::uint64_t hash);
+    static std::uint64_t input_key(const std::vector<aabb>& open_boxes, const std::vector<aabb>* close_boxes,
+        double time0, double time1, const bvh_build_options& options);
+
+    template <typename Build>
+    void cached_build(flat_bvh& bvh, size_t primitive_count, std::uint64_t key, bool motion, double time0,
+        double time1, Build&& build_tree, double hash_ms);
+
+    [[nodiscard]] std::string path_for(std::uint64_t key) const;
+    bool load(const std::string& path, std::uint64_t key, size_t primitive_count, bool motion, flat_bvh& bvh) const;
+    bool save(const std::string& path, std::uint64_t key, double time0, double time1, const flat_bvh& bvh) const;
+
+    mutable std::mutex mutex;
+    std::string directory;
+    bvh_cache_report totals;
+};
+
+// Word-at-a-time multiply-xorshift over the raw bytes; boxes are hashed by
+// bit pattern, so any change to any coordinate gives a different key.
+inline std::uint64_t bvh_cache::hash_bytes(const void* data, size_t size, std::uint64_t hash)
+{
+    constexpr std::uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof word);
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ bytes[i]) * multiplier;
+    hash ^= size;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+inline std::uint64_t bvh_cache::input_key(const std::vector<aabb>& open_boxes, const std::vector<aabb>* close_boxes,
+    double time0, double time1, const bvh_build_options& options)
+{
+    // Layout and builder parameters go in too, so a change to either misses.
+    const double parameters[] = { static_cast<double>(version), static_cast<double>(sizeof(flat_bvh_node)),
+                                  static_cast<double>(options.max_leaf_size), static_cast<double>(options.bin_count),
+                                  options.traversal_cost, options.intersection_cost,
+                                  static_cast<double>(options.builder), static_cast<double>(options.morton_bits),
+                                  close_boxes != nullptr ? time0 : 0.0, close_boxes != nullptr ? time1 : 0.0 };
+    std::uint64_t key = hash_bytes(parameters, sizeof parameters, 0x5254425648433031ull);
+    key = hash_bytes(open_boxes.data(), open_boxes.size() * sizeof(aabb), key);
+    if (close_boxes != nullptr)
+        key = hash_bytes(close_boxes->data(), close_boxes->size() * sizeof(aabb), key);
+    return key;
+}
+
+inline std::string bvh_cache::path_for(std::uint64_t key) const
+{
+    char name[24];
+    std::snprintf(name, sizeof name, "%016llx.bvh", static_cast<unsigned long long>(key));
+    std::lock_guard<std::mutex> lock(mutex);
+    return directory + "/" + name;
+}
+
+inline void bvh_cache::build(flat_bvh& bvh, const std::vector<aabb>& boxes, const bvh_build_options& options)
+{
+    if (!enabled() || boxes.empty())
+    {
+        bvh.build(boxes, options);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const std::uint64_t key = input_key(boxes, nullptr, 0.0, 0.0, options);
+    const double hash_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cached_build(bvh, boxes.size(), key, false, 0.0, 0.0, [&] { bvh.build(boxes, options); }, hash_ms);
+}
+
+inline void bvh_cache::build_motion(flat_bvh& bvh, const std::vector<aabb>& open_boxes,
+    const std::vector<aabb>& close_boxes, double time0, double time1, const bvh_build_options& options)
+{
+    if (!enabled() || open_boxes.empty())
+    {
+        bvh.build_motion(open_boxes, close_boxes, time0, time1, options);
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const std::uint64_t key = input_key(open_boxes, &close_boxes, time0, time1, options);
+    const double hash_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cached_build(bvh, open_boxes.size(), key, true, time0, time1,
+        [&] { bvh.build_motion(open_boxes, close_boxes, time0, time1, options); }, hash_ms);
+}
+
+template <typename Build>
+void bvh_cache::cached_build(flat_bvh& bvh, size_t primitive_count, std::uint64_t key, bool motion, double time0,
+    double time1, Build&& build_tree, double hash_ms)
+{
+    using clock = std::chrono::steady_clock;
+    auto milliseconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    const std::string path = path_for(key);
+    auto start = clock::now();
+    if (load(path, key, primitive_count, motion, bvh))
+    {
+        const double load_ms = milliseconds_since(start);
+        std::lock_guard<std::mutex> lock(mutex);
+        ++totals.hits;
+        totals.hash_ms += hash_ms;
+        totals.load_ms += load_ms;
+        return;
+    }
+
+    start = clock::now();
+    build_tree();
+    const double build_ms = milliseconds_since(start);
+    start = clock::now();
+    save(path, key, time0, time1, bvh);
+    const double save_ms = milliseconds_since(start);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++totals.misses;
+    totals.hash_ms += hash_ms;
+    totals.build_ms += build_ms;
+    totals.save_ms += save_ms;
+}
+
+inline bool bvh_cache::load(const std::string& path, std::uint64_t key, size_t primitive_count, bool motion,
+    flat_bvh& bvh) const
+{
+    const mapped_file file(path);
+    if (!file.is_open() || file.size() < sizeof(file_header))
+        return false;
+
+    file_header header{};
+    std::memcpy(&header, file.data(), sizeof header);
+    if (std::memcmp(header.magic, magic, sizeof header.magic) != 0 || header.version != version || header.key != key
+        || header.primitive_count != primitive_count || (header.has_motion != 0) != motion || header.node_count == 0)
+        return false;
+
+    auto align = [](std::uint64_t offset) { return (offset + section_alignment - 1) & ~(section_alignment - 1); };
+    const std::uint64_t nodes_offset = align(sizeof header);
+    const std::uint64_t indices_offset = align(nodes_offset + header.node_count * sizeof(flat_bvh_node));
+    const std::uint64_t indices_end = indices_offset + primitive_count * sizeof(std::uint32_t);
+    const std::uint64_t end_boxes_offset = align(indices_end);
+    const std::uint64_t file_end = motion ? end_boxes_offset + header.node_count * sizeof(aabb) : indices_end;
+    if (header.node_count > file.size() / sizeof(flat_bvh_node) || file_end > file.size())
+        return false;
+
+    // A truncated or foreign file must not produce out-of-range indices.
+    const auto* nodes = reinterpret_cast<const flat_bvh_node*>(file.data() + nodes_offset);
+    const auto* indices = reinterpret_cast<const std::uint32_t*>(file.data() + indices_offset);
+    if (!flat_bvh::valid_layout(nodes, header.node_count, indices, primitive_count, primitive_count))
+        return false;
+
+    bvh.assign(nodes, header.node_count, indices, primitive_count,
+        motion ? reinterpret_cast<const aabb*>(file.data() + end_boxes_offset) : nullptr, header.time0, header.time1);
+    return true;
+}
+
+// Writes to path + ".tmp" and renames it into place, so a concurrent reader
+// or a kill mid-write never sees a partial file.
+inline bool bvh_cache::save(const std::string& path, std::uint64_t key, double time0, double time1,
+    const flat_bvh& bvh) const
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write BVH cache file '" << temporary << "'.\n";
+            return false;
+        }
+
+        file_header header{};
+        std::memcpy(header.magic, magic, sizeof header.magic);
+        header.version = version;
+        header.has_motion = bvh.has_motion() ? 1 : 0;
+        header.key = key;
+        header.primitive_count = bvh.primitive_indices.size();
+        header.node_count = bvh.nodes.size();
+        header.time0 = time0;
+        header.time1 = time1;
+
+        const char padding[section_alignment] = {};
+        auto write_section = [&](const void* data, size_t size) {
+            const auto position = static_cast<std::uint64_t>(out.tellp());
+            out.write(padding, static_cast<std::streamsize>((section_alignment - position % section_alignment) % section_alignment));
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        write_section(bvh.nodes.data(), bvh.nodes.size() * sizeof(flat_bvh_node));
+        write_section(bvh.primitive_indices.data(), bvh.primitive_indices.size() * sizeof(std::uint32_t));
+        if (bvh.has_motion())
+            write_section(bvh.end_boxes.data(), bvh.end_boxes.size() * sizeof(aabb));
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write BVH cache file '" << temporary << "'.\n";
+            return false;
+        }
+    }
+
+    std::remove(path.c_str()); // rename() does not replace on Windows
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "ERROR: Could not move BVH cache file into place at '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -45,16 +45,30 @@ public:
 	//    //{ (0,0,0),  (-1, -1.77, -1) + [i/width * (1,0,0)] + [j/height * (0,1.77,0)] }
 	//}
 
+	// Enables ray differentials: one pixel in s and t, narrowed as the pixel
+	// is split over more samples (as in pbrt, never below 1/8 of a pixel).
+	void set_image_size(int image_width, int image_height, int samples_per_pixel)
+	{
+		const double scale = fmax(0.125, 1.0 / sqrt(static_cast<double>(samples_per_pixel)));
+		pixel_ds = scale / (image_width - 1);
+		pixel_dt = scale / (image_height - 1);
+	}
+
 	[[nodiscard]] ray get_ray(double s, double t) const
 	{
 		const vec3 rd = lens_radius * random_in_unit_disk();
 		const vec3 offset = u * rd.x() + v * rd.y();
+		const vec3 direction = lower_left_corner + s * horizontal + t * vertical - origin - offset;
 
-		return ray{
-			origin + offset,
-			lower_left_corner + s * horizontal + t * vertical - origin - offset,
-			random_double(time0, time1)
-		};
+		ray r{ origin + offset, direction, random_double(time0, time1) };
+		if (pixel_ds > 0)
+		{
+			// The offset rays share the lens sample, so only their directions differ.
+			r.set_differentials(
+				r.origin(), direction + pixel_ds * horizontal,
+				r.origin(), direction + pixel_dt * vertical);
+		}
+		return r;
 	}
 
 private:
@@ -67,5 +81,7 @@ private:
 	double lens_radius;
 
 	double time0, time1; //shutter open/close times
+
+	double pixel_ds{ 0 }, pixel_dt{ 0 }; // zero disables ray differentials
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,263 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+
+// What a render was of, beyond its render_settings. A checkpoint only
+// resumes onto the same scene.
+struct checkpoint_scene
+{
+    std::uint64_t file_hash{ 0 };   // of a --scene or --obj file's contents; 0 for the built-in stills
+    std::int32_t size{ 0 };         // the built-in still's --scene-size
+    double glow{ 0 };               // the fraction of its spheres that --glow made lights
+    std::int32_t forest_trees{ 0 }; // --forest's tree count; 0 for other scenes
+};
+
+// How render_settings light the scene, as a checkpoint records it: 0 sky or
+// scattered rays alone, else 1 + the light_selection of the sampled lights.
+inline std::uint8_t checkpoint_lighting(const render_settings& settings)
+{
+    if (!settings.lights)
+        return 0;
+    return static_cast<std::uint8_t>(1 + static_cast<int>(settings.lights->selected()));
+}
+
+// FNV-1a over a file's bytes; 0 if it cannot be read.
+inline std::uint64_t hash_scene_file(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return 0;
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    std::vector<char> buffer(1 << 16);
+    while (in.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || in.gcount() > 0)
+    {
+        const auto count = static_cast<size_t>(in.gcount());
+        for (size_t i = 0; i < count; ++i)
+            hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// An in-progress render that can be saved and picked up again: the sample
+// sums, how many samples each pixel has, and where each pixel's random
+// sequence stands. Pixels draw from their own generator, so finishing the
+// remaining samples after a resume replays exactly the numbers an
+// uninterrupted run would have used, and the image comes out identical.
+struct render_progress
+{
+    checkpoint_scene scene; // set by the caller before start() or load_checkpoint()
+    int frame{ 0 };
+    frame_image image;
+    std::vector<std::uint32_t> sample_counts;
+    std::vector<pcg32> generators;
+
+    void start(const render_settings& settings, int frame_number)
+    {
+        frame = frame_number;
+        image.resize(settings.image_width, settings.image_height, settings.samples_per_pixel);
+        const size_t pixel_count = image.pixels.size();
+        sample_counts.assign(pixel_count, 0);
+        generators.resize(pixel_count);
+        for (size_t p = 0; p < pixel_count; ++p)
+            generators[p].seed(pixel_seed(static_cast<std::uint64_t>(frame), p));
+    }
+
+    [[nodiscard]] bool finished() const
+    {
+        for (const std::uint32_t count : sample_counts)
+        {
+            if (count < static_cast<std::uint32_t>(image.samples_per_pixel))
+                return false;
+        }
+        return true;
+    }
+};
+
+// Checkpoint file: header, then per pixel the three double sums, the sample
+// count and the generator (state, increment). Doubles rather than floats so
+// the resumed sums are bit-for-bit those of an uninterrupted render.
+struct checkpoint_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::int32_t image_width;
+    std::int32_t image_height;
+    std::int32_t samples_per_pixel;
+    std::int32_t max_depth;
+    std::int32_t frame;
+    std::int32_t scene_size;
+    std::uint64_t scene_hash;
+    double glow;
+    std::uint8_t sky;
+    std::uint8_t lighting; // checkpoint_lighting()
+    std::uint8_t reserved[2];
+    std::int32_t forest_trees;
+};
+
+constexpr char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+constexpr std::uint32_t checkpoint_version = 4;
+
+// Writes to path + ".tmp" and renames it over `path`, so a kill mid-write
+// leaves the previous checkpoint intact.
+inline bool save_checkpoint(const std::string& path, const render_settings& settings, const render_progress& progress)
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write checkpoint '" << temporary << "'.\n";
+            return false;
+        }
+
+        checkpoint_header header{};
+        std::memcpy(header.magic, checkpoint_magic, sizeof header.magic);
+        header.version = checkpoint_version;
+        header.image_width = settings.image_width;
+        header.image_height = settings.image_height;
+        header.samples_per_pixel = settings.samples_per_pixel;
+        header.max_depth = settings.max_depth;
+        header.frame = progress.frame;
+        header.scene_size = progress.scene.size;
+        header.scene_hash = progress.scene.file_hash;
+        header.glow = progress.scene.glow;
+        header.sky = settings.sky ? 1 : 0;
+        header.lighting = checkpoint_lighting(settings);
+        header.forest_trees = progress.scene.forest_trees;
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+
+        for (size_t p = 0; p < progress.image.pixels.size(); ++p)
+        {
+            const color& sum = progress.image.pixels[p];
+            out.write(reinterpret_cast<const char*>(sum.e), sizeof sum.e);
+            out.write(reinterpret_cast<const char*>(&progress.sample_counts[p]), sizeof(std::uint32_t));
+            out.write(reinterpret_cast<const char*>(&progress.generators[p].state), sizeof(std::uint64_t));
+            out.write(reinterpret_cast<const char*>(&progress.generators[p].increment), sizeof(std::uint64_t));
+        }
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write checkpoint '" << temporary << "'.\n";
+            return false;
+        }
+    }
+
+    std::remove(path.c_str()); // rename() does not replace on Windows
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "ERROR: Could not move checkpoint into place at '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool load_checkpoint(const std::string& path, const render_settings& settings, render_progress& progress)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not open checkpoint '" << path << "'.\n";
+        return false;
+    }
+
+    checkpoint_header header{};
+    in.read(reinterpret_cast<char*>(&header), sizeof header);
+    if (!in || std::memcmp(header.magic, checkpoint_magic, sizeof header.magic) != 0 || header.version != checkpoint_version)
+    {
+        std::cerr << "ERROR: '" << path << "' is not a checkpoint file.\n";
+        return false;
+    }
+    if (header.image_width != settings.image_width || header.image_height != settings.image_height
+        || header.samples_per_pixel != settings.samples_per_pixel || header.max_depth != settings.max_depth
+        || header.scene_size != progress.scene.size || header.scene_hash != progress.scene.file_hash
+        || header.glow != progress.scene.glow || header.sky != (settings.sky ? 1 : 0)
+        || header.lighting != checkpoint_lighting(settings) || header.forest_trees != progress.scene.forest_trees)
+    {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was made with different render settings.\n";
+        return false;
+    }
+
+    progress.start(settings, header.frame);
+    for (size_t p = 0; p < progress.image.pixels.size(); ++p)
+    {
+        color& sum = progress.image.pixels[p];
+        in.read(reinterpret_cast<char*>(sum.e), sizeof sum.e);
+        in.read(reinterpret_cast<char*>(&progress.sample_counts[p]), sizeof(std::uint32_t));
+        in.read(reinterpret_cast<char*>(&progress.generators[p].state), sizeof(std::uint64_t));
+        in.read(reinterpret_cast<char*>(&progress.generators[p].increment), sizeof(std::uint64_t));
+    }
+    if (!in)
+    {
+        std::cerr << "ERROR: Checkpoint '" << path << "' is truncated.\n";
+        return false;
+    }
+    return true;
+}
+
+// Renders in passes of samples_per_pass samples per pixel until every pixel
+// has settings.samples_per_pixel, saving a checkpoint after any pass that
+// ends more than checkpoint_seconds after the last one (never, if the path is
+// empty). Picks up wherever `progress` stands.
+inline bool render_with_checkpoints(const hittable& world, const camera& cam, const render_settings& settings,
+    render_progress& progress, int samples_per_pass, const std::string& checkpoint_path, double checkpoint_seconds)
+{
+    using clock = std::chrono::steady_clock;
+    constexpr int tile_size = 16;
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+    const auto total_samples = static_cast<std::uint32_t>(settings.samples_per_pixel);
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+
+    auto last_checkpoint = clock::now();
+    while (!progress.finished())
+    {
+        parallel_for(static_cast<size_t>(tiles_x) * tiles_y, [&](size_t tile) {
+            const int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+            const int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+            pcg32& generator = thread_random();
+            for (int j = y0; j < std::min(y0 + tile_size, height); ++j)
+            {
+                for (int i = x0; i < std::min(x0 + tile_size, width); ++i)
+                {
+                    const size_t p = static_cast<size_t>(j) * width + i;
+                    const std::uint32_t end = std::min(total_samples, progress.sample_counts[p] + samples_per_pass);
+                    generator = progress.generators[p];
+                    color& pixel_color = progress.image.pixels[p];
+                    for (std::uint32_t s = progress.sample_counts[p]; s < end; ++s)
+                    {
+                        const double u = (i + random_double()) / (width - 1);
+                        const double v = (j + random_double()) / (height - 1);
+                        RT_COUNT(primary_rays);
+                        pixel_color += trace(cam.get_ray(u, v), world, settings);
+                    }
+                    progress.sample_counts[p] = end;
+                    progress.generators[p] = generator;
+                }
+            }
+        }, settings.thread_count);
+
+        if (settings.show_progress)
+            std::cerr << "\rSamples per pixel: " << progress.sample_counts.front() << " of " << total_samples << ' ' << std::flush;
+
+        if (!checkpoint_path.empty() && !progress.finished()
+            && std::chrono::duration<double>(clock::now() - last_checkpoint).count() >= checkpoint_seconds)
+        {
+            if (!save_checkpoint(checkpoint_path, settings, progress))
+                return false;
+            last_checkpoint = clock::now();
+        }
+    }
+    return true;
+}
+
+#endif
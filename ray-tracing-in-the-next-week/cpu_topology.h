@@ -0,0 +1,283 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "parallel.h"
+
+// Logical CPUs and how they share cores, packages and NUMA nodes, for placing
+// benchmark threads. Read from /sys on Linux and from
+// GetLogicalProcessorInformation on Windows (processor group 0 only, so at
+// most 64 CPUs there). Anywhere else, or when that fails, every hardware
+// thread counts as its own core on one node.
+struct logical_cpu
+{
+    unsigned id{ 0 };
+    int package{ 0 };
+    int core{ 0 };      // unique across packages
+    int node{ 0 };
+    int smt_index{ 0 }; // 0 for the first hardware thread of its core, 1 for its sibling, ...
+};
+
+// How --pin places the threads of a parallel_for.
+enum class pin_policy
+{
+    none,  // wherever the OS schedules them
+    cores, // one thread per physical core first, SMT siblings only once every core has one
+    smt,   // both hardware threads of a core before the next core
+    numa,  // round-robin over NUMA nodes, each thread free within its node
+};
+
+class cpu_topology
+{
+public:
+    [[nodiscard]] static cpu_topology detect();
+
+    [[nodiscard]] const std::vector<logical_cpu>& cpus() const { return logical; }
+    [[nodiscard]] int node_count() const { return nodes; }
+    [[nodiscard]] int core_count() const { return cores; }
+
+    // The CPUs the `index`th worker thread may run on under `policy`; empty
+    // for pin_policy::none.
+    [[nodiscard]] std::vector<unsigned> placement(pin_policy policy, unsigned index) const;
+
+private:
+    void finish();
+
+    std::vector<logical_cpu> logical;
+    int nodes{ 1 };
+    int cores{ 1 };
+};
+
+// The CPUs the calling thread may run on (on Windows, which has no per-thread
+// query, the process's).
+inline std::vector<unsigned> current_thread_cpus()
+{
+    std::vector<unsigned> cpus;
+#ifdef _WIN32
+    DWORD_PTR mask = 0, system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask))
+    {
+        for (unsigned cpu = 0; cpu < 8 * sizeof(DWORD_PTR); ++cpu)
+        {
+            if (mask & (DWORD_PTR{ 1 } << cpu))
+                cpus.push_back(cpu);
+        }
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof set, &set) == 0)
+    {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+// Restricts the calling thread to `cpus`.
+inline bool pin_current_thread(const std::vector<unsigned>& cpus)
+{
+#ifdef _WIN32
+    DWORD_PTR mask = 0;
+    for (const unsigned cpu : cpus)
+    {
+        if (cpu < 8 * sizeof(DWORD_PTR))
+            mask |= DWORD_PTR{ 1 } << cpu;
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+#endif
+}
+
+#ifndef _WIN32
+namespace topology_detail
+{
+
+// Parses a sysfs CPU list such as "0-3,8-11".
+inline std::vector<unsigned> read_cpu_list(const std::string& path)
+{
+    std::vector<unsigned> cpus;
+    std::ifstream in(path);
+    std::string text;
+    if (!std::getline(in, text))
+        return cpus;
+    size_t begin = 0;
+    while (begin < text.size())
+    {
+        size_t end = text.find(',', begin);
+        if (end == std::string::npos)
+            end = text.size();
+        unsigned first = 0, last = 0;
+        const int fields = std::sscanf(text.substr(begin, end - begin).c_str(), "%u-%u", &first, &last);
+        if (fields == 1)
+            last = first;
+        if (fields >= 1)
+        {
+            for (unsigned cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        begin = end + 1;
+    }
+    return cpus;
+}
+
+inline int read_int(const std::string& path, int fallback)
+{
+    std::ifstream in(path);
+    int value = fallback;
+    in >> value;
+    return in ? value : fallback;
+}
+
+} // namespace topology_detail
+#endif
+
+inline cpu_topology cpu_topology::detect()
+{
+    cpu_topology topology;
+#ifdef _WIN32
+    DWORD bytes = 0;
+    GetLogicalProcessorInformation(nullptr, &bytes);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> entries(bytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!entries.empty() && GetLogicalProcessorInformation(entries.data(), &bytes))
+    {
+        std::vector<logical_cpu> by_id(8 * sizeof(ULONG_PTR));
+        std::vector<bool> present(by_id.size(), false);
+        int core = 0, package = 0;
+        for (const auto& entry : entries)
+        {
+            for (unsigned cpu = 0; cpu < by_id.size(); ++cpu)
+            {
+                if (!(entry.ProcessorMask & (ULONG_PTR{ 1 } << cpu)))
+                    continue;
+                by_id[cpu].id = cpu;
+                if (entry.Relationship == RelationProcessorCore)
+                {
+                    present[cpu] = true;
+                    by_id[cpu].core = core;
+                }
+                else if (entry.Relationship == RelationProcessorPackage)
+                    by_id[cpu].package = package;
+                else if (entry.Relationship == RelationNumaNode)
+                    by_id[cpu].node = static_cast<int>(entry.NumaNode.NodeNumber);
+            }
+            core += entry.Relationship == RelationProcessorCore;
+            package += entry.Relationship == RelationProcessorPackage;
+        }
+        for (unsigned cpu = 0; cpu < by_id.size(); ++cpu)
+        {
+            if (present[cpu])
+                topology.logical.push_back(by_id[cpu]);
+        }
+    }
+#else
+    using namespace topology_detail;
+    const std::string root = "/sys/devices/system/cpu/";
+    for (const unsigned cpu : read_cpu_list(root + "online"))
+    {
+        const std::string dir = root + "cpu" + std::to_string(cpu) + "/topology/";
+        logical_cpu entry;
+        entry.id = cpu;
+        entry.package = read_int(dir + "physical_package_id", 0);
+        // core_id repeats across packages; the first sibling's id is unique.
+        const std::vector<unsigned> siblings = read_cpu_list(dir + "thread_siblings_list");
+        entry.core = siblings.empty() ? static_cast<int>(cpu) : static_cast<int>(siblings.front());
+        topology.logical.push_back(entry);
+    }
+    for (int node = 0;; ++node)
+    {
+        const std::vector<unsigned> node_cpus = read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (node_cpus.empty() && node > 0)
+            break;
+        for (logical_cpu& entry : topology.logical)
+        {
+            if (std::find(node_cpus.begin(), node_cpus.end(), entry.id) != node_cpus.end())
+                entry.node = node;
+        }
+        if (node_cpus.empty())
+            break;
+    }
+#endif
+    if (topology.logical.empty())
+    {
+        for (unsigned cpu = 0; cpu < hardware_threads(); ++cpu)
+            topology.logical.push_back({ cpu, 0, static_cast<int>(cpu), 0, 0 });
+    }
+    topology.finish();
+    return topology;
+}
+
+// Numbers the hardware threads of each core and counts cores and nodes.
+inline void cpu_topology::finish()
+{
+    std::sort(logical.begin(), logical.end(), [](const logical_cpu& a, const logical_cpu& b) {
+        return std::tie(a.package, a.core, a.id) < std::tie(b.package, b.core, b.id);
+    });
+    cores = 0;
+    nodes = 1;
+    for (size_t i = 0; i < logical.size(); ++i)
+    {
+        const bool same_core = i > 0 && logical[i].core == logical[i - 1].core && logical[i].package == logical[i - 1].package;
+        logical[i].smt_index = same_core ? logical[i - 1].smt_index + 1 : 0;
+        cores += !same_core;
+        nodes = std::max(nodes, logical[i].node + 1);
+    }
+}
+
+inline std::vector<unsigned> cpu_topology::placement(pin_policy policy, unsigned index) const
+{
+    if (policy == pin_policy::none || logical.empty())
+        return {};
+
+    if (policy == pin_policy::numa)
+    {
+        // Nodes without CPUs (memory-only) are skipped.
+        std::vector<std::vector<unsigned>> by_node(static_cast<size_t>(nodes));
+        for (const logical_cpu& cpu : logical)
+            by_node[static_cast<size_t>(cpu.node)].push_back(cpu.id);
+        by_node.erase(std::remove_if(by_node.begin(), by_node.end(), [](const auto& cpus) { return cpus.empty(); }), by_node.end());
+        return by_node[index % by_node.size()];
+    }
+
+    // logical is in (package, core, smt_index) order, which is already the
+    // smt policy's order; cores takes every core's first thread, then every
+    // core's second, ...
+    std::vector<logical_cpu> order = logical;
+    if (policy == pin_policy::cores)
+    {
+        std::stable_sort(order.begin(), order.end(), [](const logical_cpu& a, const logical_cpu& b) {
+            return a.smt_index < b.smt_index;
+        });
+    }
+    return { order[index % order.size()].id };
+}
+
+#endif
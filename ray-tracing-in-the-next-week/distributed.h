@@ -0,0 +1,322 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net_socket.h"
+#include "renderer.h"
+
+// Tile rendering spread over worker processes. The coordinator listens on a
+// TCP port and hands out tiles to whichever worker asks; every worker builds
+// its own copy of the scene and BVH, renders the tile with all its threads and
+// sends back the tile's sample sums, which the coordinator copies into the
+// frame. Pixels are seeded by (frame, pixel), so the image is identical to a
+// local render whatever the worker count. Both ends must be the same build:
+// messages are raw structs in host byte order.
+namespace distributed {
+
+constexpr char worker_magic[8] = { 'R', 'T', 'W', 'O', 'R', 'K', '0', '2' };
+
+// Which scene the workers build, and how: the meaning of every field is up
+// to the caller's scene factory.
+struct scene_parameters
+{
+    std::uint32_t scene{ 0 }; // e.g. still or animation
+    std::int32_t size{ 0 };
+    double glow{ 0 };
+    std::uint8_t light_selection{ 0 };
+};
+
+struct job_message
+{
+    std::int32_t image_width;
+    std::int32_t image_height;
+    std::int32_t samples_per_pixel;
+    std::int32_t max_depth;
+    std::uint8_t sky;             // render_settings::sky
+    std::uint8_t direct_lighting; // sample the scene's lights() directly
+    scene_parameters scene;
+};
+
+struct tile_message
+{
+    std::uint32_t done; // nonzero: no more work, disconnect
+    std::int32_t frame;
+    std::int32_t x0, y0, x1, y1;
+};
+
+// Creates a worker's scene from the job's parameters (e.g. still or animation).
+using scene_factory = std::function<std::unique_ptr<animated_scene>(const scene_parameters& scene)>;
+
+// Connects to a coordinator and renders tiles until told to stop. Returns
+// false if the coordinator could not be reached or went away mid-job.
+inline bool run_worker(const std::string& host, std::uint16_t port, const scene_factory& create_scene,
+    unsigned thread_count = 0)
+{
+    const net_socket coordinator = net_socket::connect_to(host, port);
+    if (!coordinator.is_open())
+    {
+        std::cerr << "ERROR: Could not connect to coordinator " << host << ":" << port << ".\n";
+        return false;
+    }
+
+    job_message job{};
+    if (!coordinator.send_all(worker_magic, sizeof worker_magic) || !coordinator.receive_value(job))
+        return false;
+
+    render_settings settings;
+    settings.image_width = job.image_width;
+    settings.image_height = job.image_height;
+    settings.samples_per_pixel = job.samples_per_pixel;
+    settings.max_depth = job.max_depth;
+    settings.thread_count = thread_count;
+    settings.sky = job.sky != 0;
+
+    const std::unique_ptr<animated_scene> scene = create_scene(job.scene);
+    if (!scene)
+        return false;
+    if (job.direct_lighting)
+        settings.lights = scene->lights();
+    int scene_frame = -1;
+    bool scene_ready = false;
+    camera cam = scene->frame_camera();
+
+    frame_image image;
+    image.resize(settings.image_width, settings.image_height, settings.samples_per_pixel);
+    std::vector<color> pixels;
+
+    tile_message tile{};
+    while (coordinator.receive_value(tile))
+    {
+        if (tile.done)
+            return true;
+
+        if (!scene_ready || tile.frame != scene_frame)
+        {
+            scene->set_frame(tile.frame);
+            scene_frame = tile.frame;
+            scene_ready = true;
+            cam = scene->frame_camera();
+            cam.set_image_size(settings.image_width, settings.image_height, settings.samples_per_pixel);
+        }
+
+        render_region(scene->world(), cam, settings, static_cast<std::uint64_t>(tile.frame),
+            tile.x0, tile.y0, tile.x1, tile.y1, image);
+
+        pixels.clear();
+        for (int j = tile.y0; j < tile.y1; ++j)
+            pixels.insert(pixels.end(), &image.at(tile.x0, j), &image.at(tile.x0, j) + (tile.x1 - tile.x0));
+        if (!coordinator.send_all(pixels.data(), pixels.size() * sizeof(color)))
+            return false;
+    }
+    return false;
+}
+
+struct coordinator_settings
+{
+    std::uint16_t port{ 0 };       // 0 = any free port
+    int tile_size{ 64 };           // big enough that a tile keeps a worker's threads busy
+    scene_parameters scene;        // passed to the workers' scene factory
+    bool direct_lighting{ false }; // workers sample their scene's lights() directly
+    // Called with the port once listening, e.g. to launch local workers.
+    std::function<void(std::uint16_t)> on_listening;
+    // Whether workers the caller launched may still connect. Once it says no
+    // while no worker is connected, nothing is left to finish the frames.
+    std::function<bool()> workers_starting;
+    // Seconds to wait for a worker while none is connected; 0 waits forever.
+    double idle_timeout{ 120.0 };
+};
+
+// Renders `frames`, writing each to path_for_frame(frame) as soon as its last
+// tile is in. Tiles are queued frame by frame and taken by whichever worker
+// asks next; a tile whose worker disconnects goes back on the queue. Workers
+// may join at any time. Returns once every frame is written, or with false
+// once no worker is connected and none can be expected (see
+// coordinator_settings) while frames are still outstanding.
+inline bool run_coordinator(const std::vector<int>& frames, const render_settings& settings,
+    const coordinator_settings& options, const std::function<std::string(int)>& path_for_frame)
+{
+    using clock = std::chrono::steady_clock;
+
+    const net_socket listener = net_socket::listen_on(options.port);
+    if (!listener.is_open())
+    {
+        std::cerr << "ERROR: Could not listen on port " << options.port << ".\n";
+        return false;
+    }
+    const std::uint16_t port = listener.local_port();
+    std::cerr << "Coordinator listening on port " << port << "\n";
+    if (options.on_listening)
+        options.on_listening(port);
+
+    struct frame_state
+    {
+        frame_image image;
+        size_t tiles_left{ 0 };
+        clock::time_point started;
+    };
+
+    std::mutex mutex;
+    std::condition_variable work_changed;
+    std::deque<tile_message> queue;
+    std::map<int, frame_state> open_frames;
+    size_t tiles_in_flight = 0;
+    size_t frames_left = frames.size();
+    int connected_workers = 0;
+    bool failed = false;
+
+    const int tile = std::max(1, options.tile_size);
+    const int tiles_x = (settings.image_width + tile - 1) / tile;
+    const int tiles_y = (settings.image_height + tile - 1) / tile;
+    for (const int frame : frames)
+    {
+        for (int ty = 0; ty < tiles_y; ++ty)
+        {
+            for (int tx = 0; tx < tiles_x; ++tx)
+            {
+                queue.push_back({ 0, frame, tx * tile, ty * tile,
+                    std::min((tx + 1) * tile, settings.image_width), std::min((ty + 1) * tile, settings.image_height) });
+            }
+        }
+    }
+
+    const auto sequence_start = clock::now();
+
+    auto serve_worker = [&](net_socket worker, int worker_id) {
+        char magic[sizeof worker_magic];
+        const job_message job{ settings.image_width, settings.image_height, settings.samples_per_pixel,
+                               settings.max_depth, static_cast<std::uint8_t>(settings.sky ? 1 : 0),
+                               static_cast<std::uint8_t>(options.direct_lighting ? 1 : 0), options.scene };
+        if (!worker.receive_all(magic, sizeof magic) || std::memcmp(magic, worker_magic, sizeof magic) != 0
+            || !worker.send_value(job))
+            return;
+
+        size_t tiles_done = 0;
+        std::vector<color> pixels;
+        while (true)
+        {
+            tile_message next{};
+            frame_image* image = nullptr;
+            {
+                std::unique_lock lock(mutex);
+                work_changed.wait(lock, [&] { return !queue.empty() || tiles_in_flight == 0; });
+                if (queue.empty())
+                    break;
+                next = queue.front();
+                queue.pop_front();
+                ++tiles_in_flight;
+
+                auto [state, inserted] = open_frames.try_emplace(next.frame);
+                if (inserted)
+                {
+                    state->second.image.resize(settings.image_width, settings.image_height, settings.samples_per_pixel);
+                    state->second.tiles_left = static_cast<size_t>(tiles_x) * tiles_y;
+                    state->second.started = clock::now();
+                }
+                image = &state->second.image;
+            }
+
+            pixels.resize(static_cast<size_t>(next.x1 - next.x0) * (next.y1 - next.y0));
+            if (!worker.send_value(next) || !worker.receive_all(pixels.data(), pixels.size() * sizeof(color)))
+            {
+                std::lock_guard lock(mutex);
+                std::cerr << "Worker " << worker_id << " dropped; requeueing its tile.\n";
+                queue.push_front(next);
+                --tiles_in_flight;
+                work_changed.notify_all();
+                return;
+            }
+            ++tiles_done;
+
+            // Tiles don't overlap, so copying needs no lock.
+            const color* source = pixels.data();
+            for (int j = next.y0; j < next.y1; ++j, source += next.x1 - next.x0)
+                std::copy(source, source + (next.x1 - next.x0), &image->at(next.x0, j));
+
+            std::unique_lock lock(mutex);
+            --tiles_in_flight;
+            frame_state& state = open_frames[next.frame];
+            if (--state.tiles_left == 0)
+            {
+                frame_state finished = std::move(state);
+                open_frames.erase(next.frame);
+                lock.unlock();
+                const bool written = write_ppm(path_for_frame(next.frame), finished.image);
+                const double seconds = std::chrono::duration<double>(clock::now() - finished.started).count();
+                lock.lock();
+                failed = failed || !written;
+                std::cerr << "frame " << next.frame << " done in " << seconds << " s\n";
+                --frames_left;
+            }
+            work_changed.notify_all();
+        }
+
+        worker.send_value(tile_message{ 1, 0, 0, 0, 0, 0 });
+        std::lock_guard lock(mutex);
+        std::cerr << "Worker " << worker_id << " finished after " << tiles_done << " tiles.\n";
+    };
+
+    std::vector<std::thread> connections;
+    int worker_count = 0;
+    auto idle_since = clock::now();
+    while (true)
+    {
+        {
+            std::lock_guard lock(mutex);
+            if (frames_left == 0)
+                break;
+            if (connected_workers > 0)
+                idle_since = clock::now();
+            else if (options.workers_starting && !options.workers_starting())
+            {
+                std::cerr << "ERROR: Every worker has exited with " << frames_left << " frames unfinished.\n";
+                failed = true;
+                break;
+            }
+            else if (options.idle_timeout > 0
+                && std::chrono::duration<double>(clock::now() - idle_since).count() > options.idle_timeout)
+            {
+                std::cerr << "ERROR: No worker connected for " << options.idle_timeout << " s with " << frames_left
+                          << " frames unfinished.\n";
+                failed = true;
+                break;
+            }
+        }
+        net_socket worker = listener.accept(100);
+        if (worker.is_open())
+        {
+            {
+                std::lock_guard lock(mutex);
+                ++connected_workers;
+            }
+            connections.emplace_back([&](net_socket connection, int worker_id) {
+                serve_worker(std::move(connection), worker_id);
+                std::lock_guard lock(mutex);
+                --connected_workers;
+            }, std::move(worker), worker_count++);
+        }
+    }
+    for (auto& connection : connections)
+        connection.join();
+
+    const double seconds = std::chrono::duration<double>(clock::now() - sequence_start).count();
+    if (frames_left == 0)
+        std::cerr << frames.size() << " frames from " << worker_count << " workers in " << seconds << " s\n";
+    return !failed;
+}
+
+} // namespace distributed
+
+#endif
@@ -0,0 +1,809 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "aabb.h"
+#include "parallel.h"
+#include "render_stats.h"
+
+// A BVH stored as one array of nodes in depth-first order, built over plain
+// primitive boxes. It knows nothing about what the primitives are: owners
+// (meshes, scene-level structures) map leaf ranges back to their own data.
+struct flat_bvh_node
+{
+    aabb box;
+    std::uint32_t offset{ 0 }; // leaf: first entry in primitive_indices; interior: right child
+    std::uint16_t count{ 0 };  // primitives in the leaf, 0 for interior nodes (left child = this + 1)
+    std::uint8_t axis{ 0 };    // split axis, used to visit the nearer child first
+    std::uint8_t flags{ 0 };
+};
+
+enum class bvh_builder : std::uint8_t
+{
+    binned_sah,      // top-down binned SAH: the best trees, the slowest build
+    morton,          // linear BVH over Morton-sorted centroids: the fastest build
+    morton_treelets, // linear BVH, then treelet restructuring towards SAH quality
+};
+
+// How owners that keep a traversal copy (quantized_bvh.h) store its nodes.
+enum class bvh_node_format : std::uint8_t
+{
+    full,        // traverse the flat_bvh itself
+    quantized16, // 16-bit child boxes relative to the parent's
+    quantized8,  // 8-bit child boxes: smallest, loosest
+};
+
+struct bvh_build_options
+{
+    bvh_builder builder{ bvh_builder::binned_sah };
+    unsigned morton_bits{ 63 };      // Morton code length for the morton builders: 30 or 63
+    unsigned max_leaf_size{ 4 };
+    unsigned bin_count{ 16 };        // at most flat_bvh::max_bin_count
+    double traversal_cost{ 1.0 };    // SAH cost of visiting a node ...
+    double intersection_cost{ 1.0 }; // ... relative to testing one primitive
+    unsigned thread_count{ 0 };      // 0 = one per hardware thread; the tree is the same for any count
+    bvh_node_format node_format{ bvh_node_format::full }; // for the owner's traversal copy; the build ignores it
+};
+
+inline aabb empty_box()
+{
+    return aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+}
+
+// Plain comparisons rather than fmin/fmax: these run for every primitive at
+// every level of a build, and fmin's NaN handling keeps it out of line.
+inline void grow(aabb& box, const aabb& other)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        box.minimum.e[a] = other.minimum.e[a] < box.minimum.e[a] ? other.minimum.e[a] : box.minimum.e[a];
+        box.maximum.e[a] = other.maximum.e[a] > box.maximum.e[a] ? other.maximum.e[a] : box.maximum.e[a];
+    }
+}
+
+inline void grow(aabb& box, const point3& p)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        box.minimum.e[a] = p.e[a] < box.minimum.e[a] ? p.e[a] : box.minimum.e[a];
+        box.maximum.e[a] = p.e[a] > box.maximum.e[a] ? p.e[a] : box.maximum.e[a];
+    }
+}
+
+class flat_bvh
+{
+public:
+    static constexpr int max_depth = 128;
+    static constexpr unsigned max_bin_count = 64;
+
+    flat_bvh() = default;
+    flat_bvh(const std::vector<aabb>& primitive_boxes, const bvh_build_options& options = {})
+    {
+        build(primitive_boxes, options);
+    }
+
+    // Binned SAH build (Wald 2007) over the primitives' centroids, or a
+    // Morton-code linear build (morton_bvh.h) if options.builder says so. The top
+    // levels scan and partition their ranges in parallel blocks; below them
+    // the remaining subtrees are built as independent tasks and stitched
+    // back together in depth-first order.
+    void build(const std::vector<aabb>& primitive_boxes, const bvh_build_options& options = {});
+
+    // Build for primitives that move during the shutter [time0, time1], from
+    // their bounds at shutter open and close. Every node keeps both boxes and
+    // traversal interpolates them at the ray's time, so a ray only meets a
+    // moving primitive's box near where the primitive is at that time instead
+    // of everywhere along its path. The boxes must move linearly in time for
+    // the interpolated box to stay conservative, as moving_sphere's do.
+    void build_motion(const std::vector<aabb>& open_boxes, const std::vector<aabb>& close_boxes,
+        double time0, double time1, const bvh_build_options& options = {});
+
+    // Whether nodes and primitive order read back from a file describe a tree
+    // hit() can walk: every child after its parent and inside the node array,
+    // split axes 0-2, leaf ranges inside the order, every entry a primitive
+    // below primitive_count, and no node too deep for the traversal stack.
+    static bool valid_layout(const flat_bvh_node* node_data, size_t node_count, const std::uint32_t* index_data,
+        size_t index_count, size_t primitive_count);
+
+    // Takes a tree built earlier, e.g. read back from a file: nodes, primitive
+    // order and, for a motion tree, the end boxes and shutter.
+    void assign(const flat_bvh_node* node_data, size_t node_count, const std::uint32_t* index_data, size_t index_count,
+        const aabb* end_box_data = nullptr, double time0 = 0.0, double time1 = 0.0)
+    {
+        nodes.assign(node_data, node_data + node_count);
+        primitive_indices.assign(index_data, index_data + index_count);
+        if (end_box_data != nullptr)
+            end_boxes.assign(end_box_data, end_box_data + node_count);
+        else
+            end_boxes.clear();
+        set_shutter(time0, time1);
+    }
+
+    void set_shutter(double time0, double time1)
+    {
+        shutter_open = time0;
+        inverse_shutter_length = time1 > time0 ? 1.0 / (time1 - time0) : 0.0;
+    }
+
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+    [[nodiscard]] bool has_motion() const { return !end_boxes.empty(); }
+    [[nodiscard]] aabb bounds() const
+    {
+        if (nodes.empty())
+            return aabb();
+        aabb box = nodes[0].box;
+        if (has_motion())
+            grow(box, end_boxes[0]);
+        return box;
+    }
+
+    // Node i's box at normalized shutter time s (0 = open, 1 = close).
+    [[nodiscard]] aabb box_at(std::uint32_t i, double s) const
+    {
+        const aabb& start = nodes[i].box;
+        const aabb& end = end_boxes[i];
+        return aabb(start.minimum + s * (end.minimum - start.minimum), start.maximum + s * (end.maximum - start.maximum));
+    }
+
+    // Visits the nodes the ray passes through, nearer child first. For each
+    // leaf calls hit_leaf(first, count, t_max), which tests the leaf's
+    // primitives, shrinks t_max on a hit and returns whether it hit anything.
+    // A hit_leaf that sets t_max below t_min ends the traversal (any-hit
+    // queries do, on their first blocker).
+    template <typename LeafHit>
+    bool traverse(const ray& r, double t_min, double t_max, LeafHit&& hit_leaf) const;
+
+    // Recomputes every box bottom-up while keeping the topology, for when
+    // primitives move but stay the same primitives. leaf_box(first, count)
+    // returns the current bounds of a leaf's primitives. Independent subtrees
+    // are refit in parallel, then the few nodes above them.
+    template <typename LeafBox>
+    void refit(LeafBox&& leaf_box, unsigned thread_count = 0);
+
+    // Refit of a build_motion() tree, with leaf bounds at shutter open and close.
+    template <typename LeafBox, typename LeafEndBox>
+    void refit_motion(LeafBox&& leaf_box, LeafEndBox&& leaf_end_box, unsigned thread_count = 0);
+
+    // Expected cost of a random ray under the surface area heuristic,
+    // normalized by the root area. Refitting keeps the topology, so this grows
+    // as primitives drift away from where the build placed them. With motion,
+    // areas are averaged over the shutter.
+    [[nodiscard]] double sah_cost(const bvh_build_options& options = {}) const;
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::vector<flat_bvh_node> nodes;
+    std::vector<std::uint32_t> primitive_indices;
+    // Only for build_motion(): node bounds at shutter close (nodes[i].box is at
+    // shutter open), and the mapping from ray time to normalized shutter time.
+    std::vector<aabb> end_boxes;
+    double shutter_open{ 0 };
+    double inverse_shutter_length{ 0 };
+
+private:
+    // The build partitions copies of the boxes and centroids themselves,
+    // not indices to them, so every pass over a range reads memory in order.
+    struct build_item
+    {
+        aabb box;
+        point3 centroid;
+        std::uint32_t primitive;
+    };
+
+    struct build_state
+    {
+        std::vector<build_item> items;
+        const bvh_build_options& options;
+    };
+
+    // How a range of primitives is handled: its bounds and split axis, and
+    // either a leaf or the point where primitive_indices is now partitioned.
+    struct split_result
+    {
+        aabb box;
+        int axis{ 0 };
+        bool leaf{ false };
+        std::uint32_t mid{ 0 };
+    };
+
+    // A subtree left for a task: its node offsets are local to `nodes`.
+    struct subtree_task
+    {
+        std::uint32_t begin, end;
+        int depth;
+        std::vector<flat_bvh_node> nodes;
+    };
+
+    // How many median halvings `count` primitives need before they fit in
+    // one leaf. A range at depth d is only split freely while this stays
+    // below max_depth - 2 - d; past that the builders halve it, so no leaf
+    // ends up deeper than the traversal stack allows.
+    static int halvings_to_leaf(std::uint32_t count)
+    {
+        int halvings = 0;
+        for (; count > 0xffff; count -= count / 2)
+            ++halvings;
+        return halvings;
+    }
+
+    void build_morton(const std::vector<aabb>& primitive_boxes, const bvh_build_options& options);
+    void build_parallel(build_state& state, std::uint32_t primitive_count, unsigned thread_count);
+    split_result split_range(build_state& state, std::uint32_t begin, std::uint32_t end, int depth,
+        unsigned thread_count);
+    void build_recursive(build_state& state, std::uint32_t begin, std::uint32_t end, int depth,
+        std::vector<flat_bvh_node>& out);
+    void build_top(build_state& state, std::uint32_t begin, std::uint32_t end, int depth, std::uint32_t task_size,
+        unsigned thread_count, std::vector<flat_bvh_node>& top, std::vector<std::uint32_t>& top_task,
+        std::vector<subtree_task>& tasks);
+    void append_top(const std::vector<flat_bvh_node>& top, const std::vector<std::uint32_t>& top_task,
+        std::vector<subtree_task>& tasks, std::uint32_t i);
+
+    // Calls refit_node(i) for every node, children before parents.
+    template <typename RefitNode>
+    void refit_bottom_up(RefitNode&& refit_node, unsigned thread_count);
+};
+
+inline void flat_bvh::build(const std::vector<aabb>& primitive_boxes, const bvh_build_options& options)
+{
+    nodes.clear();
+    end_boxes.clear();
+    primitive_indices.resize(primitive_boxes.size());
+    if (primitive_boxes.empty())
+        return;
+    if (options.builder != bvh_builder::binned_sah)
+        return build_morton(primitive_boxes, options);
+
+    const unsigned thread_count = options.thread_count == 0 ? hardware_threads() : options.thread_count;
+    const auto primitive_count = static_cast<std::uint32_t>(primitive_boxes.size());
+    build_state state{ std::vector<build_item>(primitive_count), options };
+    parallel_for((primitive_count + 65535) / 65536, [&](size_t block) {
+        const std::uint32_t block_end = std::min(primitive_count, static_cast<std::uint32_t>(block + 1) * 65536);
+        for (auto i = static_cast<std::uint32_t>(block) * 65536; i < block_end; ++i)
+            state.items[i] = { primitive_boxes[i], 0.5 * (primitive_boxes[i].min() + primitive_boxes[i].max()), i };
+    }, thread_count);
+
+    if (thread_count <= 1)
+    {
+        nodes.reserve(2 * primitive_count / std::max(1u, options.max_leaf_size) + 1);
+        build_recursive(state, 0, primitive_count, 0, nodes);
+        nodes.shrink_to_fit();
+    }
+    else
+        build_parallel(state, primitive_count, thread_count);
+
+    parallel_for((primitive_count + 65535) / 65536, [&](size_t block) {
+        const std::uint32_t block_end = std::min(primitive_count, static_cast<std::uint32_t>(block + 1) * 65536);
+        for (auto i = static_cast<std::uint32_t>(block) * 65536; i < block_end; ++i)
+            primitive_indices[i] = state.items[i].primitive;
+    }, thread_count);
+}
+
+inline void flat_bvh::build_parallel(build_state& state, std::uint32_t primitive_count, unsigned thread_count)
+{
+    const bvh_build_options& options = state.options;
+
+    // Ranges of at most task_size primitives become tasks: enough of them
+    // (about 16 per thread) that the dynamic scheduling evens out their sizes.
+    const std::uint32_t task_size = std::max(4096u, primitive_count / (16 * thread_count));
+    std::vector<flat_bvh_node> top;
+    std::vector<std::uint32_t> top_task;
+    std::vector<subtree_task> tasks;
+    build_top(state, 0, primitive_count, 0, task_size, thread_count, top, top_task, tasks);
+
+    // Biggest subtrees first, so no thread starts a large one near the end.
+    std::vector<std::uint32_t> order(tasks.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return tasks[a].end - tasks[a].begin > tasks[b].end - tasks[b].begin;
+    });
+    parallel_for(order.size(), [&](size_t t) {
+        subtree_task& task = tasks[order[t]];
+        task.nodes.reserve(2 * (task.end - task.begin) / std::max(1u, options.max_leaf_size) + 1);
+        build_recursive(state, task.begin, task.end, task.depth, task.nodes);
+    }, thread_count);
+
+    size_t node_count = top.size();
+    for (const auto& task : tasks)
+        node_count += task.nodes.size();
+    nodes.reserve(node_count);
+    append_top(top, top_task, tasks, 0);
+}
+
+inline void flat_bvh::build_motion(const std::vector<aabb>& open_boxes, const std::vector<aabb>& close_boxes,
+    double time0, double time1, const bvh_build_options& options)
+{
+    // The topology comes from a build over the boxes at mid-shutter: movers are
+    // grouped by where they are on average, not by their whole swept path.
+    std::vector<aabb> mid_boxes(open_boxes.size());
+    for (size_t i = 0; i < open_boxes.size(); ++i)
+    {
+        mid_boxes[i] = aabb(0.5 * (open_boxes[i].minimum + close_boxes[i].minimum),
+                            0.5 * (open_boxes[i].maximum + close_boxes[i].maximum));
+    }
+    build(mid_boxes, options);
+
+    set_shutter(time0, time1);
+    end_boxes.resize(nodes.size());
+    auto leaf_bounds = [&](const std::vector<aabb>& boxes) {
+        return [&](std::uint32_t first, std::uint32_t count) {
+            aabb box = boxes[primitive_indices[first]];
+            for (std::uint32_t i = first + 1; i < first + count; ++i)
+                grow(box, boxes[primitive_indices[i]]);
+            return box;
+        };
+    };
+    refit_motion(leaf_bounds(open_boxes), leaf_bounds(close_boxes));
+}
+
+inline bool flat_bvh::valid_layout(const flat_bvh_node* node_data, size_t node_count, const std::uint32_t* index_data,
+    size_t index_count, size_t primitive_count)
+{
+    // Children come after their parent, so one pass in node order sees every
+    // parent's depth before its children's.
+    std::vector<int> depth(node_count, 0);
+    for (size_t i = 0; i < node_count; ++i)
+    {
+        const flat_bvh_node& node = node_data[i];
+        if (node.count > 0)
+        {
+            if (static_cast<std::uint64_t>(node.offset) + node.count > index_count)
+                return false;
+            continue;
+        }
+        if (node.offset <= i || node.offset >= node_count || node.axis > 2 || depth[i] >= max_depth)
+            return false;
+        depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+        depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+    }
+    for (size_t i = 0; i < index_count; ++i)
+    {
+        if (index_data[i] >= primitive_count)
+            return false;
+    }
+    return true;
+}
+
+inline flat_bvh::split_result flat_bvh::split_range(build_state& state, std::uint32_t begin, std::uint32_t end,
+    int depth, unsigned thread_count)
+{
+    // Big ranges (the top few levels) are scanned and partitioned in blocks,
+    // in parallel. Box unions are exact and the blocked partition is stable,
+    // so the result depends on the range alone, not on the thread count.
+    constexpr std::uint32_t block_size = 16384;
+    const std::uint32_t count = end - begin;
+    const bool blocked = count >= 4 * block_size;
+    const std::uint32_t step = blocked ? block_size : count;
+    const std::uint32_t block_count = (count + step - 1) / step;
+    auto block_range = [&](size_t b) {
+        const std::uint32_t first = begin + static_cast<std::uint32_t>(b) * step;
+        return std::pair{ first, std::min(end, first + step) };
+    };
+
+    auto scan_block = [&](size_t b, aabb& box, aabb& centroid_box) {
+        const auto [first, last] = block_range(b);
+        for (std::uint32_t i = first; i < last; ++i)
+        {
+            grow(box, state.items[i].box);
+            grow(centroid_box, state.items[i].centroid);
+        }
+    };
+
+    split_result result;
+    result.box = empty_box();
+    aabb centroid_box = empty_box();
+    if (!blocked)
+        scan_block(0, result.box, centroid_box);
+    else
+    {
+        std::vector<aabb> block_boxes(block_count, empty_box());
+        std::vector<aabb> block_centroid_boxes(block_count, empty_box());
+        parallel_for(block_count, [&](size_t b) { scan_block(b, block_boxes[b], block_centroid_boxes[b]); }, thread_count);
+        for (std::uint32_t b = 0; b < block_count; ++b)
+        {
+            grow(result.box, block_boxes[b]);
+            grow(centroid_box, block_centroid_boxes[b]);
+        }
+    }
+
+    const vec3 extent = centroid_box.max() - centroid_box.min();
+    const int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    result.axis = axis;
+    const int depth_left = max_depth - 2 - depth;
+    if ((count == 1 || extent.e[axis] <= 0.0 || depth_left <= 0) && count <= 0xffff)
+    {
+        result.leaf = true;
+        return result;
+    }
+    auto median_split = [&] {
+        const std::uint32_t mid = begin + count / 2;
+        std::nth_element(state.items.begin() + begin, state.items.begin() + mid, state.items.begin() + end,
+            [&](const build_item& a, const build_item& b) { return a.centroid.e[axis] < b.centroid.e[axis]; });
+        return mid;
+    };
+    if (halvings_to_leaf(count) >= depth_left)
+    {
+        result.mid = median_split();
+        return result;
+    }
+
+    // Bin centroids along the widest axis and sweep for the cheapest split.
+    const unsigned bin_count = std::clamp(state.options.bin_count, 2u, max_bin_count);
+    const double axis_min = centroid_box.min().e[axis];
+    const double bin_scale = extent.e[axis] > 0.0 ? bin_count / extent.e[axis] : 0.0;
+    auto bin_of = [&](const build_item& item) {
+        const auto b = static_cast<unsigned>((item.centroid.e[axis] - axis_min) * bin_scale);
+        return std::min(b, bin_count - 1);
+    };
+
+    struct bins
+    {
+        std::array<aabb, max_bin_count> boxes;
+        std::array<std::uint32_t, max_bin_count> counts;
+    };
+    auto bin_block = [&](size_t b, bins& local) {
+        std::fill_n(local.boxes.begin(), bin_count, empty_box());
+        std::fill_n(local.counts.begin(), bin_count, 0u);
+        const auto [first, last] = block_range(b);
+        for (std::uint32_t i = first; i < last; ++i)
+        {
+            const unsigned bin = bin_of(state.items[i]);
+            ++local.counts[bin];
+            grow(local.boxes[bin], state.items[i].box);
+        }
+    };
+
+    bins merged;
+    std::vector<bins> block_bins;
+    if (!blocked)
+        bin_block(0, merged);
+    else
+    {
+        block_bins.resize(block_count);
+        parallel_for(block_count, [&](size_t b) { bin_block(b, block_bins[b]); }, thread_count);
+        merged = block_bins[0];
+        for (std::uint32_t b = 1; b < block_count; ++b)
+        {
+            for (unsigned bin = 0; bin < bin_count; ++bin)
+            {
+                merged.counts[bin] += block_bins[b].counts[bin];
+                grow(merged.boxes[bin], block_bins[b].boxes[bin]);
+            }
+        }
+    }
+
+    std::array<double, max_bin_count> right_area{};
+    std::array<std::uint32_t, max_bin_count> right_count{};
+    aabb accumulated = empty_box();
+    std::uint32_t accumulated_count = 0;
+    for (unsigned b = bin_count - 1; b > 0; --b)
+    {
+        grow(accumulated, merged.boxes[b]);
+        accumulated_count += merged.counts[b];
+        right_area[b] = accumulated_count ? accumulated.surface_area() : 0.0;
+        right_count[b] = accumulated_count;
+    }
+
+    double best_cost = infinity;
+    unsigned best_split = 0;
+    accumulated = empty_box();
+    accumulated_count = 0;
+    for (unsigned b = 1; b < bin_count; ++b)
+    {
+        grow(accumulated, merged.boxes[b - 1]);
+        accumulated_count += merged.counts[b - 1];
+        if (accumulated_count == 0 || right_count[b] == 0)
+            continue;
+        const double cost = accumulated_count * accumulated.surface_area() + right_count[b] * right_area[b];
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_split = b;
+        }
+    }
+
+    const double area = result.box.surface_area();
+    const double split_cost = state.options.traversal_cost
+                            + state.options.intersection_cost * (area > 0.0 ? best_cost / area : 0.0);
+    const double leaf_cost = state.options.intersection_cost * count;
+    if (split_cost >= leaf_cost && count <= state.options.max_leaf_size)
+    {
+        result.leaf = true;
+        return result;
+    }
+
+    std::uint32_t mid = begin;
+    if (best_split != 0 && !blocked)
+    {
+        const auto split = std::partition(state.items.begin() + begin, state.items.begin() + end,
+            [&](const build_item& item) { return bin_of(item) < best_split; });
+        mid = static_cast<std::uint32_t>(split - state.items.begin());
+    }
+    else if (best_split != 0)
+    {
+        // Each block's left side goes after the left sides of the blocks
+        // before it, and likewise on the right, through a scratch buffer.
+        std::vector<std::uint32_t> left_before(block_count + 1, 0);
+        for (std::uint32_t b = 0; b < block_count; ++b)
+        {
+            left_before[b + 1] = left_before[b];
+            for (unsigned bin = 0; bin < best_split; ++bin)
+                left_before[b + 1] += block_bins[b].counts[bin];
+        }
+        const std::uint32_t left_total = left_before[block_count];
+        std::vector<build_item> scratch(count);
+        parallel_for(block_count, [&](size_t b) {
+            const auto [first, last] = block_range(b);
+            std::uint32_t left = left_before[b];
+            std::uint32_t right = left_total + (first - begin) - left_before[b];
+            for (std::uint32_t i = first; i < last; ++i)
+            {
+                const build_item& item = state.items[i];
+                scratch[bin_of(item) < best_split ? left++ : right++] = item;
+            }
+        }, thread_count);
+        parallel_for(block_count, [&](size_t b) {
+            const auto [first, last] = block_range(b);
+            std::copy(scratch.begin() + (first - begin), scratch.begin() + (last - begin), state.items.begin() + first);
+        }, thread_count);
+        mid = begin + left_total;
+    }
+    if (mid == begin || mid == end)
+    {
+        // Every centroid fell in one bin: split at the median instead.
+        mid = median_split();
+    }
+    result.mid = mid;
+    return result;
+}
+
+inline void flat_bvh::build_recursive(build_state& state, std::uint32_t begin, std::uint32_t end, int depth,
+    std::vector<flat_bvh_node>& out)
+{
+    const auto node_index = static_cast<std::uint32_t>(out.size());
+    out.emplace_back();
+    const split_result split = split_range(state, begin, end, depth, 1);
+    out[node_index].box = split.box;
+    if (split.leaf)
+    {
+        out[node_index].offset = begin;
+        out[node_index].count = static_cast<std::uint16_t>(end - begin);
+        return;
+    }
+
+    out[node_index].axis = static_cast<std::uint8_t>(split.axis);
+    build_recursive(state, begin, split.mid, depth + 1, out);
+    out[node_index].offset = static_cast<std::uint32_t>(out.size());
+    build_recursive(state, split.mid, end, depth + 1, out);
+}
+
+// The levels above the tasks, built like build_recursive() but with every
+// range scanned in parallel. A range of at most task_size primitives becomes
+// a placeholder node, top_task[node] naming its task; other nodes have ~0u.
+inline void flat_bvh::build_top(build_state& state, std::uint32_t begin, std::uint32_t end, int depth,
+    std::uint32_t task_size, unsigned thread_count, std::vector<flat_bvh_node>& top,
+    std::vector<std::uint32_t>& top_task, std::vector<subtree_task>& tasks)
+{
+    const auto node_index = static_cast<std::uint32_t>(top.size());
+    top.emplace_back();
+    top_task.push_back(~0u);
+    if (end - begin <= task_size)
+    {
+        top_task[node_index] = static_cast<std::uint32_t>(tasks.size());
+        tasks.push_back({ begin, end, depth, {} });
+        return;
+    }
+
+    const split_result split = split_range(state, begin, end, depth, thread_count);
+    top[node_index].box = split.box;
+    if (split.leaf)
+    {
+        top[node_index].offset = begin;
+        top[node_index].count = static_cast<std::uint16_t>(end - begin);
+        return;
+    }
+
+    top[node_index].axis = static_cast<std::uint8_t>(split.axis);
+    build_top(state, begin, split.mid, depth + 1, task_size, thread_count, top, top_task, tasks);
+    top[node_index].offset = static_cast<std::uint32_t>(top.size());
+    build_top(state, split.mid, end, depth + 1, task_size, thread_count, top, top_task, tasks);
+}
+
+// Appends top node i and its subtree to `nodes` in depth-first order,
+// copying in each task's nodes with their child offsets moved to match.
+inline void flat_bvh::append_top(const std::vector<flat_bvh_node>& top, const std::vector<std::uint32_t>& top_task,
+    std::vector<subtree_task>& tasks, std::uint32_t i)
+{
+    if (top_task[i] != ~0u)
+    {
+        std::vector<flat_bvh_node>& task_nodes = tasks[top_task[i]].nodes;
+        const auto base = static_cast<std::uint32_t>(nodes.size());
+        for (flat_bvh_node& node : task_nodes)
+        {
+            if (node.count == 0)
+                node.offset += base;
+        }
+        nodes.insert(nodes.end(), task_nodes.begin(), task_nodes.end());
+        std::vector<flat_bvh_node>().swap(task_nodes);
+        return;
+    }
+
+    const auto node_index = static_cast<std::uint32_t>(nodes.size());
+    nodes.push_back(top[i]);
+    if (top[i].count > 0)
+        return;
+    append_top(top, top_task, tasks, i + 1);
+    nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+    append_top(top, top_task, tasks, top[i].offset);
+}
+
+template <typename LeafHit>
+bool flat_bvh::traverse(const ray& r, double t_min, double t_max, LeafHit&& hit_leaf) const
+{
+    if (nodes.empty())
+        return false;
+
+    const point3 origin = r.origin();
+    const vec3 inverse_direction(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+    const bool moving = has_motion();
+    const double shutter_time = (r.time() - shutter_open) * inverse_shutter_length;
+
+    std::uint32_t stack[max_depth];
+    int stack_size = 0;
+    std::uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true)
+    {
+        const flat_bvh_node& node = nodes[current];
+        RT_COUNT(bvh_nodes);
+        const bool hit_box = moving
+            ? box_at(current, shutter_time).hit(origin, inverse_direction, t_min, t_max)
+            : node.box.hit(origin, inverse_direction, t_min, t_max);
+        if (hit_box)
+        {
+            if (node.count > 0)
+            {
+                if (hit_leaf(node.offset, static_cast<std::uint32_t>(node.count), t_max))
+                    hit_anything = true;
+                if (t_max < t_min)
+                    break;
+            }
+            else
+            {
+                // Descend into the child on the ray's side of the split first.
+                if (inverse_direction.e[node.axis] < 0.0)
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    return hit_anything;
+}
+
+template <typename LeafBox>
+void flat_bvh::refit(LeafBox&& leaf_box, unsigned thread_count)
+{
+    refit_bottom_up([&](std::uint32_t i) {
+        flat_bvh_node& node = nodes[i];
+        if (node.count > 0)
+        {
+            node.box = leaf_box(node.offset, static_cast<std::uint32_t>(node.count));
+        }
+        else
+        {
+            node.box = nodes[i + 1].box;
+            grow(node.box, nodes[node.offset].box);
+        }
+    }, thread_count);
+}
+
+template <typename LeafBox, typename LeafEndBox>
+void flat_bvh::refit_motion(LeafBox&& leaf_box, LeafEndBox&& leaf_end_box, unsigned thread_count)
+{
+    refit_bottom_up([&](std::uint32_t i) {
+        flat_bvh_node& node = nodes[i];
+        if (node.count > 0)
+        {
+            node.box = leaf_box(node.offset, static_cast<std::uint32_t>(node.count));
+            end_boxes[i] = leaf_end_box(node.offset, static_cast<std::uint32_t>(node.count));
+        }
+        else
+        {
+            node.box = nodes[i + 1].box;
+            grow(node.box, nodes[node.offset].box);
+            end_boxes[i] = end_boxes[i + 1];
+            grow(end_boxes[i], end_boxes[node.offset]);
+        }
+    }, thread_count);
+}
+
+template <typename RefitNode>
+void flat_bvh::refit_bottom_up(RefitNode&& refit_node, unsigned thread_count)
+{
+    if (nodes.empty())
+        return;
+    if (thread_count == 0)
+        thread_count = hardware_threads();
+
+    // Depth-first order puts every subtree in one contiguous index range, so
+    // cutting the tree at split_depth yields independent ranges to refit.
+    int split_depth = 0;
+    while ((1u << split_depth) < 4 * thread_count && split_depth < 16)
+        ++split_depth;
+
+    std::vector<std::uint32_t> top_nodes;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> subtrees;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> pending{ { 0u, static_cast<std::uint32_t>(nodes.size()) } };
+    std::vector<int> pending_depth{ 0 };
+    while (!pending.empty())
+    {
+        const auto range = pending.back();
+        const int depth = pending_depth.back();
+        pending.pop_back();
+        pending_depth.pop_back();
+
+        const flat_bvh_node& node = nodes[range.first];
+        if (node.count > 0 || depth >= split_depth)
+        {
+            subtrees.push_back(range);
+            continue;
+        }
+        top_nodes.push_back(range.first);
+        pending.emplace_back(node.offset, range.second);
+        pending.emplace_back(range.first + 1, node.offset);
+        pending_depth.push_back(depth + 1);
+        pending_depth.push_back(depth + 1);
+    }
+
+    parallel_for(subtrees.size(), [&](size_t s) {
+        for (std::uint32_t i = subtrees[s].second; i-- > subtrees[s].first;)
+            refit_node(i);
+    }, thread_count);
+
+    // Top nodes were collected parents-first, so reverse order is bottom-up.
+    for (auto it = top_nodes.rbegin(); it != top_nodes.rend(); ++it)
+        refit_node(*it);
+}
+
+inline double flat_bvh::sah_cost(const bvh_build_options& options) const
+{
+    if (nodes.empty())
+        return 0.0;
+
+    // Box extents are linear in shutter time, so areas are quadratic and
+    // Simpson's rule averages them exactly.
+    auto mean_area = [&](std::uint32_t i) {
+        if (!has_motion())
+            return nodes[i].box.surface_area();
+        return (nodes[i].box.surface_area() + 4.0 * box_at(i, 0.5).surface_area() + end_boxes[i].surface_area()) / 6.0;
+    };
+
+    double cost = 0.0;
+    for (std::uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        const double area = mean_area(i);
+        cost += nodes[i].count > 0 ? options.intersection_cost * nodes[i].count * area : options.traversal_cost * area;
+    }
+    const double root_area = mean_area(0);
+    return root_area > 0.0 ? cost / root_area : cost;
+}
+
+#include "morton_bvh.h"
+
+#endif
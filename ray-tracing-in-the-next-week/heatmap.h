@@ -0,0 +1,173 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "render_stats.h"
+
+// What each pixel of a render cost, summed over its samples: BVH nodes
+// visited, ray-primitive tests, and wall time. Row 0 is the bottom of the
+// image, as in frame_image. The node and test counts come from the
+// render_stats counters, so they stay zero unless RT_ENABLE_STATS is defined;
+// the time is always measured.
+struct pixel_costs
+{
+    int width{ 0 };
+    int height{ 0 };
+    std::vector<float> bvh_nodes;
+    std::vector<float> primitive_tests;
+    std::vector<float> microseconds;
+
+    void resize(int image_width, int image_height)
+    {
+        width = image_width;
+        height = image_height;
+        const size_t count = static_cast<size_t>(width) * height;
+        bvh_nodes.assign(count, 0.0f);
+        primitive_tests.assign(count, 0.0f);
+        microseconds.assign(count, 0.0f);
+    }
+
+    [[nodiscard]] size_t index(int i, int j) const { return static_cast<size_t>(j) * width + i; }
+};
+
+// Measures one pixel at a time on the calling thread.
+class pixel_cost_meter
+{
+public:
+    void start()
+    {
+        if constexpr (stats::enabled)
+            before = stats::local();
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    void stop(pixel_costs& costs, int i, int j) const
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - start_time;
+        const size_t pixel = costs.index(i, j);
+        costs.microseconds[pixel] = std::chrono::duration<float, std::micro>(elapsed).count();
+        if constexpr (stats::enabled)
+        {
+            const stats::counters& after = stats::local();
+            costs.bvh_nodes[pixel] = static_cast<float>(after.value[stats::bvh_nodes] - before.value[stats::bvh_nodes]);
+            costs.primitive_tests[pixel] = static_cast<float>(after.value[stats::primitive_tests] - before.value[stats::primitive_tests]);
+        }
+    }
+
+private:
+    stats::counters before;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+// Maps [0, 1] onto black, blue, cyan, green, yellow, red, white.
+inline void false_color(double x, int& r, int& g, int& b)
+{
+    static constexpr double stops[][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 } };
+    constexpr int segments = static_cast<int>(std::size(stops)) - 1;
+    const double position = std::clamp(x, 0.0, 1.0) * segments;
+    const int low = std::min(static_cast<int>(position), segments - 1);
+    const double f = position - low;
+    auto channel = [&](int c) { return static_cast<int>(255.999 * ((1 - f) * stops[low][c] + f * stops[low + 1][c])); };
+    r = channel(0);
+    g = channel(1);
+    b = channel(2);
+}
+
+struct heatmap_summary
+{
+    double mean{ 0 };
+    double scale{ 0 }; // the value drawn white: the 99.5th percentile
+    double max{ 0 };
+};
+
+inline std::ostream& operator<<(std::ostream& out, const heatmap_summary& summary)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(1);
+    out << std::fixed << "mean " << summary.mean << ", 99.5% " << summary.scale << ", max " << summary.max << " per pixel";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+// Writes one cost channel as a false-color PPM. The colors run up to the
+// 99.5th percentile rather than the maximum, so a handful of outliers do not
+// wash the rest of the image out to black; anything above it is white.
+inline bool write_heatmap(const std::string& path, const std::vector<float>& values, int width, int height,
+    heatmap_summary& summary)
+{
+    summary = {};
+    if (!values.empty())
+    {
+        std::vector<float> sorted(values);
+        const size_t rank = std::min(sorted.size() - 1, sorted.size() * 995 / 1000);
+        std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(rank), sorted.end());
+        summary.scale = sorted[rank];
+        for (const float value : values)
+        {
+            summary.mean += value;
+            summary.max = std::max(summary.max, static_cast<double>(value));
+        }
+        summary.mean /= static_cast<double>(values.size());
+    }
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write heatmap '" << path << "'.\n";
+        return false;
+    }
+    out << "P3\n" << width << " " << height << "\n255\n";
+    for (int j = height - 1; j >= 0; --j)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            const double value = values[static_cast<size_t>(j) * width + i];
+            int r, g, b;
+            false_color(summary.scale > 0 ? value / summary.scale : 0.0, r, g, b);
+            out << r << ' ' << g << ' ' << b << '\n';
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+// Writes prefix_time.ppm and, when the counters are compiled in,
+// prefix_nodes.ppm and prefix_tests.ppm, with a summary line for each.
+inline bool write_heatmaps(const std::string& prefix, const pixel_costs& costs)
+{
+    struct channel
+    {
+        const char* suffix;
+        const char* label;
+        const std::vector<float>* values;
+    };
+    std::vector<channel> channels = { { "_time.ppm", "wall time (us)", &costs.microseconds } };
+    if constexpr (stats::enabled)
+    {
+        channels.push_back({ "_nodes.ppm", "BVH nodes", &costs.bvh_nodes });
+        channels.push_back({ "_tests.ppm", "primitive tests", &costs.primitive_tests });
+    }
+    else
+        std::cerr << "Heatmaps: node and test counts need a build with RT_ENABLE_STATS; writing wall time only.\n";
+
+    for (const channel& c : channels)
+    {
+        heatmap_summary summary;
+        const std::string path = prefix + c.suffix;
+        if (!write_heatmap(path, *c.values, costs.width, costs.height, summary))
+            return false;
+        std::cerr << "Heatmap " << path << ": " << c.label << ", " << summary << "\n";
+    }
+    return true;
+}
+
+#endif
@@ -4,20 +4,55 @@
 #include "aabb.h"
 #include "ray.h"
 
+class hittable;
 class material;
 
 struct hit_record
 {
     point3 hit_point;
     vec3 normal_vec_of_hit;
-    shared_ptr<material> hit_material;
+    const material* hit_material{ nullptr }; // owned by the object hit
+    const hittable* hit_object{ nullptr };   // the primitive hit (null inside a sphere_array); lights are looked up by it
     double t_of_ray{ 0.0 };
     double u{};
     double v{};
     bool is_front_face{ false };
 
+    // Ray differentials: change of the hit point, normal and (u,v) per pixel
+    // step in x and y. Only valid when has_differentials is set.
+    bool has_differentials{ false };
+    vec3 dpdx, dpdy;
+    vec3 dndx, dndy;
+    double dudx{}, dvdx{}, dudy{}, dvdy{};
+
+    // Spheres leave their (u,v) and differentials to finish_shading(): a BVH
+    // tries many candidates per ray, and only the closest one is ever shaded.
+    // They keep what the finishing step needs here.
+    void (*pending_shading)(const ray& r, hit_record& rec){ nullptr };
+    point3 shape_center;
+    double shape_radius{};
 
     void set_face_normal(const ray& r, const vec3& outward_normal);
+    bool set_differentials(const ray& r);
+
+    // Completes the final hit along r for whoever shades it: (u,v) and the
+    // differentials. A no-op for primitives that filled them in during hit().
+    void finish_shading(const ray& r)
+    {
+        if (const auto finish = pending_shading)
+        {
+            pending_shading = nullptr;
+            finish(r, *this);
+        }
+    }
+
+    // Width of the pixel footprint in (u,v) space, 0 when unknown.
+    [[nodiscard]] double uv_footprint() const
+    {
+        if (!has_differentials)
+            return 0.0;
+        return fmax(sqrt(dudx * dudx + dvdx * dvdx), sqrt(dudy * dudy + dvdy * dvdy));
+    }
 };
 
 inline void hit_record::set_face_normal(const ray& r, const vec3& outward_normal)
@@ -26,12 +61,45 @@ inline void hit_record::set_face_normal(const ray& r, const vec3& outward_normal
 	normal_vec_of_hit = is_front_face ? outward_normal : -outward_normal;
 }
 
+// Intersects the offset rays with the tangent plane at the hit point to find
+// dpdx and dpdy. The caller fills in the normal and (u,v) derivatives.
+inline bool hit_record::set_differentials(const ray& r)
+{
+    has_differentials = false;
+    if (!r.has_differentials)
+        return false;
+
+    const vec3& n = normal_vec_of_hit;
+    const double plane_d = dot(n, hit_point);
+    const double denominator_x = dot(n, r.rx_direction);
+    const double denominator_y = dot(n, r.ry_direction);
+    if (fabs(denominator_x) < 1e-12 || fabs(denominator_y) < 1e-12)
+        return false;
+
+    const double tx = (plane_d - dot(n, r.rx_origin)) / denominator_x;
+    const double ty = (plane_d - dot(n, r.ry_origin)) / denominator_y;
+    dpdx = r.rx_origin + tx * r.rx_direction - hit_point;
+    dpdy = r.ry_origin + ty * r.ry_direction - hit_point;
+    dudx = dvdx = dudy = dvdy = 0;
+    has_differentials = true;
+    return true;
+}
+
 class hittable
 {
 public:
     virtual ~hittable() = default;//
     virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
     virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+    // Whether anything blocks the ray within [t_min, t_max], for shadow rays.
+    // Unlike hit(), any blocker will do, so containers override this to stop
+    // at the first one instead of searching on for the nearest.
+    virtual bool occluded(const ray& r, double t_min, double t_max) const
+    {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
 };
 
 #endif
\ No newline at end of file
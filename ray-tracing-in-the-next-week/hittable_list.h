@@ -24,9 +24,12 @@ public:
     bool bounding_box(double time0, double time1, aabb& output_box)
 		const override;
 
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
     std::vector<shared_ptr<hittable>> hit_objects;
+    std::shared_ptr<const void> storage; // owns hit_objects made by a scene_arena, if any
 };
 
 inline bool hittable_list::hit(const ray& r, const double t_min, const double t_max, hit_record& rec)
@@ -49,6 +52,16 @@ const
     return hit_anything;
 }
 
+inline bool hittable_list::occluded(const ray& r, const double t_min, const double t_max) const
+{
+    for (const auto& object : hit_objects)
+    {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+    return false;
+}
+
 inline bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) const
 {
     if (hit_objects.empty()) return false;
@@ -0,0 +1,189 @@
+#ifndef IMAGE_TEXTURE_H
+#define IMAGE_TEXTURE_H
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "rtweekend.h"
+#include "texture.h"
+#include "texture_cache.h"
+
+// A texture backed by a memory-mapped tiled file (see texture_cache.h). Only
+// the header is read at construction; tiles are decoded on first use into the
+// shared tile_cache, so the resident size is bounded by the cache budget
+// rather than by the size of the images in the scene.
+class image_texture : public texture
+{
+public:
+    image_texture() = default;
+
+    // Accepts either a tiled .rtt file or a .ppm, which is converted once.
+    explicit image_texture(const std::string& filename)
+    {
+        const bool is_ppm = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0;
+        const std::string tiled_path = is_ppm ? make_tiled_texture(filename) : filename;
+        path = tiled_path;
+
+        if (tiled_path.empty() || !file.open(tiled_path) || file.size() < sizeof(tiled_texture_header))
+        {
+            std::cerr << "ERROR: Could not load texture image file '" << filename << "'.\n";
+            return;
+        }
+
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (!valid_layout())
+        {
+            std::cerr << "ERROR: '" << tiled_path << "' is not a tiled texture file.\n";
+            header = {};
+            file.close();
+            return;
+        }
+
+        levels = reinterpret_cast<const tiled_texture_level*>(file.data() + sizeof(header));
+        tile_texels = static_cast<size_t>(header.tile_size) * header.tile_size;
+        texture_id = tile_cache::global().register_texture();
+    }
+
+    [[nodiscard]] color value(double u, double v, const point3& p) const override
+    {
+        return sample(u, v, 0);
+    }
+
+    // Trilinear lookup in the two mip levels bracketing the footprint, so
+    // distant or blurry hits read small, cache-friendly levels.
+    [[nodiscard]] color filtered_value(double u, double v, const point3& p, double footprint) const override
+    {
+        const double texels = footprint * (header.width > header.height ? header.width : header.height);
+        if (texels <= 1.0)
+            return sample(u, v, 0);
+
+        const double level = fmin(log2(texels), level_count() - 1.0);
+        const int fine = static_cast<int>(level);
+        const double blend = level - fine;
+        if (blend < 1e-3 || fine + 1 >= level_count())
+            return sample(u, v, fine);
+        return (1 - blend) * sample(u, v, fine) + blend * sample(u, v, fine + 1);
+    }
+
+    [[nodiscard]] int level_count() const { return static_cast<int>(header.level_count); }
+    [[nodiscard]] int width() const { return static_cast<int>(header.width); }
+    [[nodiscard]] int height() const { return static_cast<int>(header.height); }
+
+    // Bilinear lookup in one mip level with clamped addressing.
+    [[nodiscard]] color sample(double u, double v, int level) const
+    {
+        // If we have no texture data, then return solid cyan as a debugging aid.
+        if (levels == nullptr)
+            return color(0, 1, 1);
+
+        level = level < 0 ? 0 : (level >= level_count() ? level_count() - 1 : level);
+        const tiled_texture_level& info = levels[level];
+
+        // Clamp input texture coordinates to [0,1] x [1,0] (image rows run top-down).
+        u = clamp(u, 0.0, 1.0);
+        v = 1.0 - clamp(v, 0.0, 1.0);
+
+        const double x = u * info.width - 0.5;
+        const double y = v * info.height - 0.5;
+        const double fx = std::floor(x);
+        const double fy = std::floor(y);
+        const double tx = x - fx;
+        const double ty = y - fy;
+        const int x0 = clamp_index(static_cast<int>(fx), info.width);
+        const int y0 = clamp_index(static_cast<int>(fy), info.height);
+        const int x1 = clamp_index(static_cast<int>(fx) + 1, info.width);
+        const int y1 = clamp_index(static_cast<int>(fy) + 1, info.height);
+
+        // The four taps usually share a tile; only fetch a second one when they don't.
+        tile_reference tile;
+        const color c00 = texel(level, x0, y0, tile);
+        const color c10 = texel(level, x1, y0, tile);
+        const color c01 = texel(level, x0, y1, tile);
+        const color c11 = texel(level, x1, y1, tile);
+        return (1 - ty) * ((1 - tx) * c00 + tx * c10) + ty * ((1 - tx) * c01 + tx * c11);
+    }
+
+private:
+    // A truncated or foreign file must not make lookups divide by zero or
+    // read outside the mapping: every level's tiles have to cover the level
+    // and lie inside the file. Levels are keyed with 8 bits (see texel()).
+    [[nodiscard]] bool valid_layout() const
+    {
+        if (std::memcmp(header.magic, tiled_texture_magic, sizeof(header.magic)) != 0
+            || header.version != tiled_texture_version || header.channels != 3 || header.tile_size == 0
+            || header.level_count == 0 || header.level_count > 256 || header.width == 0 || header.height == 0
+            || file.size() < sizeof(header) + sizeof(tiled_texture_level) * header.level_count)
+            return false;
+
+        const auto* table = reinterpret_cast<const tiled_texture_level*>(file.data() + sizeof(header));
+        const std::uint64_t tile_size = header.tile_size;
+        const std::uint64_t tile_bytes = tile_size * tile_size * 3;
+        for (std::uint32_t l = 0; l < header.level_count; ++l)
+        {
+            const tiled_texture_level& level = table[l];
+            if (level.width == 0 || level.height == 0
+                || level.tiles_x != (level.width + tile_size - 1) / tile_size
+                || level.tiles_y != (level.height + tile_size - 1) / tile_size)
+                return false;
+            const std::uint64_t tile_count = static_cast<std::uint64_t>(level.tiles_x) * level.tiles_y;
+            if (tile_count > 0xffffffffull || level.offset > file.size()
+                || tile_count > (file.size() - level.offset) / tile_bytes)
+                return false;
+        }
+        return true;
+    }
+
+    struct tile_reference
+    {
+        std::uint32_t index{ ~0u };
+        std::shared_ptr<const texture_tile> tile;
+    };
+
+    static int clamp_index(int i, std::uint32_t size)
+    {
+        return i < 0 ? 0 : (i >= static_cast<int>(size) ? static_cast<int>(size) - 1 : i);
+    }
+
+    [[nodiscard]] color texel(int level, int x, int y, tile_reference& current) const
+    {
+        const tiled_texture_level& info = levels[level];
+        const std::uint32_t tile_size = header.tile_size;
+        const std::uint32_t tile_index = (static_cast<std::uint32_t>(y) / tile_size) * info.tiles_x
+                                       + static_cast<std::uint32_t>(x) / tile_size;
+
+        if (tile_index != current.index)
+        {
+            // texture id : 24 bits, level : 8 bits, tile index : 32 bits
+            const std::uint64_t key = (static_cast<std::uint64_t>(texture_id) << 40)
+                                    | (static_cast<std::uint64_t>(level) << 32)
+                                    | tile_index;
+
+            current.index = tile_index;
+            current.tile = tile_cache::global().get(key, tile_texels * 3 * sizeof(float),
+                [&](texture_tile& decoded) {
+                    const unsigned char* src = file.data() + info.offset + static_cast<size_t>(tile_index) * tile_texels * 3;
+                    const float color_scale = 1.0f / 255.0f;
+                    decoded.texels.resize(tile_texels * 3);
+                    for (size_t i = 0; i < decoded.texels.size(); ++i)
+                        decoded.texels[i] = color_scale * src[i];
+                });
+        }
+
+        const float* t = &current.tile->texels[((y % tile_size) * tile_size + (x % tile_size)) * 3];
+        return color(t[0], t[1], t[2]);
+    }
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::string path; // the .rtt actually read, for exporters
+
+private:
+    mapped_file file;
+    tiled_texture_header header{};
+    const tiled_texture_level* levels{ nullptr };
+    size_t tile_texels{ 0 };
+    std::uint32_t texture_id{ 0 };
+};
+
+#endif
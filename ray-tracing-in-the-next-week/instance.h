@@ -0,0 +1,202 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+
+// Affine transform as a row-major 3x4 matrix: p' = L * p + t.
+struct affine_transform
+{
+    double m[3][4]{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+    static affine_transform translation(const vec3& offset)
+    {
+        affine_transform result;
+        for (int r = 0; r < 3; ++r)
+            result.m[r][3] = offset[r];
+        return result;
+    }
+
+    static affine_transform scaling(double s)
+    {
+        affine_transform result;
+        for (int r = 0; r < 3; ++r)
+            result.m[r][r] = s;
+        return result;
+    }
+
+    static affine_transform rotation_y(double degrees)
+    {
+        const double radians = degrees_to_radians(degrees);
+        affine_transform result;
+        result.m[0][0] = cos(radians);
+        result.m[0][2] = sin(radians);
+        result.m[2][0] = -sin(radians);
+        result.m[2][2] = cos(radians);
+        return result;
+    }
+
+    [[nodiscard]] point3 apply_point(const point3& p) const
+    {
+        return point3(
+            m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+            m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+            m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    [[nodiscard]] vec3 apply_vector(const vec3& v) const
+    {
+        return vec3(
+            m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+            m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+            m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiplies by the transposed linear part. For a world-to-object
+    // transform this takes object-space normals to world space.
+    [[nodiscard]] vec3 apply_transposed(const vec3& v) const
+    {
+        return vec3(
+            m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+            m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+            m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    [[nodiscard]] affine_transform inverse() const
+    {
+        const double det =
+              m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        const double inv_det = 1.0 / det;
+
+        affine_transform result;
+        result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        const vec3 t = result.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int r = 0; r < 3; ++r)
+            result.m[r][3] = -t[r];
+        return result;
+    }
+};
+
+// a * b applies b first.
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b)
+{
+    affine_transform result;
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            result.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c]
+                           + (c == 3 ? a.m[r][3] : 0.0);
+        }
+    }
+    return result;
+}
+
+// A placement of shared geometry (a mesh, a BVH, any hittable) in the world.
+// Only the world-to-object transform is stored: hit points are taken from the
+// world ray, and normals go back to world space through its transpose.
+class instance final : public hittable
+{
+public:
+    instance() = default;
+    instance(shared_ptr<hittable> object, const affine_transform& object_to_world)
+        : world_to_object(object_to_world.inverse()), object_ptr(std::move(object))
+    {}
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
+    // Moves the instance; a scene_bvh holding it then needs update().
+    void set_transform(const affine_transform& object_to_world)
+    {
+        world_to_object = object_to_world.inverse();
+    }
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    affine_transform world_to_object;
+    shared_ptr<hittable> object_ptr;
+};
+
+inline bool instance::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    // Directions are not renormalized, so t is the same in both spaces.
+    ray object_ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time());
+    if (r.has_differentials)
+    {
+        object_ray.set_differentials(
+            world_to_object.apply_point(r.rx_origin), world_to_object.apply_vector(r.rx_direction),
+            world_to_object.apply_point(r.ry_origin), world_to_object.apply_vector(r.ry_direction));
+    }
+
+    if (!object_ptr->hit(object_ray, t_min, t_max, rec))
+        return false;
+    // What the object left pending is in object space, so it is finished here.
+    rec.finish_shading(object_ray);
+
+    // Orientation is preserved: dot(A d, L^T n) == dot(d, n) for A = L^-1.
+    rec.hit_point = r.at(rec.t_of_ray);
+    rec.normal_vec_of_hit = unit_vector(world_to_object.apply_transposed(rec.normal_vec_of_hit));
+
+    if (rec.has_differentials)
+    {
+        // (u,v) derivatives carry over; positions and normals are redone in world space.
+        const double dudx = rec.dudx, dvdx = rec.dvdx, dudy = rec.dudy, dvdy = rec.dvdy;
+        const vec3 dndx = world_to_object.apply_transposed(rec.dndx);
+        const vec3 dndy = world_to_object.apply_transposed(rec.dndy);
+        if (rec.set_differentials(r))
+        {
+            rec.dudx = dudx;
+            rec.dvdx = dvdx;
+            rec.dudy = dudy;
+            rec.dvdy = dvdy;
+            rec.dndx = dndx;
+            rec.dndy = dndy;
+        }
+    }
+    return true;
+}
+
+inline bool instance::occluded(const ray& r, double t_min, double t_max) const
+{
+    const ray object_ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time());
+    return object_ptr->occluded(object_ray, t_min, t_max);
+}
+
+inline bool instance::bounding_box(double time0, double time1, aabb& output_box) const
+{
+    aabb object_box;
+    if (!object_ptr->bounding_box(time0, time1, object_box))
+        return false;
+
+    const affine_transform object_to_world = world_to_object.inverse();
+    point3 small(infinity, infinity, infinity);
+    point3 big(-infinity, -infinity, -infinity);
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const point3 p = object_to_world.apply_point(point3(
+            (corner & 1) ? object_box.max().x() : object_box.min().x(),
+            (corner & 2) ? object_box.max().y() : object_box.min().y(),
+            (corner & 4) ? object_box.max().z() : object_box.min().z()));
+        for (int a = 0; a < 3; ++a)
+        {
+            small.e[a] = fmin(small.e[a], p.e[a]);
+            big.e[a] = fmax(big.e[a], p.e[a]);
+        }
+    }
+    output_box = aabb(small, big);
+    return true;
+}
+
+#endif
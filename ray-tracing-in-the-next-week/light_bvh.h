@@ -0,0 +1,291 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "rtweekend.h"
+#include "vec3.h"
+
+// What a light hierarchy knows about a light, or about every light below a
+// node: where the emitters are, how much they emit in total, and which way.
+// Emission leaves within cos_theta_o of `axis` (-1: every way, as spheres
+// emit) and then spreads up to cos_theta_e further (0: a full hemisphere of
+// diffuse emission).
+struct light_bounds
+{
+    aabb box;
+    double power{ 0 };
+    vec3 axis{ 0, 0, 1 };
+    double cos_theta_o{ -1 };
+    double cos_theta_e{ 0 };
+
+    // An upper bound of sorts on what these lights contribute at p, on a
+    // surface with normal n (or anywhere, for n = 0): power over squared
+    // distance, times the best cosines the box and cones allow towards p and
+    // towards n (pbrt-v4's LightBounds::Importance).
+    [[nodiscard]] double importance(const point3& p, const vec3& n) const;
+};
+
+namespace light_bvh_detail
+{
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b.
+inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+}
+
+inline double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+inline double safe_sqrt(double x) { return sqrt(fmax(0.0, x)); }
+
+// The smallest cone holding both cones, per pbrt-v4's DirectionCone Union.
+inline void merge_cones(const vec3& axis_a, double cos_a, const vec3& axis_b, double cos_b, vec3& axis, double& cos_theta)
+{
+    const double theta_a = acos(clamp(cos_a, -1.0, 1.0));
+    const double theta_b = acos(clamp(cos_b, -1.0, 1.0));
+    const double theta_d = acos(clamp(dot(axis_a, axis_b), -1.0, 1.0));
+    axis = axis_a;
+    cos_theta = cos_a;
+    if (fmin(theta_d + theta_b, pi) <= theta_a)
+        return;
+    axis = axis_b;
+    cos_theta = cos_b;
+    if (fmin(theta_d + theta_a, pi) <= theta_b)
+        return;
+
+    const double theta_o = 0.5 * (theta_a + theta_d + theta_b);
+    const vec3 perpendicular = cross(axis_a, axis_b);
+    if (theta_o >= pi || perpendicular.length_squared() == 0)
+    {
+        axis = vec3(0, 0, 1);
+        cos_theta = -1;
+        return;
+    }
+    // Turn axis_a towards axis_b by theta_o - theta_a about their common perpendicular.
+    const double theta_r = theta_o - theta_a;
+    const vec3 k = unit_vector(perpendicular);
+    axis = unit_vector(cos(theta_r) * axis_a + sin(theta_r) * cross(k, axis_a));
+    cos_theta = cos(theta_o);
+}
+
+} // namespace light_bvh_detail
+
+inline double light_bounds::importance(const point3& p, const vec3& n) const
+{
+    using namespace light_bvh_detail;
+    if (power <= 0)
+        return 0;
+
+    const point3 center = 0.5 * (box.min() + box.max());
+    const vec3 half_diagonal = 0.5 * (box.max() - box.min());
+    const vec3 from_center = p - center;
+    const double center_distance_squared = from_center.length_squared();
+    // Clamped so points inside or next to the box do not get unbounded weights.
+    const double distance_squared = fmax(center_distance_squared, half_diagonal.length());
+    const vec3 to_p = from_center / sqrt(center_distance_squared);
+
+    // The cone from p around the box's bounding sphere.
+    const double radius_squared = half_diagonal.length_squared();
+    const bool inside = center_distance_squared < radius_squared;
+    const double sin2_theta_b = inside ? 1.0 : radius_squared / center_distance_squared;
+    const double cos_theta_b = inside ? -1.0 : sqrt(1 - sin2_theta_b);
+    const double sin_theta_b = inside ? 0.0 : sqrt(sin2_theta_b);
+
+    // The smallest angle between an emission direction and the way to p.
+    // Lights that emit every way (spheres) always face p, and from inside
+    // the bounds every light might.
+    double cos_theta_p = 1;
+    if (cos_theta_o > -1 && !inside)
+    {
+        const double cos_theta_w = dot(axis, to_p);
+        const double sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+        const double sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+        const double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        const double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= cos_theta_e)
+            return 0;
+    }
+
+    double result = power * cos_theta_p / distance_squared;
+    if (n.length_squared() > 0 && !inside)
+    {
+        // Light arriving from below the surface counts for nothing.
+        const double cos_theta_i = -dot(n, to_p);
+        const double sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+        result *= fmax(0.0, cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b));
+    }
+    return result;
+}
+
+inline light_bounds merge(const light_bounds& a, const light_bounds& b)
+{
+    if (a.power <= 0)
+        return b;
+    if (b.power <= 0)
+        return a;
+    light_bounds result;
+    result.box = surrounding_box(a.box, b.box);
+    result.power = a.power + b.power;
+    light_bvh_detail::merge_cones(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, result.axis, result.cos_theta_o);
+    result.cos_theta_e = fmin(a.cos_theta_e, b.cos_theta_e);
+    return result;
+}
+
+// A binary tree over lights for picking one in proportion to how much it
+// might contribute at a shading point, after pbrt-v4's BVHLightSampler. At
+// each node, pick() descends into a child with probability proportional to
+// the child's light_bounds::importance(), so of thousands of lights the near
+// and bright ones are chosen, and the many far-off ones rarely. The cost is a
+// descent of log2(light count) nodes per pick, and the same again for pmf().
+class light_bvh
+{
+public:
+    // One light_bounds per light; lights keep their index.
+    void build(const std::vector<light_bounds>& lights);
+
+    [[nodiscard]] bool empty() const { return nodes.empty(); }
+    [[nodiscard]] size_t node_count() const { return nodes.size(); }
+
+    // Picks a light for a shading point at p with normal n, using the random
+    // number u in [0, 1). Fails when nothing can reach p.
+    bool pick(const point3& p, const vec3& n, double u, std::uint32_t& light, double& pmf) const;
+
+    // The probability that pick() chooses `light` at p.
+    [[nodiscard]] double pmf(const point3& p, const vec3& n, std::uint32_t light) const;
+
+private:
+    // Depth-first: an interior node's first child follows it, the second is
+    // at `offset`. A leaf's offset is its light.
+    struct node
+    {
+        light_bounds bounds;
+        std::uint32_t offset{ 0 };
+        bool leaf{ false };
+    };
+
+    std::uint32_t build_range(const std::vector<light_bounds>& lights, std::vector<std::uint32_t>& order,
+        size_t begin, size_t end, std::uint64_t trail, int depth);
+
+    std::vector<node> nodes;
+    // Per light, the way down to its leaf: bit d set means the second child at depth d.
+    std::vector<std::uint64_t> trails;
+};
+
+inline void light_bvh::build(const std::vector<light_bounds>& lights)
+{
+    nodes.clear();
+    trails.assign(lights.size(), 0);
+    if (lights.empty())
+        return;
+    nodes.reserve(2 * lights.size() - 1);
+    std::vector<std::uint32_t> order(lights.size());
+    for (std::uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    build_range(lights, order, 0, order.size(), 0, 0);
+}
+
+// Median splits along the widest axis of the centers. pbrt weighs splits by
+// power, area and orientation spread; with spheres, which all emit every
+// way, balanced halves in space come close and keep the tree shallow.
+inline std::uint32_t light_bvh::build_range(const std::vector<light_bounds>& lights, std::vector<std::uint32_t>& order,
+    size_t begin, size_t end, std::uint64_t trail, int depth)
+{
+    const auto index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+    if (end - begin == 1)
+    {
+        nodes[index].bounds = lights[order[begin]];
+        nodes[index].offset = order[begin];
+        nodes[index].leaf = true;
+        trails[order[begin]] = trail;
+        return index;
+    }
+
+    auto centroid = [&](std::uint32_t light) { return 0.5 * (lights[light].box.min() + lights[light].box.max()); };
+    point3 low(infinity, infinity, infinity), high(-infinity, -infinity, -infinity);
+    for (size_t i = begin; i < end; ++i)
+    {
+        const point3 c = centroid(order[i]);
+        for (int a = 0; a < 3; ++a)
+        {
+            low.e[a] = fmin(low.e[a], c.e[a]);
+            high.e[a] = fmax(high.e[a], c.e[a]);
+        }
+    }
+    const vec3 extent = high - low;
+    const int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+    const size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + static_cast<std::ptrdiff_t>(begin), order.begin() + static_cast<std::ptrdiff_t>(middle),
+        order.begin() + static_cast<std::ptrdiff_t>(end),
+        [&](std::uint32_t a, std::uint32_t b) { return centroid(a).e[axis] < centroid(b).e[axis]; });
+
+    build_range(lights, order, begin, middle, trail, depth + 1);
+    const std::uint32_t second = build_range(lights, order, middle, end, trail | (std::uint64_t{ 1 } << depth), depth + 1);
+    nodes[index].bounds = merge(nodes[index + 1].bounds, nodes[second].bounds);
+    nodes[index].offset = second;
+    return index;
+}
+
+inline bool light_bvh::pick(const point3& p, const vec3& n, double u, std::uint32_t& light, double& pmf) const
+{
+    if (nodes.empty() || nodes[0].bounds.importance(p, n) <= 0)
+        return false;
+    std::uint32_t current = 0;
+    pmf = 1;
+    while (!nodes[current].leaf)
+    {
+        const std::uint32_t first = current + 1, second = nodes[current].offset;
+        const double first_importance = nodes[first].bounds.importance(p, n);
+        const double second_importance = nodes[second].bounds.importance(p, n);
+        if (first_importance <= 0 && second_importance <= 0)
+            return false;
+        // Reuse u for the next level by stretching the chosen part back to [0, 1).
+        const double p_first = first_importance / (first_importance + second_importance);
+        if (u < p_first)
+        {
+            current = first;
+            pmf *= p_first;
+            u = fmin(u / p_first, 0.99999999999999989);
+        }
+        else
+        {
+            current = second;
+            pmf *= 1 - p_first;
+            u = fmin((u - p_first) / (1 - p_first), 0.99999999999999989);
+        }
+    }
+    light = nodes[current].offset;
+    return true;
+}
+
+inline double light_bvh::pmf(const point3& p, const vec3& n, std::uint32_t light) const
+{
+    if (nodes.empty() || nodes[0].bounds.importance(p, n) <= 0)
+        return 0;
+    std::uint64_t trail = trails[light];
+    std::uint32_t current = 0;
+    double result = 1;
+    while (!nodes[current].leaf)
+    {
+        const std::uint32_t first = current + 1, second = nodes[current].offset;
+        const double first_importance = nodes[first].bounds.importance(p, n);
+        const double second_importance = nodes[second].bounds.importance(p, n);
+        if (first_importance <= 0 && second_importance <= 0)
+            return 0;
+        const bool take_second = trail & 1;
+        result *= (take_second ? second_importance : first_importance) / (first_importance + second_importance);
+        current = take_second ? second : first;
+        trail >>= 1;
+    }
+    return result;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_bvh.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "rtweekend.h"
+#include "scene_bvh.h"
+#include "sphere.h"
+
+// An emissive sphere, still or moving, as the light sampler sees it.
+struct sphere_light
+{
+    const hittable* object{ nullptr };
+    const material* emitter{ nullptr };
+    point3 center0;
+    vec3 motion;                  // center1 - center0, zero for a still sphere
+    double time0{ 0 };
+    double inverse_duration{ 0 }; // 1 / (time1 - time0), zero for a still sphere
+    double radius{ 0 };
+
+    [[nodiscard]] point3 center(double time) const { return center0 + ((time - time0) * inverse_duration) * motion; }
+};
+
+// A direction towards a light, from a shading point.
+struct light_sample
+{
+    vec3 direction;   // unit length
+    double distance;  // to the light's surface along direction
+    double pdf;       // solid-angle density, the choice of light included
+    color radiance;   // what the light emits back along -direction
+};
+
+// 1 - cos_max for the cone of directions from p that meet a sphere, whose
+// solid angle is 2 pi times this; 0 when p is inside the sphere.
+inline double sphere_cone_one_minus_cos(const point3& p, const point3& center, double radius)
+{
+    const double distance_squared = (center - p).length_squared();
+    const double sin2_max = radius * radius / distance_squared;
+    if (sin2_max >= 1)
+        return 0;
+    // 1 - sqrt(1 - s) loses everything to cancellation for small lights far away.
+    return sin2_max / (1 + sqrt(1 - sin2_max));
+}
+
+// How light_list::sample() chooses among the lights.
+enum class light_selection
+{
+    uniform, // every light equally often
+    bvh,     // by estimated contribution at the shading point, through a light_bvh
+};
+
+// The emissive spheres of a scene (those whose material is a diffuse_light),
+// so the renderer can aim rays at them rather than wait for scattered rays to
+// find them. sample() picks a light (see light_selection), then a direction
+// uniformly inside the cone that light subtends; pdf() is the density
+// sample() would have had for a direction that happened to hit a light, for
+// weighting the two against each other. Lights are found at the top level
+// and inside hittable_list, bvh_node and scene_bvh containers. Spheres packed
+// in a sphere_array or placed through an instance (as scene files hold them)
+// are not, nor are other emissive shapes: those are lit by scattered rays
+// alone.
+class light_list
+{
+public:
+    light_list() = default;
+    explicit light_list(const std::vector<shared_ptr<hittable>>& objects, light_selection how = light_selection::bvh)
+    {
+        add_all(objects);
+        select(how);
+    }
+
+    // Switches how lights are chosen, building the light_bvh when first needed.
+    void select(light_selection how)
+    {
+        selection = how;
+        if (how == light_selection::bvh && hierarchy.empty() && !lights.empty())
+            build_hierarchy();
+    }
+
+    [[nodiscard]] light_selection selected() const { return selection; }
+    [[nodiscard]] const light_bvh& tree() const { return hierarchy; }
+
+    // Adds `object` if it is an emissive sphere, or the emissive spheres in
+    // it if it is one of the containers above; returns whether any was found.
+    bool add(const hittable& object)
+    {
+        if (const auto* list = dynamic_cast<const hittable_list*>(&object))
+            return add_all(list->hit_objects);
+        if (const auto* tree = dynamic_cast<const scene_bvh*>(&object))
+            return add_all(tree->objects);
+        if (const auto* node = dynamic_cast<const bvh_node*>(&object))
+        {
+            const bool left = add(*node->left);
+            // A leaf over one object holds it on both sides.
+            const bool right = node->right != node->left && add(*node->right);
+            return left || right;
+        }
+
+        sphere_light light;
+        const material* surface = nullptr;
+        if (const auto* still = dynamic_cast<const sphere*>(&object))
+        {
+            light.center0 = still->center;
+            light.radius = still->radius;
+            surface = still->object_material.get();
+        }
+        else if (const auto* moving = dynamic_cast<const moving_sphere*>(&object))
+        {
+            light.center0 = moving->center0;
+            light.motion = moving->center1 - moving->center0;
+            light.time0 = moving->time0;
+            light.inverse_duration = 1.0 / (moving->time1 - moving->time0);
+            light.radius = moving->radius;
+            surface = moving->mat_ptr.get();
+        }
+        if (!dynamic_cast<const diffuse_light*>(surface) || light.radius <= 0)
+            return false;
+        if (index.count(&object) != 0)
+            return true; // reached again through another container
+
+        light.object = &object;
+        light.emitter = surface;
+        index.emplace(&object, static_cast<std::uint32_t>(lights.size()));
+        lights.push_back(light);
+        hierarchy = {}; // out of date; select() rebuilds it
+        return true;
+    }
+
+    [[nodiscard]] bool empty() const { return lights.empty(); }
+    [[nodiscard]] size_t size() const { return lights.size(); }
+    [[nodiscard]] const std::vector<sphere_light>& all() const { return lights; }
+
+    // For a shading point at p with normal n (which only the light_bvh uses).
+    bool sample(const point3& p, const vec3& n, double time, light_sample& out) const
+    {
+        std::uint32_t chosen = 0;
+        double pick_pmf = 0;
+        if (!pick(p, n, chosen, pick_pmf))
+            return false;
+        const sphere_light& light = lights[chosen];
+
+        const point3 center = light.center(time);
+        const double one_minus_cos_max = sphere_cone_one_minus_cos(p, center, light.radius);
+        if (one_minus_cos_max <= 0)
+            return false;
+
+        // Uniform in cos_theta over [cos_max, 1] and in phi, about the axis to the center.
+        const vec3 w = unit_vector(center - p);
+        const vec3 a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        const vec3 v = unit_vector(cross(w, a));
+        const vec3 u = cross(w, v);
+        const double one_minus_cos = random_double() * one_minus_cos_max;
+        const double cos_theta = 1 - one_minus_cos;
+        const double sin_theta = sqrt(fmax(0.0, one_minus_cos * (2 - one_minus_cos)));
+        const double phi = 2 * pi * random_double();
+        out.direction = unit_vector(sin_theta * cos(phi) * u + sin_theta * sin(phi) * v + cos_theta * w);
+
+        // The light's own hit() gives the distance and the (u,v) its texture needs.
+        const ray towards(p, out.direction, time);
+        hit_record rec;
+        if (!light.object->hit(towards, 0, infinity, rec))
+            return false;
+        rec.finish_shading(towards);
+        out.distance = rec.t_of_ray;
+        out.radiance = rec.hit_material->emitted(rec);
+        out.pdf = pick_pmf / (2 * pi * one_minus_cos_max);
+        return true;
+    }
+
+    // The density sample() has, from p with normal n, for the direction that
+    // hit `rec`; 0 when rec is not on one of these lights.
+    [[nodiscard]] double pdf(const point3& p, const vec3& n, double time, const hit_record& rec) const
+    {
+        const auto found = index.find(rec.hit_object);
+        if (found == index.end())
+            return 0;
+        const sphere_light& light = lights[found->second];
+        const double one_minus_cos_max = sphere_cone_one_minus_cos(p, light.center(time), light.radius);
+        if (one_minus_cos_max <= 0)
+            return 0;
+        const double pick_pmf = selection == light_selection::bvh ? hierarchy.pmf(p, n, found->second) : 1.0 / lights.size();
+        return pick_pmf / (2 * pi * one_minus_cos_max);
+    }
+
+private:
+    bool add_all(const std::vector<shared_ptr<hittable>>& objects)
+    {
+        bool found = false;
+        for (const auto& object : objects)
+            found = add(*object) || found;
+        return found;
+    }
+
+    bool pick(const point3& p, const vec3& n, std::uint32_t& chosen, double& pick_pmf) const
+    {
+        if (lights.empty())
+            return false;
+        if (selection == light_selection::bvh)
+            return hierarchy.pick(p, n, random_double(), chosen, pick_pmf);
+        chosen = static_cast<std::uint32_t>(std::min(static_cast<size_t>(random_double() * lights.size()), lights.size() - 1));
+        pick_pmf = 1.0 / lights.size();
+        return true;
+    }
+
+    // A sphere emits every way, so its cone is the whole sphere of
+    // directions. Its power is pi * area * the luminance of its emission,
+    // taken at one point of the surface for textured lights.
+    void build_hierarchy()
+    {
+        std::vector<light_bounds> bounds(lights.size());
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            const sphere_light& light = lights[i];
+            const vec3 extent(light.radius, light.radius, light.radius);
+            const point3 end_center = light.center0 + light.motion;
+            bounds[i].box = surrounding_box(aabb(light.center0 - extent, light.center0 + extent), aabb(end_center - extent, end_center + extent));
+
+            hit_record rec;
+            rec.hit_point = light.center0 + vec3(0, light.radius, 0);
+            rec.normal_vec_of_hit = vec3(0, 1, 0);
+            rec.u = rec.v = 0.5;
+            const color emission = light.emitter->emitted(rec);
+            const double luminance = 0.2126 * emission.x() + 0.7152 * emission.y() + 0.0722 * emission.z();
+            bounds[i].power = pi * 4 * pi * light.radius * light.radius * luminance;
+        }
+        hierarchy.build(bounds);
+    }
+
+    std::vector<sphere_light> lights;
+    std::unordered_map<const hittable*, std::uint32_t> index;
+    light_selection selection{ light_selection::uniform };
+    light_bvh hierarchy;
+};
+
+#endif
@@ -1,44 +1,53 @@
 #include "rtweekend.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include "camera.h"
+#include "checkpoint.h"
+#include "cpu_topology.h"
 #include "color.h"
+#include "distributed.h"
 #include "hittable_list.h"
+#include "instance.h"
+#include "bvh.h"
 #include "material.h"
 #include "moving_sphere.h"
+#include "numa_replicas.h"
+#include "obj_loader.h"
+#include "render_benchmark.h"
+#include "render_stats.h"
+#include "renderer.h"
+#include "scene_arena.h"
+#include "scene_bvh.h"
+#include "scene_file.h"
 #include "sphere.h"
 #include "texture.h"
+#include "triangle_mesh.h"
 
-color ray_color(const ray& r, const hittable& world, int depth)
-{
-    hit_record record;
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color{ 0, 0, 0 };
-
-    if (world.hit(r, 0.001, infinity, record))
-    {
-        ray scattered;
-        color attenuation;
-        if (record.hit_material->scatter(r, record, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth - 1);
-        return color{ 0, 0, 0 };
-    }
-    const vec3 unit_direction = unit_vector(r.direction());
-    const auto t = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
-}
-
-hittable_list random_scene()
+// max_rise is how far the diffuse spheres move up during the shutter; the
+// book uses 0.5, larger values make fast movers with long bounding boxes.
+// The small spheres fill a grid of 2 * half_extent cells on a side. Every
+// object is made in `arena`, which the returned list keeps alive. A `glow`
+// fraction of the small diffuse spheres are lights instead, for rendering
+// the scene at night.
+hittable_list random_scene(double max_rise = 0.5, int half_extent = 11, scene_arena arena = {}, double glow = 0)
 {
     hittable_list world;
+    world.storage = arena.storage();
 
-    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+    auto checker = arena.make<checker_texture>(
+        arena.make<solid_color>(color(0.2, 0.3, 0.1)), arena.make<solid_color>(color(0.9, 0.9, 0.9)));
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(checker)));
 
-    for (int a = -11; a < 11; a++)
+    for (int a = -half_extent; a < half_extent; a++)
     {
-        for (int b = -11; b < 11; b++)
+        for (int b = -half_extent; b < half_extent; b++)
         {
 	        const double choose_mat = random_double();
             point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
@@ -47,13 +56,20 @@ hittable_list random_scene()
             {
                 shared_ptr<material> sphere_material;
 
-                if (choose_mat < 0.8)
+                // Only glowing scenes draw the extra number, so the others stay as they were.
+                if (choose_mat < 0.8 && glow > 0 && random_double() < glow)
+                {
+                    // light
+                    sphere_material = arena.make<diffuse_light>(color::random(1, 4));
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.8)
                 {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, .5), 0);
-                    world.add(make_shared<moving_sphere>(
+                    sphere_material = arena.make<lambertian>(albedo);
+                    auto center2 = center + vec3(0, random_double(0, max_rise), 0);
+                    world.add(arena.make<moving_sphere>(
                         center, center2, 0.0, 1.0, 0.2, sphere_material));
                 }
                 else if (choose_mat < 0.95)
@@ -61,74 +77,1085 @@ hittable_list random_scene()
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
                 else
                 {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<dielectric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = arena.make<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = arena.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
 
     return world;
 }
 
+// A low-poly tree: a cone of `sides` triangles on top of a square trunk.
+shared_ptr<triangle_mesh> tree_mesh(int sides, shared_ptr<material> mat)
+{
+    std::vector<mesh_vertex> vertices;
+    std::vector<std::uint32_t> indices;
+
+    // Crown: apex, then a ring at y = 0.6.
+    vertices.push_back({ 0.0f, 2.0f, 0.0f });
+    for (int i = 0; i < sides; ++i)
+    {
+        const double angle = 2 * pi * i / sides;
+        vertices.push_back({ static_cast<float>(0.7 * cos(angle)), 0.6f, static_cast<float>(0.7 * sin(angle)) });
+    }
+    for (int i = 0; i < sides; ++i)
+    {
+        const auto a = static_cast<std::uint32_t>(1 + i);
+        const auto b = static_cast<std::uint32_t>(1 + (i + 1) % sides);
+        indices.insert(indices.end(), { 0u, b, a });
+    }
+
+    // Trunk: four walls of a 0.2 x 0.6 box.
+    const auto base = static_cast<std::uint32_t>(vertices.size());
+    for (const float y : { 0.0f, 0.6f })
+        for (const auto& xz : { std::pair{ -0.1f, -0.1f }, { 0.1f, -0.1f }, { 0.1f, 0.1f }, { -0.1f, 0.1f } })
+            vertices.push_back({ xz.first, y, xz.second });
+    for (std::uint32_t i = 0; i < 4; ++i)
+    {
+        const std::uint32_t j = (i + 1) % 4;
+        indices.insert(indices.end(), { base + i, base + j, base + 4 + j, base + i, base + 4 + j, base + 4 + i });
+    }
+
+    return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), std::move(mat));
+}
 
-int main()
+// Many copies of one tree mesh: every tree is an instance (a transform and a
+// pointer to the shared mesh), so memory grows with the instance count only.
+hittable_list forest_scene(int tree_count)
 {
-    // Image
-    const auto aspect_ratio = 16.0 / 9.0;
-    const int image_width = 400;
-    const int image_height = static_cast<int>(image_width / aspect_ratio);
-    const int samples_per_pixel =100;
-    const int max_depth = 50;
+    hittable_list world;
 
-    const hittable_list world = random_scene();
+    auto ground = make_shared<lambertian>(color(0.3, 0.4, 0.2));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
 
-    // Camera
-    const point3 lookfrom(13, 2, 3);
-    const point3 lookat(0, 0, 0);
-    const vec3 vup(0, 1, 0);
-    const auto dist_to_focus = 10.0;
-    const auto aperture = 0.1;
+    const auto tree = tree_mesh(32, make_shared<lambertian>(color(0.1, 0.35, 0.1)));
+    const double radius = sqrt(static_cast<double>(tree_count));
+    for (int i = 0; i < tree_count; ++i)
+    {
+        const auto placement = affine_transform::translation(vec3(random_double(-radius, radius), 0, random_double(-radius, radius)))
+                             * affine_transform::rotation_y(random_double(0, 360))
+                             * affine_transform::scaling(random_double(0.6, 1.4));
+        world.add(make_shared<instance>(tree, placement));
+    }
 
-    const camera camera(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
+    return world;
+}
 
-    // Render
-    // TODO: Only after completing the project should it experimentally apply OpenMP and Sobol sequence.
-    std::ofstream output_image("output_image(0405_4_13).ppm");
-    output_image << "P3\n" << image_width << " " << image_height << "\n255\n";
-    for (int j = image_height - 1; j >= 0; --j)
+// The bounds of forest_scene()'s trees, for framing_view(): the tallest tree
+// (scale 1.4) standing anywhere in the square they are scattered over.
+aabb forest_bounds(int tree_count)
+{
+    const double reach = sqrt(static_cast<double>(tree_count)) + 1.4 * 0.7;
+    return aabb(point3(-reach, 0, -reach), point3(reach, 1.4 * 2.0, reach));
+}
+
+// The book's camera for the final scene, as stored with an exported scene.
+scene_file::camera_record random_still_view()
+{
+    scene_file::camera_record view{};
+    const double lookfrom[3] = { 13, 2, 3 };
+    const double vup[3] = { 0, 1, 0 };
+    std::copy(std::begin(lookfrom), std::end(lookfrom), view.lookfrom);
+    std::copy(std::begin(vup), std::end(vup), view.vup);
+    view.vertical_fov = 20;
+    view.aspect_ratio = 16.0 / 9.0;
+    view.aperture = 0.1;
+    view.focus_distance = 10.0;
+    return view;
+}
+
+// A camera looking at `box` from in front, a little to the side and above,
+// far enough back that the box's bounding sphere fills most of the frame.
+scene_file::camera_record framing_view(const aabb& box)
+{
+    const point3 center = 0.5 * (box.min() + box.max());
+    const double radius = fmax(0.5 * (box.max() - box.min()).length(), 1e-6);
+    scene_file::camera_record view{};
+    view.vertical_fov = 30;
+    view.aspect_ratio = 16.0 / 9.0;
+    view.focus_distance = radius / sin(degrees_to_radians(0.4 * view.vertical_fov));
+    const point3 lookfrom = center + view.focus_distance * unit_vector(vec3(0.35, 0.3, 1));
+    const double vup[3] = { 0, 1, 0 };
+    std::copy(std::begin(lookfrom.e), std::end(lookfrom.e), view.lookfrom);
+    std::copy(std::begin(center.e), std::end(center.e), view.lookat);
+    std::copy(std::begin(vup), std::end(vup), view.vup);
+    return view;
+}
+
+// A mesh (--obj) on a ground sphere that touches the bottom of its bounds.
+hittable_list mesh_scene(const shared_ptr<triangle_mesh>& mesh, const aabb& box)
+{
+    hittable_list world;
+    const point3 center = 0.5 * (box.min() + box.max());
+    const double ground_radius = 1000 * fmax((box.max() - box.min()).length(), 1e-3);
+    world.add(make_shared<sphere>(point3(center.x(), box.min().y() - ground_radius, center.z()), ground_radius,
+        make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.add(mesh);
+    return world;
+}
+
+// Traces `ray_count` rays at the mesh, from a sphere around its bounds
+// towards random points inside them, through hit() and through
+// brute_force_hit(), and reports where the two disagree: on whether there is
+// a hit, or on its distance by more than float precision allows.
+bool check_mesh_hits(const triangle_mesh& mesh, const aabb& box, int ray_count)
+{
+    seed_random(2022);
+    const point3 center = 0.5 * (box.min() + box.max());
+    const double radius = fmax(0.5 * (box.max() - box.min()).length(), 1e-6);
+    int hits = 0, mismatches = 0;
+    for (int i = 0; i < ray_count; ++i)
     {
-        std::cerr << "\rScan-lines remaining: " << j << ' ' << std::flush;
+        const point3 origin = center + 2 * radius * random_unit_vector();
+        point3 target;
+        for (int a = 0; a < 3; ++a)
+            target.e[a] = random_double(box.min().e[a], box.max().e[a]);
+        const ray r(origin, target - origin);
 
-        for (int i = 0; i < image_width; ++i)
+        hit_record rec;
+        double reference_t = 0;
+        const bool hit = mesh.hit(r, 0.001, infinity, rec);
+        const bool reference_hit = mesh.brute_force_hit(r, 0.001, infinity, reference_t);
+        hits += reference_hit ? 1 : 0;
+        if (hit != reference_hit || (hit && fabs(rec.t_of_ray - reference_t) > 1e-4 * fmax(1.0, reference_t)))
         {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s)
+            if (++mismatches <= 5)
+                std::cerr << "ray " << i << ": hit " << (hit ? rec.t_of_ray : -1) << ", reference " << (reference_hit ? reference_t : -1) << "\n";
+        }
+    }
+    std::cerr << ray_count << " rays, " << hits << " hits, " << mismatches << " disagree with the brute-force reference\n";
+    return mismatches == 0;
+}
+
+// How the built-in scenes build their top-level BVH (--bvh-builder), and
+// whether they pool their objects in a scene_arena (--scene-allocation).
+bvh_build_options world_bvh_options;
+bool pooled_scenes = true;
+
+// The local still: random_scene() with N by N cells (--scene-size), the
+// fraction of its diffuse spheres that glow (--glow), and how the renderer
+// picks which of those lights to sample (--light-selection).
+int still_scene_size = 22;
+double still_glow = 0;
+light_selection still_light_selection = light_selection::bvh;
+
+scene_arena make_scene_arena()
+{
+    return pooled_scenes ? scene_arena() : scene_arena::heap();
+}
+
+// Builds random_scene() (N by N cells) both ways and prints what its objects
+// cost and where they lie, in the order the scene BVH visits them.
+void print_layout_report(int scene_size)
+{
+    for (const bool pooled : { false, true })
+    {
+        seed_random(2022);
+        const scene_arena arena = pooled ? scene_arena() : scene_arena::heap();
+        const scene_bvh world(random_scene(0.5, scene_size / 2, arena), 0.0, 1.0, world_bvh_options);
+        std::cerr << arena.report() << "\n" << measure_layout(world.objects) << "\n";
+    }
+}
+
+// The book's final scene as a single still: nothing moves between frames.
+class random_still final : public animated_scene
+{
+public:
+    random_still() : random_still(random_scene(0.5, still_scene_size / 2, make_scene_arena(), still_glow)) {}
+
+    explicit random_still(const hittable_list& list)
+        : world_bvh(list, 0.0, 1.0, world_bvh_options), emitters(list.hit_objects, still_light_selection)
+    {}
+
+    bvh_update_report set_frame(int) override { return {}; }
+
+    [[nodiscard]] const hittable& world() const override { return world_bvh; }
+
+    [[nodiscard]] camera frame_camera() const override { return scene_file::make_camera(random_still_view()); }
+
+    [[nodiscard]] const light_list* lights() const override { return emitters.empty() ? nullptr : &emitters; }
+
+private:
+    scene_bvh world_bvh;
+    light_list emitters;
+};
+
+// A still loaded from a scene file, seen through the file's camera.
+class file_still final : public animated_scene
+{
+public:
+    bool load(const std::string& path)
+    {
+        if (!scene_file::load_scene(path, scene, world_bvh_options.node_format))
+            return false;
+        std::cerr << scene.report << "\n";
+        return true;
+    }
+
+    bvh_update_report set_frame(int) override { return {}; }
+
+    [[nodiscard]] const hittable& world() const override { return scene.world; }
+
+    [[nodiscard]] camera frame_camera() const override { return scene_file::make_camera(scene.view); }
+
+private:
+    scene_file::loaded_scene scene;
+};
+
+// A still of objects assembled here rather than by random_scene(), such as an
+// OBJ mesh (--obj) or a forest of instanced trees (--forest), seen through `view`.
+class list_still final : public animated_scene
+{
+public:
+    list_still(const hittable_list& list, const scene_file::camera_record& view)
+        : world_bvh(list, 0.0, 1.0, world_bvh_options), view(view)
+    {}
+
+    bvh_update_report set_frame(int) override { return {}; }
+
+    [[nodiscard]] const hittable& world() const override { return world_bvh; }
+
+    [[nodiscard]] camera frame_camera() const override { return scene_file::make_camera(view); }
+
+private:
+    scene_bvh world_bvh;
+    scene_file::camera_record view;
+};
+
+// random_scene() in motion: the diffuse spheres bounce, each with its own
+// height and phase, blurred over the frame's shutter, while the camera orbits.
+class bouncing_spheres final : public animated_scene
+{
+public:
+    explicit bouncing_spheres(std::uint64_t seed)
+    {
+        // Both copies render_sequence() makes must hold the same spheres.
+        seed_random(seed);
+        const hittable_list list = random_scene(0.5, 11, make_scene_arena());
+        for (const auto& object : list.hit_objects)
+        {
+            if (auto sphere = std::dynamic_pointer_cast<moving_sphere>(object))
             {
-	            const double u = (i + random_double()) / (image_width - 1);
-	            const double v = (j + random_double()) / (image_height - 1);
-                ray r = camera.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
+                spheres.push_back({ sphere, sphere->center0, random_double(0.2, 1.5), random_double(0, 2 * pi) });
             }
-            write_color(output_image, pixel_color, samples_per_pixel);
         }
+        world_bvh = scene_bvh(list, 0.0, 1.0, world_bvh_options);
+    }
+
+    bvh_update_report set_frame(int frame) override
+    {
+        current_frame = frame;
+        for (const auto& bouncer : spheres)
+        {
+            bouncer.sphere->center0 = bouncer.rest + vec3(0, bounce(bouncer, frame), 0);
+            bouncer.sphere->center1 = bouncer.rest + vec3(0, bounce(bouncer, frame + 1), 0);
+        }
+        return world_bvh.update(0.0, 1.0);
+    }
+
+    [[nodiscard]] const hittable& world() const override { return world_bvh; }
+
+    [[nodiscard]] camera frame_camera() const override
+    {
+        const auto orbit = affine_transform::rotation_y(0.5 * current_frame);
+        return camera(orbit.apply_point(point3(13, 2, 3)), point3(0, 0, 0), vec3(0, 1, 0), 20, 16.0 / 9.0, 0.1, 10.0, 0.0, 1.0);
+    }
+
+private:
+    struct bouncer
+    {
+        shared_ptr<moving_sphere> sphere;
+        point3 rest;
+        double height;
+        double phase;
+    };
+
+    static double bounce(const bouncer& b, int frame)
+    {
+        return b.height * fabs(sin(b.phase + 0.15 * frame));
+    }
+
+    std::vector<bouncer> spheres;
+    scene_bvh world_bvh;
+    int current_frame{ 0 };
+};
+
+// Scene ids shared by the local, coordinator and worker modes.
+std::unique_ptr<animated_scene> make_scene(std::uint32_t scene)
+{
+    if (scene == 1)
+        return std::make_unique<bouncing_spheres>(2022);
+    seed_random(2022);
+    return std::make_unique<random_still>();
+}
+
+// Writes the statistics counters gathered since the last reset as JSON.
+bool write_stats(const std::string& path, double seconds)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write statistics '" << path << "'.\n";
+        return false;
+    }
+    stats::write_json(out, stats::registry::global().totals(), seconds);
+    return static_cast<bool>(out);
+}
+
+// Compares the still with a converged render of the same view (the same
+// settings at many more samples per pixel) and prints the RMS error of the
+// 8-bit output, and MSE times render seconds: the lower that product, the
+// less noise a sampling strategy leaves for the time it takes.
+bool report_noise(const std::string& reference_path, const frame_image& image, double seconds)
+{
+    std::ifstream reference(reference_path);
+    std::string magic;
+    int width = 0, height = 0, max_value = 0;
+    if (!(reference >> magic >> width >> height >> max_value) || magic != "P3")
+    {
+        std::cerr << "ERROR: Could not read reference image '" << reference_path << "'.\n";
+        return false;
+    }
+    if (width != image.width || height != image.height)
+    {
+        std::cerr << "ERROR: Reference image '" << reference_path << "' is " << width << "x" << height << ", not "
+                  << image.width << "x" << image.height << ".\n";
+        return false;
+    }
+
+    // Quantized exactly as write_ppm() writes the still.
+    std::stringstream ours;
+    for (int j = image.height - 1; j >= 0; --j)
+    {
+        for (int i = 0; i < image.width; ++i)
+            write_color(ours, image.at(i, j), image.samples_per_pixel);
+    }
+    double squared_error = 0;
+    size_t count = 0;
+    for (int value = 0, expected = 0; ours >> value; ++count)
+    {
+        if (!(reference >> expected))
+        {
+            std::cerr << "ERROR: Reference image '" << reference_path << "' is truncated.\n";
+            return false;
+        }
+        squared_error += static_cast<double>(value - expected) * (value - expected);
     }
+    const double mse = count > 0 ? squared_error / count : 0.0;
+    std::cerr << "\nRMSE " << sqrt(mse) << " against " << reference_path << " in " << seconds << " s, MSE x seconds "
+              << mse * seconds << "\n";
+    return true;
+}
+
+// What --benchmark renders: random_scene() with N by N cells (--scene-size)
+// and spheres rising by up to --max-rise, over the --accel structure. With
+// --thread-sweep the still is rendered again at each of those thread counts;
+// --pin places every render's threads. --numa-replicate builds one copy of
+// the scene per NUMA node and routes each thread, pinned round-robin over the
+// nodes, to its node's copy.
+struct benchmark_options
+{
+    int scene_size{ 22 };
+    double max_rise{ 0.5 };
+    std::string accelerator{ "bvh" }; // bvh (scene_bvh), bvh-node (the book's bvh_node) or list
+    std::string bvh_builder{ "sah" };
+    std::string bvh_nodes{ "full" };
+    pin_policy pinning{ pin_policy::none };
+    std::string pinning_name{ "none" };
+    std::vector<int> thread_sweep;
+    bool numa_replicate{ false };
+};
+
+// Builds and renders one still, timing each phase, and writes the report as
+// JSON to report_path and the image to image_path.
+bool run_render_benchmark(const render_settings& settings, const benchmark_options& options, const std::string& image_path,
+    const std::string& report_path)
+{
+    using clock = std::chrono::steady_clock;
+    auto seconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    render_benchmark_report report;
+    report.image_width = settings.image_width;
+    report.image_height = settings.image_height;
+    report.samples_per_pixel = settings.samples_per_pixel;
+    report.max_depth = settings.max_depth;
+    report.scene_size = options.scene_size;
+    report.max_rise = options.max_rise;
+    report.accelerator = options.accelerator;
+    report.bvh_builder = options.bvh_builder;
+    report.bvh_nodes = options.bvh_nodes;
+    report.pinning = options.numa_replicate ? "numa" : options.pinning_name;
+
+    if (options.accelerator != "bvh" && options.accelerator != "bvh-node" && options.accelerator != "list")
+    {
+        std::cerr << "ERROR: unknown acceleration structure '" << options.accelerator << "'.\n";
+        return false;
+    }
+
+    // One complete copy of the scene and its accelerator. The phase times are
+    // those of the first copy made.
+    auto make_world = [&]() -> std::shared_ptr<const hittable> {
+        struct built_world
+        {
+            hittable_list list;
+            scene_bvh flat;
+            shared_ptr<bvh_node> tree;
+        };
+        const bool first = report.objects == 0;
+        auto built = std::make_shared<built_world>();
+
+        auto start = clock::now();
+        seed_random(2022);
+        built->list = random_scene(options.max_rise, options.scene_size / 2, make_scene_arena());
+        if (first)
+        {
+            report.objects = built->list.hit_objects.size();
+            report.scene_seconds = seconds_since(start);
+        }
+
+        start = clock::now();
+        const hittable* top = &built->list;
+        if (options.accelerator == "bvh")
+        {
+            built->flat = scene_bvh(built->list, 0.0, 1.0, world_bvh_options);
+            top = &built->flat;
+        }
+        else if (options.accelerator == "bvh-node")
+        {
+            const auto& objects = built->list.hit_objects;
+            built->tree = make_shared<bvh_node>(objects, 0, objects.size(), 0.0, 1.0, settings.thread_count);
+            top = built->tree.get();
+        }
+        if (first)
+            report.build_seconds = seconds_since(start);
+        return std::shared_ptr<const hittable>(built, top);
+    };
+
+    const cpu_topology topology = cpu_topology::detect();
+    std::shared_ptr<const hittable> single;
+    std::unique_ptr<numa_replicated_world> replicated;
+    const hittable* world = nullptr;
+    if (options.numa_replicate)
+    {
+        const auto start = clock::now();
+        replicated = std::make_unique<numa_replicated_world>(topology, make_world);
+        report.replicas = replicated->replica_count();
+        report.replicate_seconds = seconds_since(start);
+        world = replicated.get();
+    }
+    else
+    {
+        single = make_world();
+        world = single.get();
+    }
+
+    scene_file::camera_record view = random_still_view();
+    view.aspect_ratio = static_cast<double>(settings.image_width) / settings.image_height;
+    camera cam = scene_file::make_camera(view);
+    cam.set_image_size(settings.image_width, settings.image_height, settings.samples_per_pixel);
+    const ray_counting_world counted(*world);
+
+    // Every render runs with the hooks in place, to pin its threads and to
+    // measure their idle time. The calling thread is worker 0, so it gets its
+    // own affinity back at the end.
+    const std::vector<unsigned> caller_cpus = current_thread_cpus();
+    parallel_hooks hooks;
+    if (replicated)
+        hooks.on_start = [&](unsigned worker) { replicated->enter(worker); };
+    else if (options.pinning != pin_policy::none)
+        hooks.on_start = [&](unsigned worker) { pin_current_thread(topology.placement(options.pinning, worker)); };
+    active_parallel_hooks() = &hooks;
+
+    auto timed_render = [&](unsigned threads, frame_image& image) {
+        render_settings run = settings;
+        run.thread_count = threads;
+        ray_counting_world::reset();
+        const auto render_start = clock::now();
+        render_frame(counted, cam, run, 0, image);
+        thread_scaling_point point;
+        point.seconds = seconds_since(render_start);
+        point.rays = ray_counting_world::total();
+        point.threads = static_cast<unsigned>(hooks.busy_seconds.size());
+        for (const double busy : hooks.busy_seconds)
+            point.idle_seconds.push_back(std::max(0.0, point.seconds - busy));
+        return point;
+    };
+
+    frame_image image;
+    const thread_scaling_point still = timed_render(settings.thread_count, image);
+    report.threads = still.threads;
+    report.render_seconds = still.seconds;
+    report.rays = still.rays;
+    for (const int threads : options.thread_sweep)
+    {
+        frame_image scratch;
+        report.scaling.push_back(timed_render(static_cast<unsigned>(threads), scratch));
+        const thread_scaling_point& point = report.scaling.back();
+        std::cerr << point.threads << " threads: " << point.mrays_per_second() << " Mrays/s, "
+                  << 100.0 * point.idle_fraction() << "% idle\n";
+    }
+
+    active_parallel_hooks() = nullptr;
+    if (!caller_cpus.empty())
+        pin_current_thread(caller_cpus);
+    report.primary_rays = static_cast<std::uint64_t>(settings.image_width) * settings.image_height * settings.samples_per_pixel;
+
+    const auto output_start = clock::now();
+    if (!write_ppm(image_path, image))
+        return false;
+    report.output_seconds = seconds_since(output_start);
+    report.peak_rss_bytes = peak_resident_bytes();
+
+    std::ofstream out(report_path);
+    write_json(out, report);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write benchmark report '" << report_path << "'.\n";
+        return false;
+    }
+    std::cerr << report.objects << " objects, " << report.rays << " rays in " << report.render_seconds << " s: "
+              << report.mrays_per_second() << " Mrays/s\n";
+    return true;
+}
+
+// Starts `count` workers on this machine, each a copy of this executable.
+// `running` counts those that have not exited yet.
+std::vector<std::thread> spawn_local_workers(const std::string& executable, int count, std::uint16_t port, unsigned threads,
+    std::atomic<int>& running)
+{
+    std::vector<std::thread> workers;
+    running += count;
+    for (int w = 0; w < count; ++w)
+    {
+        const std::string command = "\"" + executable + "\" --worker 127.0.0.1:" + std::to_string(port)
+                                  + " --threads " + std::to_string(threads);
+        workers.emplace_back([command, &running] {
+            std::system(command.c_str());
+            --running;
+        });
+    }
+    return workers;
+}
+
+const char* usage =
+    " [--frames 0-99[,120-139]] [--output path-or-prefix] [--threads N]\n"
+    "    [--coordinator PORT [--spawn-workers N]] [--worker HOST:PORT]\n"
+    "    [--checkpoint FILE [--checkpoint-interval SECONDS] [--resume]]\n"
+    "    [--scene FILE] [--export-scene FILE [--scene-size N] [--no-bvh]] [--bvh-cache DIRECTORY]\n"
+    "    [--obj FILE [--obj-check RAYS]] [--forest N]\n"
+    "    [--bvh-builder sah|morton|morton-treelets [--morton-bits 30|63]]\n"
+    "    [--bvh-nodes full|16|8] [--scene-allocation arena|heap] [--layout-report [--scene-size N]]\n"
+    "    [--stats FILE] [--heatmap PREFIX]\n"
+    "    [--width N] [--height N] [--samples N] [--depth N] [--scene-size N] [--glow FRACTION [--no-nee]\n"
+    "        [--light-selection bvh|uniform]] [--reference FILE]\n"
+    "    [--benchmark FILE [--scene-size N] [--max-rise X] [--accel bvh|bvh-node|list]\n"
+    "        [--thread-sweep 1-4,8,16] [--pin none|cores|smt|numa | --numa-replicate]]\n";
+
+// Without --frames a single still of random_scene() is rendered.
+// --coordinator renders through worker processes instead of locally; they
+// build its still, with its --scene-size, --glow and --light-selection.
+// It gives up once its --spawn-workers have all exited, or after two minutes
+// with no worker connected, while frames are unfinished.
+// --checkpoint saves a still's progress every so often; --resume continues it.
+// --export-scene writes random_scene() (N by N cells of small spheres) and its
+// camera to a scene file and exits; --scene renders the still from such a file.
+// --obj renders the triangles of a Wavefront OBJ file on a ground sphere
+// instead, or with --export-scene writes them to a scene file; --obj-check
+// traces RAYS rays at the mesh through its BVH and through a brute-force
+// double-precision reference, reports where they disagree and exits.
+// --forest renders N instances of one tree mesh scattered on a ground sphere,
+// or with --export-scene writes them (one mesh, N instances) to a scene file.
+// --bvh-cache keeps built BVHs in DIRECTORY and reuses them while the geometry
+// is unchanged.
+// --bvh-builder picks how the scene's BVH is built: binned SAH (the default),
+// a Morton-code LBVH, or an LBVH improved by treelet restructuring.
+// --bvh-nodes 16 or 8 traverses the scene's BVHs (the top level, and a scene
+// file's spheres) as quantized_bvh copies with 16- or 8-bit child boxes.
+// --scene-allocation heap makes every object with make_shared, as before the
+// scene arena; --layout-report compares the two layouts (for --scene-size)
+// and exits.
+// --stats writes ray, BVH node and primitive test counts of a local render as
+// JSON; it needs a build with RT_ENABLE_STATS defined.
+// --heatmap writes PREFIX_time.ppm, and in such a build PREFIX_nodes.ppm and
+// PREFIX_tests.ppm, false-color images of what each pixel of the still cost.
+// --width, --height, --samples and --depth override the 400 pixel wide 16:9
+// image at 100 samples per pixel and 50 bounces; --scene-size sizes the still.
+// --glow turns that fraction of the still's diffuse spheres into lights and
+// the sky off, and samples the lights directly (next-event estimation) unless
+// --no-nee asks for scattered rays alone. --light-selection picks those lights
+// by estimated contribution through a light BVH (the default), or uniformly.
+// Only spheres reachable through lists and BVH nodes are sampled (see
+// light_list); scene files have no emissive materials and keep their spheres
+// in sphere_arrays and instances, so --glow does not apply to --scene.
+// --reference compares the still with a converged one and prints its noise.
+// --benchmark renders random_scene() (--scene-size, --max-rise) over the
+// --accel structure once and writes phase times, Mrays/s and peak RSS as
+// JSON to FILE. --thread-sweep renders it again at each thread count and adds
+// speedup, efficiency and per-thread idle time; --pin places the threads one
+// per physical core first, SMT siblings together, or round-robin over NUMA
+// nodes.
+int main(int argc, char* argv[])
+{
+    // Image
+    const auto aspect_ratio = 16.0 / 9.0;
+    int image_width = 400;
+    int image_height = 0; // from the aspect ratio unless --height is given
+    int samples_per_pixel =100;
+    int max_depth = 50;
+
+    render_settings settings;
+
+    std::vector<int> frames;
+    std::string output;
+    std::string worker_address;
+    int coordinator_port = -1;
+    int spawn_workers = 0;
+    std::string checkpoint_path;
+    double checkpoint_interval = 60.0;
+    bool resume = false;
+    std::string scene_path;
+    std::string obj_path;
+    int obj_check_rays = 0;
+    int forest_trees = 0;
+    std::string export_path;
+    int scene_size = 22;
+    bool export_bvh = true;
+    bool layout_report = false;
+    std::string stats_path;
+    std::string heatmap_prefix;
+    std::string benchmark_path;
+    benchmark_options bench;
+    bool direct_lighting = true;
+    std::string reference_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            if (!parse_frame_ranges(argv[++i], frames))
+                return 1;
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            settings.thread_count = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--coordinator") == 0 && i + 1 < argc)
+            coordinator_port = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--spawn-workers") == 0 && i + 1 < argc)
+            spawn_workers = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--worker") == 0 && i + 1 < argc)
+            worker_address = argv[++i];
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else if (std::strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+            checkpoint_interval = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (std::strcmp(argv[i], "--obj") == 0 && i + 1 < argc)
+            obj_path = argv[++i];
+        else if (std::strcmp(argv[i], "--obj-check") == 0 && i + 1 < argc)
+            obj_check_rays = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--forest") == 0 && i + 1 < argc)
+            forest_trees = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--export-scene") == 0 && i + 1 < argc)
+            export_path = argv[++i];
+        else if (std::strcmp(argv[i], "--scene-size") == 0 && i + 1 < argc)
+            scene_size = std::max(2, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--no-bvh") == 0)
+            export_bvh = false;
+        else if (std::strcmp(argv[i], "--bvh-cache") == 0 && i + 1 < argc)
+            bvh_cache::global().set_directory(argv[++i]);
+        else if (std::strcmp(argv[i], "--bvh-builder") == 0 && i + 1 < argc)
+        {
+            const std::string builder = argv[++i];
+            bench.bvh_builder = builder;
+            if (builder == "sah")
+                world_bvh_options.builder = bvh_builder::binned_sah;
+            else if (builder == "morton")
+                world_bvh_options.builder = bvh_builder::morton;
+            else if (builder == "morton-treelets")
+                world_bvh_options.builder = bvh_builder::morton_treelets;
+            else
+            {
+                std::cerr << "ERROR: unknown BVH builder '" << builder << "'.\n";
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--morton-bits") == 0 && i + 1 < argc)
+            world_bvh_options.morton_bits = std::atoi(argv[++i]) <= 30 ? 30 : 63;
+        else if (std::strcmp(argv[i], "--bvh-nodes") == 0 && i + 1 < argc)
+        {
+            const std::string format = argv[++i];
+            bench.bvh_nodes = format;
+            if (format == "full")
+                world_bvh_options.node_format = bvh_node_format::full;
+            else if (format == "16")
+                world_bvh_options.node_format = bvh_node_format::quantized16;
+            else if (format == "8")
+                world_bvh_options.node_format = bvh_node_format::quantized8;
+            else
+            {
+                std::cerr << "ERROR: --bvh-nodes expects full, 16 or 8.\n";
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--scene-allocation") == 0 && i + 1 < argc)
+            pooled_scenes = std::strcmp(argv[++i], "heap") != 0;
+        else if (std::strcmp(argv[i], "--layout-report") == 0)
+            layout_report = true;
+        else if (std::strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            stats_path = argv[++i];
+        else if (std::strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc)
+            heatmap_prefix = argv[++i];
+        else if (std::strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            image_width = std::max(2, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+            image_height = std::max(2, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            samples_per_pixel = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            max_depth = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--glow") == 0 && i + 1 < argc)
+            still_glow = std::clamp(std::atof(argv[++i]), 0.0, 1.0);
+        else if (std::strcmp(argv[i], "--no-nee") == 0)
+            direct_lighting = false;
+        else if (std::strcmp(argv[i], "--light-selection") == 0 && i + 1 < argc)
+        {
+            const char* how = argv[++i];
+            if (std::strcmp(how, "bvh") == 0)
+                still_light_selection = light_selection::bvh;
+            else if (std::strcmp(how, "uniform") == 0)
+                still_light_selection = light_selection::uniform;
+            else
+            {
+                std::cerr << "ERROR: --light-selection expects bvh or uniform.\n";
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--reference") == 0 && i + 1 < argc)
+            reference_path = argv[++i];
+        else if (std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmark_path = argv[++i];
+        else if (std::strcmp(argv[i], "--max-rise") == 0 && i + 1 < argc)
+            bench.max_rise = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--accel") == 0 && i + 1 < argc)
+            bench.accelerator = argv[++i];
+        else if (std::strcmp(argv[i], "--thread-sweep") == 0 && i + 1 < argc)
+        {
+            if (!parse_frame_ranges(argv[++i], bench.thread_sweep))
+                return 1;
+            bench.thread_sweep.erase(std::remove_if(bench.thread_sweep.begin(), bench.thread_sweep.end(),
+                [](int threads) { return threads < 1; }), bench.thread_sweep.end());
+        }
+        else if (std::strcmp(argv[i], "--numa-replicate") == 0)
+            bench.numa_replicate = true;
+        else if (std::strcmp(argv[i], "--pin") == 0 && i + 1 < argc)
+        {
+            bench.pinning_name = argv[++i];
+            if (bench.pinning_name == "none")
+                bench.pinning = pin_policy::none;
+            else if (bench.pinning_name == "cores")
+                bench.pinning = pin_policy::cores;
+            else if (bench.pinning_name == "smt")
+                bench.pinning = pin_policy::smt;
+            else if (bench.pinning_name == "numa")
+                bench.pinning = pin_policy::numa;
+            else
+            {
+                std::cerr << "ERROR: --pin expects none, cores, smt or numa.\n";
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << usage;
+            return 1;
+        }
+    }
+
+    if (image_height == 0)
+        image_height = std::max(2, static_cast<int>(image_width / aspect_ratio));
+    settings.image_width = image_width;
+    settings.image_height = image_height;
+    settings.samples_per_pixel = samples_per_pixel;
+    settings.max_depth = max_depth;
+
+    if (!benchmark_path.empty())
+    {
+        if (bench.numa_replicate && bench.pinning != pin_policy::none)
+        {
+            std::cerr << "ERROR: --numa-replicate pins threads to their replica's node; it cannot be combined with --pin.\n";
+            return 1;
+        }
+        bench.scene_size = scene_size;
+        return run_render_benchmark(settings, bench, output.empty() ? "benchmark.ppm" : output, benchmark_path) ? 0 : 1;
+    }
+
+    if (!stats_path.empty() && !stats::enabled)
+    {
+        std::cerr << "ERROR: --stats needs a build with RT_ENABLE_STATS defined.\n";
+        return 1;
+    }
+
+    if (!heatmap_prefix.empty() && (!frames.empty() || coordinator_port >= 0 || !checkpoint_path.empty()))
+    {
+        std::cerr << "ERROR: --heatmap measures a plain local still; it cannot be combined with --frames, --coordinator or --checkpoint.\n";
+        return 1;
+    }
+
+    if (!reference_path.empty() && (!frames.empty() || coordinator_port >= 0 || !checkpoint_path.empty()))
+    {
+        std::cerr << "ERROR: --reference measures a plain local still; it cannot be combined with --frames, --coordinator or --checkpoint.\n";
+        return 1;
+    }
+
+    if (still_glow > 0 && (!frames.empty() || !worker_address.empty() || !scene_path.empty()))
+    {
+        std::cerr << "ERROR: --glow lights the built-in still; it cannot be combined with --frames, --worker or --scene.\n";
+        return 1;
+    }
+    still_scene_size = scene_size;
+
+    if (!obj_path.empty() && (!frames.empty() || coordinator_port >= 0 || !worker_address.empty() || !scene_path.empty()
+        || still_glow > 0))
+    {
+        std::cerr << "ERROR: --obj renders a local still; it cannot be combined with --frames, --coordinator, --worker, --scene or --glow.\n";
+        return 1;
+    }
+    if (forest_trees > 0 && (!frames.empty() || coordinator_port >= 0 || !worker_address.empty() || !scene_path.empty()
+        || !obj_path.empty() || still_glow > 0))
+    {
+        std::cerr << "ERROR: --forest renders a local still; it cannot be combined with --frames, --coordinator, --worker, --scene, --obj or --glow.\n";
+        return 1;
+    }
+    shared_ptr<triangle_mesh> obj_mesh;
+    aabb obj_box;
+    if (!obj_path.empty())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        obj_mesh = load_obj_mesh(obj_path, make_shared<lambertian>(color(0.6, 0.6, 0.6)), settings.thread_count);
+        if (!obj_mesh)
+            return 1;
+        if (!obj_mesh->bounding_box(0, 0, obj_box))
+        {
+            std::cerr << "ERROR: OBJ file '" << obj_path << "' has no faces.\n";
+            return 1;
+        }
+        std::cerr << obj_mesh->triangle_count() << " triangles loaded in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n";
+        if (obj_check_rays > 0)
+            return check_mesh_hits(*obj_mesh, obj_box, obj_check_rays) ? 0 : 1;
+    }
+
+    if (layout_report)
+    {
+        print_layout_report(scene_size);
+        return 0;
+    }
+
+    if (!export_path.empty())
+    {
+        seed_random(2022);
+        hittable_list world;
+        scene_file::camera_record view = random_still_view();
+        if (obj_mesh)
+        {
+            world = mesh_scene(obj_mesh, obj_box);
+            view = framing_view(obj_box);
+        }
+        else if (forest_trees > 0)
+        {
+            world = forest_scene(forest_trees);
+            view = framing_view(forest_bounds(forest_trees));
+        }
+        else
+            world = random_scene(0.5, scene_size / 2);
+        if (!scene_file::export_scene(export_path, world, view, export_bvh))
+            return 1;
+        std::cerr << "Wrote " << world.hit_objects.size() << " objects to " << export_path << "\n";
+        return 0;
+    }
+
+    if (!worker_address.empty())
+    {
+        const size_t colon = worker_address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "ERROR: --worker expects HOST:PORT.\n";
+            return 1;
+        }
+        const auto port = static_cast<std::uint16_t>(std::atoi(worker_address.c_str() + colon + 1));
+        // The still is the coordinator's, whatever this command line says.
+        auto coordinator_scene = [](const distributed::scene_parameters& scene) {
+            still_scene_size = std::max(2, scene.size);
+            still_glow = std::clamp(scene.glow, 0.0, 1.0);
+            still_light_selection = scene.light_selection == static_cast<std::uint8_t>(light_selection::uniform)
+                ? light_selection::uniform : light_selection::bvh;
+            return make_scene(scene.scene);
+        };
+        return distributed::run_worker(worker_address.substr(0, colon), port, coordinator_scene, settings.thread_count) ? 0 : 1;
+    }
+
+    const bool animated = !frames.empty();
+    if (!scene_path.empty() && (animated || coordinator_port >= 0))
+    {
+        std::cerr << "ERROR: --scene renders a local still; it cannot be combined with --frames or --coordinator.\n";
+        return 1;
+    }
+    if (!animated)
+        frames.push_back(0);
+    auto path_for_frame = [&](int frame) {
+        if (animated)
+            return frame_path(output.empty() ? "frame_" : output, frame);
+        return output.empty() ? std::string("output_image(0405_4_13).ppm") : output;
+    };
+
+    if (coordinator_port >= 0)
+    {
+        distributed::coordinator_settings options;
+        options.port = static_cast<std::uint16_t>(coordinator_port);
+        options.scene = { animated ? 1u : 0u, scene_size, still_glow, static_cast<std::uint8_t>(still_light_selection) };
+        if (still_glow > 0)
+        {
+            settings.sky = false;
+            options.direct_lighting = direct_lighting;
+        }
+        std::vector<std::thread> local_workers;
+        std::atomic<int> local_workers_running{ 0 };
+        options.on_listening = [&](std::uint16_t port) {
+            local_workers = spawn_local_workers(argv[0], spawn_workers, port, settings.thread_count, local_workers_running);
+        };
+        if (spawn_workers > 0)
+            options.workers_starting = [&] { return local_workers_running > 0; };
+        const bool ok = distributed::run_coordinator(frames, settings, options, path_for_frame);
+        for (auto& worker : local_workers)
+        {
+            // A worker that never connected may still be running; leave it.
+            if (ok)
+                worker.join();
+            else
+                worker.detach();
+        }
+        return ok ? 0 : 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto seconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    if (animated)
+    {
+        stats::registry::global().reset();
+        const auto start = clock::now();
+        render_sequence(frames, [] { return make_scene(1); }, settings, output.empty() ? "frame_" : output);
+        if (!stats_path.empty() && !write_stats(stats_path, seconds_since(start)))
+            return 1;
+        return 0;
+    }
+
+    std::unique_ptr<animated_scene> still;
+    if (obj_mesh)
+        still = std::make_unique<list_still>(mesh_scene(obj_mesh, obj_box), framing_view(obj_box));
+    else if (forest_trees > 0)
+    {
+        seed_random(2022);
+        still = std::make_unique<list_still>(forest_scene(forest_trees), framing_view(forest_bounds(forest_trees)));
+    }
+    else if (scene_path.empty())
+        still = make_scene(0);
+    else
+    {
+        auto loaded = std::make_unique<file_still>();
+        if (!loaded->load(scene_path))
+            return 1;
+        still = std::move(loaded);
+    }
+    if (bvh_cache::global().enabled())
+        std::cerr << bvh_cache::global().report() << "\n";
+    camera camera = still->frame_camera();
+    camera.set_image_size(image_width, image_height, samples_per_pixel);
+    if (still_glow > 0)
+    {
+        settings.sky = false;
+        settings.lights = direct_lighting ? still->lights() : nullptr;
+        const light_list* lights = still->lights();
+        std::cerr << (lights ? lights->size() : 0) << " lights, ";
+        if (!settings.lights)
+            std::cerr << "found by scattered rays only\n";
+        else if (lights->selected() == light_selection::bvh)
+            std::cerr << "sampled directly, picked through a " << lights->tree().node_count() << "-node light BVH\n";
+        else
+            std::cerr << "sampled directly, picked uniformly\n";
+    }
+
+    // Render
+    settings.show_progress = true;
+    stats::registry::global().reset();
+    const auto render_start = clock::now();
+    if (!checkpoint_path.empty())
+    {
+        render_progress progress;
+        if (!scene_path.empty() || !obj_path.empty())
+            progress.scene.file_hash = hash_scene_file(scene_path.empty() ? obj_path : scene_path);
+        else if (forest_trees > 0)
+            progress.scene.forest_trees = forest_trees;
+        else
+        {
+            progress.scene.size = scene_size;
+            progress.scene.glow = still_glow;
+        }
+        if (resume)
+        {
+            if (!load_checkpoint(checkpoint_path, settings, progress))
+                return 1;
+            std::cerr << "Resuming at " << progress.sample_counts.front() << " samples per pixel.\n";
+        }
+        else
+            progress.start(settings, 0);
+
+        if (!render_with_checkpoints(still->world(), camera, settings, progress, 4, checkpoint_path, checkpoint_interval)
+            || !write_ppm(path_for_frame(0), progress.image))
+            return 1;
+        std::remove(checkpoint_path.c_str());
+    }
+    else
+    {
+        frame_image image;
+        pixel_costs costs;
+        render_frame(still->world(), camera, settings, 0, image, heatmap_prefix.empty() ? nullptr : &costs);
+        const double render_seconds = seconds_since(render_start);
+        if (!write_ppm(path_for_frame(0), image))
+            return 1;
+        if (!reference_path.empty() && !report_noise(reference_path, image, render_seconds))
+            return 1;
+        if (!heatmap_prefix.empty() && !write_heatmaps(heatmap_prefix, costs))
+            return 1;
+    }
+
+    if (!stats_path.empty() && !write_stats(stats_path, seconds_since(render_start)))
+        return 1;
 
     std::cerr << "\nDone.\n";
     return 0;
-}
\ No newline at end of file
+}
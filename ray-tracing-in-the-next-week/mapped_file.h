@@ -0,0 +1,151 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only memory mapping of a whole file. Pages are brought in by the OS
+// on first touch, so opening a large file costs nothing up front.
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    explicit mapped_file(const std::string& path) { open(path); }
+    ~mapped_file() { close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other) noexcept { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            bytes = other.bytes;
+            byte_count = other.byte_count;
+#ifdef _WIN32
+            file_handle = other.file_handle;
+            mapping_handle = other.mapping_handle;
+            other.file_handle = INVALID_HANDLE_VALUE;
+            other.mapping_handle = nullptr;
+#endif
+            other.bytes = nullptr;
+            other.byte_count = 0;
+        }
+        return *this;
+    }
+
+    bool open(const std::string& path);
+    void close();
+
+    [[nodiscard]] bool is_open() const { return bytes != nullptr; }
+    [[nodiscard]] const unsigned char* data() const { return bytes; }
+    [[nodiscard]] std::size_t size() const { return byte_count; }
+
+private:
+    const unsigned char* bytes{ nullptr };
+    std::size_t byte_count{ 0 };
+#ifdef _WIN32
+    HANDLE file_handle{ INVALID_HANDLE_VALUE };
+    HANDLE mapping_handle{ nullptr };
+#endif
+};
+
+#ifdef _WIN32
+
+inline bool mapped_file::open(const std::string& path)
+{
+    close();
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (bytes == nullptr)
+    {
+        close();
+        return false;
+    }
+    byte_count = static_cast<std::size_t>(file_size.QuadPart);
+    return true;
+}
+
+inline void mapped_file::close()
+{
+    if (bytes != nullptr)
+        UnmapViewOfFile(bytes);
+    if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+    if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+    bytes = nullptr;
+    byte_count = 0;
+    mapping_handle = nullptr;
+    file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+inline bool mapped_file::open(const std::string& path)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* address = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+    if (address == MAP_FAILED)
+        return false;
+
+    bytes = static_cast<const unsigned char*>(address);
+    byte_count = static_cast<std::size_t>(info.st_size);
+    return true;
+}
+
+inline void mapped_file::close()
+{
+    if (bytes != nullptr)
+        munmap(const_cast<unsigned char*>(bytes), byte_count);
+    bytes = nullptr;
+    byte_count = 0;
+}
+
+#endif
+
+#endif
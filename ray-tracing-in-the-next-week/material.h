@@ -15,13 +15,68 @@ public:
 	virtual bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const = 0;
+
+    // Light given off at the hit, the same in every direction.
+    [[nodiscard]] virtual color emitted(const hit_record& rec) const { return color(0, 0, 0); }
+
+    // For sampling lights directly: the BSDF times the cosine for light
+    // arriving from `direction` (a unit vector), and the solid-angle density
+    // with which scatter() would have picked that direction. Materials whose
+    // scatter() is specular or fuzzed-specular have no usable density and
+    // return 0 from both; they are only ever lit through scatter().
+    [[nodiscard]] virtual color scattering(const ray& r_in, const hit_record& rec, const vec3& direction) const
+    {
+        return color(0, 0, 0);
+    }
+    [[nodiscard]] virtual double scattering_pdf(const hit_record& rec, const vec3& direction) const { return 0; }
 };
 
+// Ray differentials for perfectly specular reflection and transmission
+// (pbrt's SpecularReflect / SpecularTransmit), applied to an already scattered
+// ray. Fuzz added to the direction is carried over unchanged to the offset rays.
+inline void set_specular_differentials(
+    const ray& in_ray, const hit_record& rec, ray& scattered, bool is_transmission = false, double eta = 1.0)
+{
+    if (!rec.has_differentials || !in_ray.has_differentials)
+        return;
+
+    const vec3& n = rec.normal_vec_of_hit;
+    const vec3 wo = -unit_vector(in_ray.direction());
+    const vec3 wi = scattered.direction();
+    const vec3 dwodx = -unit_vector(in_ray.rx_direction) - wo;
+    const vec3 dwody = -unit_vector(in_ray.ry_direction) - wo;
+    const double dDNdx = dot(dwodx, n) + dot(wo, rec.dndx);
+    const double dDNdy = dot(dwody, n) + dot(wo, rec.dndy);
+    const double cos_o = dot(wo, n);
+
+    vec3 rx_direction, ry_direction;
+    if (!is_transmission)
+    {
+        rx_direction = wi - dwodx + 2 * (cos_o * rec.dndx + dDNdx * n);
+        ry_direction = wi - dwody + 2 * (cos_o * rec.dndy + dDNdy * n);
+    }
+    else
+    {
+        const double cos_i = fabs(dot(wi, n));
+        if (cos_i < 1e-12)
+            return;
+        const double mu = eta * cos_o - cos_i;
+        const double dmudx = (eta - (eta * eta * cos_o) / cos_i) * dDNdx;
+        const double dmudy = (eta - (eta * eta * cos_o) / cos_i) * dDNdy;
+        rx_direction = wi - eta * dwodx + mu * rec.dndx + dmudx * n;
+        ry_direction = wi - eta * dwody + mu * rec.dndy + dmudy * n;
+    }
+
+    scattered.set_differentials(
+        rec.hit_point + rec.dpdx, rx_direction,
+        rec.hit_point + rec.dpdy, ry_direction);
+}
+
 class lambertian final : public material
 {
 public:
-    lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
-    lambertian(shared_ptr<texture> a) : albedo(a) {}
+    lambertian(const color& a) : albedo(a) {}
+    lambertian(shared_ptr<texture> a) : albedo(std::move(a)) {}
 
     bool scatter ([[maybe_unused]]const ray& in_ray, const hit_record& rec, color& attenuation, ray& scattered)
 	const override
@@ -33,13 +88,25 @@ public:
             scatter_direction = rec.normal_vec_of_hit;
         }
         scattered = ray(rec.hit_point, scatter_direction, in_ray.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.hit_point);
+        attenuation = albedo.value(rec.u, rec.v, rec.hit_point, rec.uv_footprint());
         return true;
     }
 
+    // normal + random_unit_vector() is cosine-distributed about the normal.
+    [[nodiscard]] color scattering([[maybe_unused]] const ray& in_ray, const hit_record& rec, const vec3& direction) const override
+    {
+        return albedo.value(rec.u, rec.v, rec.hit_point, rec.uv_footprint()) * scattering_pdf(rec, direction);
+    }
+
+    [[nodiscard]] double scattering_pdf(const hit_record& rec, const vec3& direction) const override
+    {
+        const double cosine = dot(rec.normal_vec_of_hit, direction);
+        return cosine > 0 ? cosine / pi : 0;
+    }
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
-    shared_ptr<texture> albedo;
+    texture_program albedo; // compiled once, evaluated without virtual calls
 };
 
 class metal final : public material
@@ -52,6 +119,7 @@ public:
     {
 	    const vec3 reflected = reflect(unit_vector(in_ray.direction()), record.normal_vec_of_hit);
         scattered = ray(record.hit_point, reflected + fuzziness * random_in_unit_sphere(), in_ray.time());
+        set_specular_differentials(in_ray, record, scattered);
         attenuation = albedo;
         return (dot(scattered.direction(), record.normal_vec_of_hit) > 0);
     }
@@ -79,12 +147,14 @@ public:
         const bool cannot_refract = refraction_ratio * sin_theta > 1.0;
 
         vec3 direction;
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        const bool is_reflection = cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double();
+        if (is_reflection)
             direction = reflect(unit_direction, record.normal_vec_of_hit);
         else
             direction = refract(unit_direction, record.normal_vec_of_hit, refraction_ratio);
         
         scattered = ray(record.hit_point, direction, in_ray.time());
+        set_specular_differentials(in_ray, record, scattered, !is_reflection, refraction_ratio);
         attenuation = color(1.0, 1.0, 1.0); //glass surface absorbs nothing
         return true;
     }
@@ -103,6 +173,27 @@ private:
     }
 };
 
+// Glows with `emit` on both sides and reflects nothing.
+class diffuse_light final : public material
+{
+public:
+    explicit diffuse_light(const color& c) : emit(c) {}
+    explicit diffuse_light(shared_ptr<texture> a) : emit(std::move(a)) {}
+
+    bool scatter([[maybe_unused]] const ray& in_ray, [[maybe_unused]] const hit_record& record,
+        [[maybe_unused]] color& attenuation, [[maybe_unused]] ray& scattered) const override
+    {
+        return false;
+    }
+
+    [[nodiscard]] color emitted(const hit_record& rec) const override
+    {
+        return emit.value(rec.u, rec.v, rec.hit_point, rec.uv_footprint());
+    }
 
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    texture_program emit;
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,426 @@
+#ifndef MORTON_BVH_H
+#define MORTON_BVH_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "flat_bvh.h"
+#include "parallel.h"
+
+// Linear BVH construction (Karras 2012): primitives sorted by the Morton code
+// of their centroid, and every internal node found independently from the
+// sorted codes, which makes the whole build a handful of parallel passes.
+// Optionally followed by treelet restructuring (Karras and Aila 2013), which
+// rearranges small groups of nodes into their SAH-optimal shape.
+
+// Spreads the low 21 bits of v out to every third bit.
+inline std::uint64_t morton_spread(std::uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// Morton code of p within `bounds`, with bits / 3 bits per axis (30 or 63).
+inline std::uint64_t morton_code(const point3& p, const aabb& bounds, unsigned bits)
+{
+    const unsigned axis_bits = bits / 3;
+    const double scale = static_cast<double>((1u << axis_bits) - 1);
+    std::uint64_t code = 0;
+    for (int a = 0; a < 3; ++a)
+    {
+        const double extent = bounds.max().e[a] - bounds.min().e[a];
+        const double t = extent > 0.0 ? (p.e[a] - bounds.min().e[a]) / extent : 0.0;
+        const auto cell = static_cast<std::uint64_t>(std::clamp(t, 0.0, 1.0) * scale);
+        code |= morton_spread(cell) << (2 - a);
+    }
+    return code;
+}
+
+// Stable LSD radix sort of keys (the low key_bits bits) with their values,
+// 8 bits per pass. Each pass counts digits per block, turns the counts into
+// per-block offsets and scatters every block in parallel.
+inline void radix_sort_pairs(std::vector<std::uint64_t>& keys, std::vector<std::uint32_t>& values, unsigned key_bits,
+    unsigned thread_count)
+{
+    constexpr size_t block_size = 65536;
+    const size_t count = keys.size();
+    const size_t block_count = (count + block_size - 1) / block_size;
+    std::vector<std::uint64_t> key_buffer(count);
+    std::vector<std::uint32_t> value_buffer(count);
+    std::vector<std::array<size_t, 256>> offsets(block_count);
+
+    for (unsigned shift = 0; shift < key_bits; shift += 8)
+    {
+        parallel_for(block_count, [&](size_t b) {
+            offsets[b].fill(0);
+            for (size_t i = b * block_size; i < std::min(count, (b + 1) * block_size); ++i)
+                ++offsets[b][(keys[i] >> shift) & 0xff];
+        }, thread_count);
+
+        size_t position = 0;
+        for (unsigned digit = 0; digit < 256; ++digit)
+        {
+            for (size_t b = 0; b < block_count; ++b)
+            {
+                const size_t digit_count = offsets[b][digit];
+                offsets[b][digit] = position;
+                position += digit_count;
+            }
+        }
+
+        parallel_for(block_count, [&](size_t b) {
+            std::array<size_t, 256>& next = offsets[b];
+            for (size_t i = b * block_size; i < std::min(count, (b + 1) * block_size); ++i)
+            {
+                const size_t slot = next[(keys[i] >> shift) & 0xff]++;
+                key_buffer[slot] = keys[i];
+                value_buffer[slot] = values[i];
+            }
+        }, thread_count);
+        keys.swap(key_buffer);
+        values.swap(value_buffer);
+    }
+}
+
+inline void flat_bvh::build_morton(const std::vector<aabb>& primitive_boxes, const bvh_build_options& options)
+{
+    const unsigned thread_count = options.thread_count == 0 ? hardware_threads() : options.thread_count;
+    const auto count = static_cast<std::uint32_t>(primitive_boxes.size());
+    const std::uint32_t block_count = (count + 65535) / 65536;
+    auto for_blocks = [&](auto&& body) {
+        parallel_for(block_count, [&](size_t block) {
+            const std::uint32_t block_end = std::min(count, static_cast<std::uint32_t>(block + 1) * 65536);
+            for (auto i = static_cast<std::uint32_t>(block) * 65536; i < block_end; ++i)
+                body(i);
+        }, thread_count);
+    };
+
+    // Codes are taken within the bounds of the centroids.
+    std::vector<aabb> block_bounds(block_count, empty_box());
+    parallel_for(block_count, [&](size_t block) {
+        const std::uint32_t block_end = std::min(count, static_cast<std::uint32_t>(block + 1) * 65536);
+        for (auto i = static_cast<std::uint32_t>(block) * 65536; i < block_end; ++i)
+            grow(block_bounds[block], 0.5 * (primitive_boxes[i].min() + primitive_boxes[i].max()));
+    }, thread_count);
+    aabb centroid_bounds = empty_box();
+    for (const aabb& box : block_bounds)
+        grow(centroid_bounds, box);
+
+    const unsigned bits = options.morton_bits <= 30 ? 30 : 63;
+    std::vector<std::uint64_t> codes(count);
+    std::vector<std::uint32_t> order(count);
+    for_blocks([&](std::uint32_t i) {
+        codes[i] = morton_code(0.5 * (primitive_boxes[i].min() + primitive_boxes[i].max()), centroid_bounds, bits);
+        order[i] = i;
+    });
+    radix_sort_pairs(codes, order, bits, thread_count);
+
+    // The binary radix tree over the sorted codes: internal nodes 0 .. n-2
+    // (0 is the root), then leaf k, the k-th primitive in code order, at n-1+k.
+    // Equal codes are told apart by position, as if it were appended to the code.
+    struct tree_node
+    {
+        aabb box;
+        double cost{ 0 };          // SAH cost, unnormalized (area-weighted)
+        std::uint32_t child[2]{ 0, 0 };
+        std::uint32_t parent{ 0 };
+        std::uint32_t count{ 1 };  // primitives below
+        bool collapse{ false };    // cheaper as one leaf than as a subtree
+    };
+    const std::uint32_t internal_count = count - 1;
+    std::vector<tree_node> tree(2 * static_cast<size_t>(count) - 1);
+    auto is_leaf = [&](std::uint32_t n) { return n >= internal_count; };
+
+    auto common_prefix = [&](std::int64_t i, std::int64_t j) {
+        if (j < 0 || j >= count)
+            return -1;
+        const std::uint64_t difference = codes[i] ^ codes[j];
+        if (difference != 0)
+            return std::countl_zero(difference);
+        return 64 + std::countl_zero(static_cast<std::uint32_t>(i ^ j));
+    };
+    parallel_for((internal_count + 65535) / 65536, [&](size_t block) {
+        const std::uint32_t block_end = std::min(internal_count, static_cast<std::uint32_t>(block + 1) * 65536);
+        for (auto node = static_cast<std::uint32_t>(block) * 65536; node < block_end; ++node)
+        {
+            const std::int64_t i = node;
+            // Which end of its range node i is at, and how far the range reaches.
+            const int direction = common_prefix(i, i + 1) - common_prefix(i, i - 1) > 0 ? 1 : -1;
+            const int prefix_min = common_prefix(i, i - direction);
+            std::int64_t length_max = 2;
+            while (common_prefix(i, i + length_max * direction) > prefix_min)
+                length_max *= 2;
+            std::int64_t length = 0;
+            for (std::int64_t step = length_max / 2; step >= 1; step /= 2)
+            {
+                if (common_prefix(i, i + (length + step) * direction) > prefix_min)
+                    length += step;
+            }
+            const std::int64_t j = i + length * direction;
+
+            // The split is where the range's common prefix ends.
+            const int prefix_node = common_prefix(i, j);
+            std::int64_t split = 0;
+            for (std::int64_t divisor = 2;; divisor *= 2)
+            {
+                const std::int64_t step = (length + divisor - 1) / divisor;
+                if (common_prefix(i, i + (split + step) * direction) > prefix_node)
+                    split += step;
+                if (step <= 1)
+                    break;
+            }
+            const std::int64_t gamma = i + split * direction + std::min(direction, 0);
+
+            tree_node& n = tree[node];
+            n.child[0] = std::min(i, j) == gamma ? internal_count + static_cast<std::uint32_t>(gamma) : static_cast<std::uint32_t>(gamma);
+            n.child[1] = std::max(i, j) == gamma + 1 ? internal_count + static_cast<std::uint32_t>(gamma + 1)
+                                                     : static_cast<std::uint32_t>(gamma + 1);
+            tree[n.child[0]].parent = node;
+            tree[n.child[1]].parent = node;
+        }
+    }, thread_count);
+
+    auto update_node = [&](std::uint32_t n) {
+        tree_node& node = tree[n];
+        const tree_node& left = tree[node.child[0]];
+        const tree_node& right = tree[node.child[1]];
+        node.box = left.box;
+        grow(node.box, right.box);
+        node.count = left.count + right.count;
+        const double area = node.box.surface_area();
+        const double split_cost = options.traversal_cost * area + left.cost + right.cost;
+        const double leaf_cost = options.intersection_cost * node.count * area;
+        node.collapse = node.count <= options.max_leaf_size && leaf_cost <= split_cost;
+        node.cost = node.collapse ? leaf_cost : split_cost;
+    };
+
+    // Treelet restructuring at node n: grow a treelet of up to 7 leaves by
+    // opening its largest internal leaf, find the cheapest binary tree over
+    // those leaves by dynamic programming over leaf subsets, and rebuild the
+    // treelet's internal nodes in that shape.
+    auto restructure = [&](std::uint32_t root) {
+        constexpr int max_leaves = 7;
+        std::uint32_t leaves[max_leaves];
+        std::uint32_t internals[max_leaves - 1];
+        int leaf_count = 2, internal_count_used = 1;
+        leaves[0] = tree[root].child[0];
+        leaves[1] = tree[root].child[1];
+        internals[0] = root;
+        while (leaf_count < max_leaves)
+        {
+            int widest = -1;
+            double widest_area = -1.0;
+            for (int l = 0; l < leaf_count; ++l)
+            {
+                if (!is_leaf(leaves[l]) && !tree[leaves[l]].collapse && tree[leaves[l]].box.surface_area() > widest_area)
+                {
+                    widest = l;
+                    widest_area = tree[leaves[l]].box.surface_area();
+                }
+            }
+            if (widest < 0)
+                break;
+            const std::uint32_t opened = leaves[widest];
+            internals[internal_count_used++] = opened;
+            leaves[widest] = tree[opened].child[0];
+            leaves[leaf_count++] = tree[opened].child[1];
+        }
+        if (leaf_count < 3)
+            return;
+
+        // Every proper subset of s is numerically smaller than s, so one pass
+        // in increasing order solves parts before the sets they make up.
+        const unsigned subset_count = 1u << leaf_count;
+        aabb box[1 << max_leaves];
+        double best_cost[1 << max_leaves];
+        unsigned best_split[1 << max_leaves];
+        for (unsigned s = 1; s < subset_count; ++s)
+        {
+            const unsigned lowest = s & (~s + 1);
+            const unsigned rest = s ^ lowest;
+            if (rest == 0)
+            {
+                box[s] = tree[leaves[std::countr_zero(s)]].box;
+                best_cost[s] = tree[leaves[std::countr_zero(s)]].cost;
+                continue;
+            }
+            box[s] = box[rest];
+            grow(box[s], box[lowest]);
+
+            // Parts containing the lowest leaf; the rest is the other side.
+            double cheapest = infinity;
+            unsigned cheapest_part = 0;
+            for (unsigned part = (rest - 1) & rest;; part = (part - 1) & rest)
+            {
+                const unsigned side = part | lowest;
+                const double cost = best_cost[side] + best_cost[s ^ side];
+                if (cost < cheapest)
+                {
+                    cheapest = cost;
+                    cheapest_part = side;
+                }
+                if (part == 0)
+                    break;
+            }
+            best_cost[s] = options.traversal_cost * box[s].surface_area() + cheapest;
+            best_split[s] = cheapest_part;
+        }
+
+        // Rebuild top-down, reusing the treelet's internal nodes (root first).
+        int next_internal = 0;
+        auto assign = [&](auto&& self, unsigned s) -> std::uint32_t {
+            if (std::popcount(s) == 1)
+                return leaves[std::countr_zero(s)];
+            const std::uint32_t n = internals[next_internal++];
+            const std::uint32_t left = self(self, best_split[s]);
+            const std::uint32_t right = self(self, s ^ best_split[s]);
+            tree[n].child[0] = left;
+            tree[n].child[1] = right;
+            tree[left].parent = n;
+            tree[right].parent = n;
+            update_node(n);
+            return n;
+        };
+        const std::uint32_t root_parent = tree[root].parent;
+        assign(assign, subset_count - 1);
+        tree[root].parent = root_parent;
+    };
+
+    // Bottom-up passes: each leaf climbs towards the root, and the second of
+    // a node's two children to arrive finishes the node, so a node is only
+    // handled once both subtrees are final.
+    if (count > 1)
+    {
+        const std::unique_ptr<std::atomic<std::uint32_t>[]> arrivals(new std::atomic<std::uint32_t>[internal_count]);
+        const bool treelets = options.builder == bvh_builder::morton_treelets;
+        for_blocks([&](std::uint32_t k) {
+            tree_node& leaf = tree[internal_count + k];
+            leaf.box = primitive_boxes[order[k]];
+            leaf.cost = options.intersection_cost * leaf.box.surface_area();
+        });
+
+        const int passes = treelets ? 3 : 1;
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            // Later passes only revisit bigger subtrees, as in the paper.
+            const std::uint32_t treelet_min_count = 7u << pass;
+            for (std::uint32_t n = 0; n < internal_count; ++n)
+                arrivals[n].store(0, std::memory_order_relaxed);
+            for_blocks([&](std::uint32_t k) {
+                std::uint32_t n = internal_count + k;
+                while (n != 0)
+                {
+                    const std::uint32_t parent = tree[n].parent;
+                    if (arrivals[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+                        return;
+                    update_node(parent);
+                    if (treelets && tree[parent].count >= treelet_min_count)
+                        restructure(parent);
+                    n = parent;
+                }
+            });
+        }
+    }
+    else
+    {
+        tree[0].box = primitive_boxes[0];
+    }
+
+    // Depth-first emission into the flat layout; a collapsed subtree becomes
+    // one leaf holding all of its primitives.
+    nodes.reserve(2 * static_cast<size_t>(count) / std::max(1u, options.max_leaf_size) + 1);
+    primitive_indices.clear();
+    primitive_indices.reserve(count);
+    std::vector<std::uint32_t> stack;
+    auto gather = [&](std::uint32_t n) {
+        stack.assign(1, n);
+        while (!stack.empty())
+        {
+            const std::uint32_t m = stack.back();
+            stack.pop_back();
+            if (is_leaf(m))
+                primitive_indices.push_back(order[m - internal_count]);
+            else
+            {
+                stack.push_back(tree[m].child[1]);
+                stack.push_back(tree[m].child[0]);
+            }
+        }
+    };
+    // A radix tree can be lopsided enough to run past max_depth with more
+    // primitives below than a leaf holds; such a subtree is gathered and
+    // re-emitted balanced, halving its run of primitive_indices.
+    auto emit_balanced = [&](auto&& self, std::uint32_t first, std::uint32_t count, int depth) -> void {
+        const auto node_index = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+        aabb box = empty_box();
+        for (std::uint32_t i = first; i < first + count; ++i)
+            grow(box, primitive_boxes[primitive_indices[i]]);
+        nodes[node_index].box = box;
+        if (count <= 0xffff)
+        {
+            nodes[node_index].offset = first;
+            nodes[node_index].count = static_cast<std::uint16_t>(count);
+            return;
+        }
+        const vec3 extent = box.max() - box.min();
+        nodes[node_index].axis = static_cast<std::uint8_t>(
+            extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2));
+        self(self, first, count / 2, depth + 1);
+        nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+        self(self, first + count / 2, count - count / 2, depth + 1);
+    };
+    auto emit = [&](auto&& self, std::uint32_t n, int depth) -> void {
+        const tree_node& node = tree[n];
+        const int depth_left = max_depth - 2 - depth;
+        const int halvings = halvings_to_leaf(node.count);
+        if (!is_leaf(n) && !node.collapse && halvings > 0 && halvings >= depth_left)
+        {
+            const auto first = static_cast<std::uint32_t>(primitive_indices.size());
+            gather(n);
+            emit_balanced(emit_balanced, first, node.count, depth);
+            return;
+        }
+
+        const auto node_index = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes[node_index].box = node.box;
+        if (is_leaf(n) || node.collapse || depth_left <= 0)
+        {
+            nodes[node_index].offset = static_cast<std::uint32_t>(primitive_indices.size());
+            nodes[node_index].count = static_cast<std::uint16_t>(node.count);
+            gather(n);
+            return;
+        }
+
+        // Visit order follows the axis along which the children lie apart.
+        const vec3 apart = (tree[node.child[1]].box.min() + tree[node.child[1]].box.max())
+                         - (tree[node.child[0]].box.min() + tree[node.child[0]].box.max());
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+        {
+            if (std::fabs(apart.e[a]) > std::fabs(apart.e[axis]))
+                axis = a;
+        }
+        nodes[node_index].axis = static_cast<std::uint8_t>(axis);
+        const bool swap = apart.e[axis] < 0.0;
+        self(self, node.child[swap ? 1 : 0], depth + 1);
+        nodes[node_index].offset = static_cast<std::uint32_t>(nodes.size());
+        self(self, node.child[swap ? 0 : 1], depth + 1);
+    };
+    emit(emit, 0, 0);
+    nodes.shrink_to_fit();
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define MOVING_SPHERE_H
 
 #include "hittable.h"
+#include "render_stats.h"
 
 
 class moving_sphere final : public hittable
@@ -23,6 +24,9 @@ public:
     [[nodiscard]] bool bounding_box(
         double _time0, double _time1, aabb& output_box
     ) const override;
+
+    // The normal differentials of a hit left pending by hit().
+    static void finish_shading(const ray& r, hit_record& rec);
 	
 
 // ReSharper disable once CppRedundantAccessSpecifier
@@ -40,6 +44,7 @@ inline point3 moving_sphere::center(double time) const
 
 inline bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 {
+    RT_COUNT(primitive_tests);
     vec3 oc = r.origin() - center(r.time());
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -62,11 +67,32 @@ inline bool moving_sphere::hit(const ray& r, double t_min, double t_max, hit_rec
     rec.hit_point = r.at(rec.t_of_ray);
     auto outward_normal = (rec.hit_point - center(r.time())) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.hit_material = mat_ptr;
+    rec.hit_material = mat_ptr.get();
+    rec.hit_object = this;
+
+    rec.has_differentials = false;
+    if (r.has_differentials)
+    {
+        rec.shape_center = center(r.time());
+        rec.shape_radius = radius;
+        rec.pending_shading = &finish_shading;
+    }
+    else
+        rec.pending_shading = nullptr;
 
     return true;
 }
 
+inline void moving_sphere::finish_shading(const ray& r, hit_record& rec)
+{
+    if (rec.set_differentials(r))
+    {
+        const double side = rec.is_front_face ? 1.0 : -1.0;
+        rec.dndx = side * rec.dpdx / rec.shape_radius;
+        rec.dndy = side * rec.dpdy / rec.shape_radius;
+    }
+}
+
 inline bool moving_sphere::bounding_box(double _time0, double _time1, aabb& output_box) const
 {
     aabb box0(
@@ -0,0 +1,227 @@
+#ifndef NET_SOCKET_H
+#define NET_SOCKET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// A blocking TCP socket, just enough for the coordinator and its workers:
+// listen/accept on one side, connect on the other, and whole-buffer sends
+// and receives. Move-only; closes on destruction.
+class net_socket
+{
+public:
+#ifdef _WIN32
+    using native_handle = SOCKET;
+    static constexpr native_handle invalid_handle = INVALID_SOCKET;
+#else
+    using native_handle = int;
+    static constexpr native_handle invalid_handle = -1;
+#endif
+
+    net_socket() = default;
+    ~net_socket() { close(); }
+
+    net_socket(const net_socket&) = delete;
+    net_socket& operator=(const net_socket&) = delete;
+
+    net_socket(net_socket&& other) noexcept : handle(other.handle) { other.handle = invalid_handle; }
+    net_socket& operator=(net_socket&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            handle = other.handle;
+            other.handle = invalid_handle;
+        }
+        return *this;
+    }
+
+    // Listens on all interfaces; port 0 picks a free port (see local_port()).
+    static net_socket listen_on(std::uint16_t port);
+    static net_socket connect_to(const std::string& host, std::uint16_t port);
+
+    // Waits up to timeout_ms for a connection; returns a closed socket on timeout.
+    [[nodiscard]] net_socket accept(int timeout_ms) const;
+
+    bool send_all(const void* data, std::size_t size) const;
+    bool receive_all(void* data, std::size_t size) const;
+
+    template <typename T>
+    bool send_value(const T& value) const { return send_all(&value, sizeof value); }
+    template <typename T>
+    bool receive_value(T& value) const { return receive_all(&value, sizeof value); }
+
+    [[nodiscard]] std::uint16_t local_port() const;
+    [[nodiscard]] bool is_open() const { return handle != invalid_handle; }
+    void close();
+
+private:
+    explicit net_socket(native_handle h) : handle(h) {}
+
+    static bool startup()
+    {
+#ifdef _WIN32
+        static const bool started = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+#else
+        return true;
+#endif
+    }
+
+    native_handle handle{ invalid_handle };
+};
+
+inline net_socket net_socket::listen_on(std::uint16_t port)
+{
+    if (!startup())
+        return {};
+    net_socket s(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (!s.is_open())
+        return {};
+
+    const int reuse = 1;
+    setsockopt(s.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof reuse);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(s.handle, reinterpret_cast<const sockaddr*>(&address), sizeof address) != 0
+        || ::listen(s.handle, SOMAXCONN) != 0)
+        return {};
+    return s;
+}
+
+inline net_socket net_socket::connect_to(const std::string& host, std::uint16_t port)
+{
+    if (!startup())
+        return {};
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0)
+        return {};
+
+    net_socket s;
+    for (const addrinfo* a = results; a != nullptr && !s.is_open(); a = a->ai_next)
+    {
+        net_socket candidate(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+        if (candidate.is_open() && ::connect(candidate.handle, a->ai_addr, static_cast<int>(a->ai_addrlen)) == 0)
+            s = std::move(candidate);
+    }
+    freeaddrinfo(results);
+
+    if (s.is_open())
+    {
+        // Tiles are sent as one request and one reply; don't hold them back.
+        const int no_delay = 1;
+        setsockopt(s.handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof no_delay);
+    }
+    return s;
+}
+
+inline net_socket net_socket::accept(int timeout_ms) const
+{
+#ifdef _WIN32
+    WSAPOLLFD descriptor{ handle, POLLIN, 0 };
+    if (WSAPoll(&descriptor, 1, timeout_ms) <= 0)
+        return {};
+#else
+    pollfd descriptor{ handle, POLLIN, 0 };
+    if (::poll(&descriptor, 1, timeout_ms) <= 0)
+        return {};
+#endif
+    net_socket s(::accept(handle, nullptr, nullptr));
+    if (s.is_open())
+    {
+        const int no_delay = 1;
+        setsockopt(s.handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof no_delay);
+    }
+    return s;
+}
+
+inline bool net_socket::send_all(const void* data, std::size_t size) const
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+#ifdef _WIN32
+        const int sent = ::send(handle, bytes, static_cast<int>(std::min<std::size_t>(size, 1 << 30)), 0);
+#else
+        const auto sent = ::send(handle, bytes, size, MSG_NOSIGNAL);
+#endif
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+inline bool net_socket::receive_all(void* data, std::size_t size) const
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+#ifdef _WIN32
+        const int received = ::recv(handle, bytes, static_cast<int>(std::min<std::size_t>(size, 1 << 30)), 0);
+#else
+        const auto received = ::recv(handle, bytes, size, 0);
+#endif
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+inline std::uint16_t net_socket::local_port() const
+{
+    sockaddr_in address{};
+#ifdef _WIN32
+    int length = sizeof address;
+#else
+    socklen_t length = sizeof address;
+#endif
+    if (getsockname(handle, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+        return 0;
+    return ntohs(address.sin_port);
+}
+
+inline void net_socket::close()
+{
+    if (handle == invalid_handle)
+        return;
+#ifdef _WIN32
+    closesocket(handle);
+#else
+    ::close(handle);
+#endif
+    handle = invalid_handle;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef NUMA_REPLICAS_H
+#define NUMA_REPLICAS_H
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cpu_topology.h"
+#include "hittable.h"
+
+// One copy of a read-only scene (objects, materials, textures and BVH) per
+// NUMA node, so no thread traverses memory on the other socket. Each copy is
+// made by a thread pinned to its node; the OS places pages on the node of the
+// thread that first touches them (Linux's default local policy, and Windows'
+// default), and threads started from there inherit the pinning, so a
+// parallel BVH build stays on the node too.
+//
+// Worker threads call enter() as they start (from a parallel_hooks
+// on_start): it pins them round-robin to a node and routes their hit() calls
+// to that node's copy. Threads that never entered use the first copy. Costs
+// one extra virtual call per ray.
+class numa_replicated_world final : public hittable
+{
+public:
+    // make() builds one complete, independent copy of the scene; it must
+    // produce the same scene every time it is called.
+    numa_replicated_world(const cpu_topology& topology, const std::function<std::shared_ptr<const hittable>()>& make)
+    {
+        std::vector<std::vector<unsigned>> by_node(static_cast<size_t>(topology.node_count()));
+        for (const logical_cpu& cpu : topology.cpus())
+            by_node[static_cast<size_t>(cpu.node)].push_back(cpu.id);
+        for (auto& cpus : by_node)
+        {
+            if (!cpus.empty()) // memory-only nodes run no threads
+                node_cpus.push_back(std::move(cpus));
+        }
+
+        replicas.resize(std::max<size_t>(node_cpus.size(), 1));
+        for (size_t node = 0; node < replicas.size(); ++node)
+        {
+            std::thread builder([&, node] {
+                if (node < node_cpus.size())
+                    pin_current_thread(node_cpus[node]);
+                replicas[node] = make();
+            });
+            builder.join();
+        }
+    }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+    {
+        return replicas[local_replica()]->hit(r, t_min, t_max, rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override
+    {
+        return replicas[local_replica()]->occluded(r, t_min, t_max);
+    }
+
+    bool bounding_box(double time0, double time1, aabb& output_box) const override
+    {
+        return replicas.front()->bounding_box(time0, time1, output_box);
+    }
+
+    // Pins the calling thread, the `worker`th of a parallel_for, to node
+    // worker % replica_count() and routes it to that node's copy.
+    void enter(unsigned worker) const
+    {
+        const size_t node = worker % replicas.size();
+        if (node < node_cpus.size())
+            pin_current_thread(node_cpus[node]);
+        local_replica() = node;
+    }
+
+    [[nodiscard]] size_t replica_count() const { return replicas.size(); }
+
+private:
+    static size_t& local_replica()
+    {
+        thread_local size_t replica = 0;
+        return replica;
+    }
+
+    std::vector<std::vector<unsigned>> node_cpus;
+    std::vector<std::shared_ptr<const hittable>> replicas;
+};
+
+#endif
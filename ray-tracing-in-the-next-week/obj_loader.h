@@ -0,0 +1,188 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "parallel.h"
+#include "triangle_mesh.h"
+
+// Wavefront OBJ loader for large meshes. The file is memory-mapped and cut
+// into chunks at line boundaries; each thread parses its chunk into local
+// vertex and face arrays, then chunk vertex counts are prefix-summed to
+// resolve relative (negative) indices and the chunks are concatenated.
+// Only "v" and "f" records are used; polygons are fan-triangulated and the
+// texture/normal parts of "f v/vt/vn" are skipped.
+namespace obj_detail {
+
+struct chunk_result
+{
+    std::vector<mesh_vertex> vertices;
+    // Raw OBJ position indices (1-based, or negative = relative), and the
+    // number of vertices this chunk had seen when each index was read.
+    std::vector<std::int64_t> raw_indices;
+    std::vector<std::uint32_t> seen_vertices;
+    bool ok{ true };
+};
+
+inline const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    return p;
+}
+
+inline const char* next_line(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        ++p;
+    return p < end ? p + 1 : end;
+}
+
+inline void parse_chunk(const char* p, const char* end, chunk_result& out)
+{
+    std::vector<std::int64_t> polygon;
+    while (p < end)
+    {
+        const char* line_end = p;
+        while (line_end < end && *line_end != '\n' && *line_end != '\r')
+            ++line_end;
+
+        if (line_end - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            float xyz[3] = { 0, 0, 0 };
+            const char* q = p + 2;
+            for (float& coordinate : xyz)
+            {
+                q = skip_spaces(q, line_end);
+                const auto result = std::from_chars(q, line_end, coordinate);
+                if (result.ec != std::errc())
+                {
+                    out.ok = false;
+                    break;
+                }
+                q = result.ptr;
+            }
+            out.vertices.push_back({ xyz[0], xyz[1], xyz[2] });
+        }
+        else if (line_end - p > 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            polygon.clear();
+            const char* q = skip_spaces(p + 2, line_end);
+            while (q < line_end)
+            {
+                std::int64_t index = 0;
+                const auto result = std::from_chars(q, line_end, index);
+                if (result.ec != std::errc() || index == 0)
+                {
+                    out.ok = false;
+                    break;
+                }
+                polygon.push_back(index);
+                q = result.ptr;
+                while (q < line_end && *q != ' ' && *q != '\t') // skip "/vt/vn"
+                    ++q;
+                q = skip_spaces(q, line_end);
+            }
+
+            const auto seen = static_cast<std::uint32_t>(out.vertices.size());
+            for (size_t i = 1; i + 1 < polygon.size(); ++i)
+            {
+                for (const std::int64_t corner : { polygon[0], polygon[i], polygon[i + 1] })
+                {
+                    out.raw_indices.push_back(corner);
+                    out.seen_vertices.push_back(seen);
+                }
+            }
+        }
+        p = next_line(line_end, end);
+    }
+}
+
+} // namespace obj_detail
+
+inline bool load_obj(const std::string& path, std::vector<mesh_vertex>& vertices,
+    std::vector<std::uint32_t>& indices, unsigned thread_count = 0)
+{
+    mapped_file file;
+    if (!file.open(path))
+    {
+        std::cerr << "ERROR: Could not open OBJ file '" << path << "'.\n";
+        return false;
+    }
+
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+
+    // Chunks of at least 1 MiB, a few per thread for load balance.
+    if (thread_count == 0)
+        thread_count = hardware_threads();
+    const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(4 * thread_count, file.size() >> 20));
+    std::vector<const char*> bounds(chunk_count + 1, end);
+    bounds[0] = begin;
+    for (size_t c = 1; c < chunk_count; ++c)
+    {
+        const char* cut = begin + file.size() * c / chunk_count;
+        bounds[c] = cut <= bounds[c - 1] ? bounds[c - 1] : obj_detail::next_line(cut, end);
+    }
+
+    std::vector<obj_detail::chunk_result> chunks(chunk_count);
+    parallel_for(chunk_count, [&](size_t c) {
+        obj_detail::parse_chunk(bounds[c], bounds[c + 1], chunks[c]);
+    }, thread_count);
+
+    std::vector<size_t> vertex_offsets(chunk_count + 1, 0), index_offsets(chunk_count + 1, 0);
+    for (size_t c = 0; c < chunk_count; ++c)
+    {
+        if (!chunks[c].ok)
+        {
+            std::cerr << "ERROR: Malformed record in OBJ file '" << path << "'.\n";
+            return false;
+        }
+        vertex_offsets[c + 1] = vertex_offsets[c] + chunks[c].vertices.size();
+        index_offsets[c + 1] = index_offsets[c] + chunks[c].raw_indices.size();
+    }
+
+    vertices.resize(vertex_offsets[chunk_count]);
+    indices.resize(index_offsets[chunk_count]);
+    const auto total_vertices = static_cast<std::int64_t>(vertices.size());
+    std::atomic<bool> indices_valid{ true };
+    parallel_for(chunk_count, [&](size_t c) {
+        const auto& chunk = chunks[c];
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), vertices.begin() + vertex_offsets[c]);
+        for (size_t i = 0; i < chunk.raw_indices.size(); ++i)
+        {
+            const std::int64_t raw = chunk.raw_indices[i];
+            const std::int64_t resolved = raw > 0
+                ? raw - 1
+                : static_cast<std::int64_t>(vertex_offsets[c]) + chunk.seen_vertices[i] + raw;
+            if (resolved < 0 || resolved >= total_vertices)
+                indices_valid = false;
+            indices[index_offsets[c] + i] = static_cast<std::uint32_t>(resolved);
+        }
+    }, thread_count);
+
+    if (!indices_valid)
+    {
+        std::cerr << "ERROR: Face index out of range in OBJ file '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+inline shared_ptr<triangle_mesh> load_obj_mesh(const std::string& path, shared_ptr<material> m, unsigned thread_count = 0)
+{
+    std::vector<mesh_vertex> vertices;
+    std::vector<std::uint32_t> indices;
+    if (!load_obj(path, vertices, indices, thread_count))
+        return nullptr;
+    return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), std::move(m));
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+inline unsigned hardware_threads()
+{
+    const unsigned count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+// Instrumentation for benchmarks. While set, every parallel_for calls
+// on_start(worker) on each of its threads before their first task (worker 0
+// is the calling thread) and leaves in busy_seconds[worker] how long that
+// thread spent inside tasks. Set and read only while no parallel_for runs.
+struct parallel_hooks
+{
+    std::function<void(unsigned worker)> on_start;
+    std::vector<double> busy_seconds;
+};
+
+inline parallel_hooks*& active_parallel_hooks()
+{
+    static parallel_hooks* hooks = nullptr;
+    return hooks;
+}
+
+// Runs body(i) for every i in [0, task_count) on up to thread_count threads
+// (0 = one per hardware thread). Threads pull indices from a shared counter,
+// so uneven tasks still balance. The calling thread takes part.
+template <typename Body>
+void parallel_for(std::size_t task_count, Body&& body, unsigned thread_count = 0)
+{
+    if (thread_count == 0)
+        thread_count = hardware_threads();
+    thread_count = static_cast<unsigned>(std::min<std::size_t>(thread_count, task_count));
+
+    parallel_hooks* const hooks = active_parallel_hooks();
+    if (thread_count <= 1 && !hooks)
+    {
+        for (std::size_t i = 0; i < task_count; ++i)
+            body(i);
+        return;
+    }
+
+    thread_count = std::max(thread_count, 1u);
+    if (hooks)
+        hooks->busy_seconds.assign(thread_count, 0.0);
+
+    std::atomic<std::size_t> next{ 0 };
+    auto worker = [&](unsigned index) {
+        if (!hooks)
+        {
+            for (std::size_t i = next++; i < task_count; i = next++)
+                body(i);
+            return;
+        }
+        if (hooks->on_start)
+            hooks->on_start(index);
+        std::chrono::steady_clock::duration busy{};
+        for (std::size_t i = next++; i < task_count; i = next++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            body(i);
+            busy += std::chrono::steady_clock::now() - start;
+        }
+        hooks->busy_seconds[index] = std::chrono::duration<double>(busy).count();
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (unsigned t = 1; t < thread_count; ++t)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Runs first() on a new thread and second() on this one, and returns once
+// both are done. Meant for the top few levels of a fork-join recursion.
+template <typename First, typename Second>
+void fork_join(First&& first, Second&& second)
+{
+    std::thread helper(std::forward<First>(first));
+    second();
+    helper.join();
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef PERLIN_H
+#define PERLIN_H
+
+#include <cmath>
+#include <cstdint>
+
+#include "rtweekend.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_PERLIN_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Gradient noise with all tables precomputed at construction:
+//  - one permutation doubled to 512 entries, so the corner hash is
+//    perm[perm[perm[i] + j] + k] with no masking or per-axis tables;
+//  - 256 random unit gradients stored as 16-byte float4 rows, so a whole
+//    gradient table is 4 KiB and stays in L1 next to the 512-byte permutation.
+class perlin
+{
+public:
+    static constexpr int point_count = 256;
+
+    perlin()
+    {
+        for (int i = 0; i < point_count; ++i)
+        {
+            const vec3 g = unit_vector(vec3::random(-1, 1));
+            gradients[i][0] = static_cast<float>(g.x());
+            gradients[i][1] = static_cast<float>(g.y());
+            gradients[i][2] = static_cast<float>(g.z());
+            gradients[i][3] = 0.0f;
+            perm[i] = static_cast<std::uint8_t>(i);
+        }
+        for (int i = point_count - 1; i > 0; --i)
+        {
+            const int target = random_int(0, i);
+            const std::uint8_t tmp = perm[i];
+            perm[i] = perm[target];
+            perm[target] = tmp;
+        }
+        for (int i = 0; i < point_count; ++i)
+            perm[point_count + i] = perm[i];
+    }
+
+    [[nodiscard]] double noise(const point3& p) const
+    {
+        return noise_lane(p.x(), p.y(), p.z());
+    }
+
+    // The book's turbulence: the sum of `depth` octaves of noise, each at twice
+    // the frequency and half the weight of the last, made positive. The
+    // octaves are independent, so they go through noise_batch<8> side by side;
+    // doubling is exact, so lane i holds the same point the book's loop
+    // reaches after i doublings, and the sum is taken in the same order.
+    [[nodiscard]] double turb(const point3& p, int depth = 7) const
+    {
+        constexpr int lanes = 8;
+        double px[lanes], py[lanes], pz[lanes], octave[lanes];
+        double accum = 0.0, weight = 1.0;
+        double scale = 1.0;
+        for (int first = 0; first < depth; first += lanes)
+        {
+            for (int l = 0; l < lanes; ++l)
+            {
+                px[l] = scale * p.x();
+                py[l] = scale * p.y();
+                pz[l] = scale * p.z();
+                scale *= 2;
+            }
+            noise_batch<lanes>(px, py, pz, 1, octave);
+            for (int l = 0; l < lanes && first + l < depth; ++l)
+            {
+                accum += weight * octave[l];
+                weight *= 0.5;
+            }
+        }
+        return std::fabs(accum);
+    }
+
+    // Noise for N points at once. Coordinates are read from x[l*stride],
+    // y[l*stride], z[l*stride], so both point3 arrays (stride 3) and separate
+    // coordinate arrays (stride 1) work. With SSE2, pairs of lanes share one
+    // set of double registers for the fraction, gradient and blend arithmetic;
+    // only the permutation lookups stay scalar. Every lane gives exactly what
+    // noise() gives for its point.
+    template <int N>
+    void noise_batch(const double* x, const double* y, const double* z, int stride, double* out) const
+    {
+        int l = 0;
+#ifdef RT_PERLIN_SSE
+        for (; l + 2 <= N; l += 2)
+        {
+            noise_pair(_mm_set_pd(x[(l + 1) * stride], x[l * stride]), _mm_set_pd(y[(l + 1) * stride], y[l * stride]),
+                _mm_set_pd(z[(l + 1) * stride], z[l * stride]), out + l);
+        }
+#endif
+        for (; l < N; ++l)
+            out[l] = noise_lane(x[l * stride], y[l * stride], z[l * stride]);
+    }
+
+    // turb() for N points: the octaves one after another, each for all lanes.
+    template <int N>
+    void turb_batch(const double* x, const double* y, const double* z, int stride, double* out, int depth = 7) const
+    {
+        if constexpr (N == 1)
+        {
+            out[0] = turb(point3(x[0], y[0], z[0]), depth);
+        }
+        else
+        {
+            double px[N], py[N], pz[N], accum[N], octave[N];
+            for (int l = 0; l < N; ++l)
+            {
+                px[l] = x[l * stride];
+                py[l] = y[l * stride];
+                pz[l] = z[l * stride];
+                accum[l] = 0.0;
+            }
+
+            double weight = 1.0;
+            for (int i = 0; i < depth; ++i)
+            {
+                noise_batch<N>(px, py, pz, 1, octave);
+                for (int l = 0; l < N; ++l)
+                {
+                    accum[l] += weight * octave[l];
+                    px[l] *= 2;
+                    py[l] *= 2;
+                    pz[l] *= 2;
+                }
+                weight *= 0.5;
+            }
+
+            for (int l = 0; l < N; ++l)
+                out[l] = std::fabs(accum[l]);
+        }
+    }
+
+private:
+    // The eight corner hashes of the lattice cell at (ix, iy, iz), corner c
+    // being (c >> 2 & 1, c >> 1 & 1, c & 1) away from it.
+    void corner_hashes(int ix, int iy, int iz, int hash[8]) const
+    {
+        const int a = perm[ix] + iy;
+        const int b = perm[ix + 1] + iy;
+        hash[0] = perm[perm[a] + iz];
+        hash[1] = perm[perm[a] + iz + 1];
+        hash[2] = perm[perm[a + 1] + iz];
+        hash[3] = perm[perm[a + 1] + iz + 1];
+        hash[4] = perm[perm[b] + iz];
+        hash[5] = perm[perm[b] + iz + 1];
+        hash[6] = perm[perm[b + 1] + iz];
+        hash[7] = perm[perm[b + 1] + iz + 1];
+    }
+
+    [[nodiscard]] double noise_lane(double px, double py, double pz) const
+    {
+        const double flx = std::floor(px), fly = std::floor(py), flz = std::floor(pz);
+        const double fx = px - flx, fy = py - fly, fz = pz - flz;
+        int hash[8];
+        corner_hashes(static_cast<int>(flx) & 255, static_cast<int>(fly) & 255, static_cast<int>(flz) & 255, hash);
+
+        // Dot products of the eight corner gradients with the offset vectors.
+        double d[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            const float* g = gradients[hash[c]];
+            d[c] = g[0] * (fx - ((c >> 2) & 1)) + g[1] * (fy - ((c >> 1) & 1)) + g[2] * (fz - (c & 1));
+        }
+
+        // Hermitian smoothing, then trilinear blend of the corner values.
+        const double u = fx * fx * (3 - 2 * fx);
+        const double v = fy * fy * (3 - 2 * fy);
+        const double w = fz * fz * (3 - 2 * fz);
+        const double x00 = d[0] + u * (d[4] - d[0]);
+        const double x01 = d[1] + u * (d[5] - d[1]);
+        const double x10 = d[2] + u * (d[6] - d[2]);
+        const double x11 = d[3] + u * (d[7] - d[3]);
+        const double y0 = x00 + v * (x10 - x00);
+        const double y1 = x01 + v * (x11 - x01);
+        return y0 + w * (y1 - y0);
+    }
+
+#ifdef RT_PERLIN_SSE
+    // floor() of both lanes, for values in int range (the only ones noise
+    // can index with): truncate, then step down where that rounded up.
+    static __m128d floor_pd(__m128d x)
+    {
+        const __m128d truncated = _mm_cvtepi32_pd(_mm_cvttpd_epi32(x));
+        return _mm_sub_pd(truncated, _mm_and_pd(_mm_cmpgt_pd(truncated, x), _mm_set1_pd(1.0)));
+    }
+
+    // noise_lane() for two points, operation for operation, so the results match.
+    void noise_pair(__m128d px, __m128d py, __m128d pz, double* out) const
+    {
+        const __m128d flx = floor_pd(px), fly = floor_pd(py), flz = floor_pd(pz);
+        const __m128d fx = _mm_sub_pd(px, flx), fy = _mm_sub_pd(py, fly), fz = _mm_sub_pd(pz, flz);
+
+        alignas(16) std::int32_t ix[4], iy[4], iz[4];
+        const __m128i mask = _mm_set1_epi32(255);
+        _mm_store_si128(reinterpret_cast<__m128i*>(ix), _mm_and_si128(_mm_cvttpd_epi32(flx), mask));
+        _mm_store_si128(reinterpret_cast<__m128i*>(iy), _mm_and_si128(_mm_cvttpd_epi32(fly), mask));
+        _mm_store_si128(reinterpret_cast<__m128i*>(iz), _mm_and_si128(_mm_cvttpd_epi32(flz), mask));
+        int hash0[8], hash1[8];
+        corner_hashes(ix[0], iy[0], iz[0], hash0);
+        corner_hashes(ix[1], iy[1], iz[1], hash1);
+
+        const __m128d one = _mm_set1_pd(1.0);
+        const __m128d fx1 = _mm_sub_pd(fx, one), fy1 = _mm_sub_pd(fy, one), fz1 = _mm_sub_pd(fz, one);
+        __m128d d[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            // Both lanes' gradient rows, widened to double and transposed to x, y, z.
+            const __m128 row0 = _mm_load_ps(gradients[hash0[c]]);
+            const __m128 row1 = _mm_load_ps(gradients[hash1[c]]);
+            const __m128d xy0 = _mm_cvtps_pd(row0), xy1 = _mm_cvtps_pd(row1);
+            const __m128d z0 = _mm_cvtps_pd(_mm_movehl_ps(row0, row0)), z1 = _mm_cvtps_pd(_mm_movehl_ps(row1, row1));
+            const __m128d gx = _mm_unpacklo_pd(xy0, xy1), gy = _mm_unpackhi_pd(xy0, xy1), gz = _mm_unpacklo_pd(z0, z1);
+            d[c] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(gx, (c & 4) ? fx1 : fx), _mm_mul_pd(gy, (c & 2) ? fy1 : fy)),
+                _mm_mul_pd(gz, (c & 1) ? fz1 : fz));
+        }
+
+        const __m128d three = _mm_set1_pd(3.0), two = _mm_set1_pd(2.0);
+        const __m128d u = _mm_mul_pd(_mm_mul_pd(fx, fx), _mm_sub_pd(three, _mm_mul_pd(two, fx)));
+        const __m128d v = _mm_mul_pd(_mm_mul_pd(fy, fy), _mm_sub_pd(three, _mm_mul_pd(two, fy)));
+        const __m128d w = _mm_mul_pd(_mm_mul_pd(fz, fz), _mm_sub_pd(three, _mm_mul_pd(two, fz)));
+        auto lerp = [](__m128d a, __m128d b, __m128d t) { return _mm_add_pd(a, _mm_mul_pd(t, _mm_sub_pd(b, a))); };
+        const __m128d x00 = lerp(d[0], d[4], u);
+        const __m128d x01 = lerp(d[1], d[5], u);
+        const __m128d x10 = lerp(d[2], d[6], u);
+        const __m128d x11 = lerp(d[3], d[7], u);
+        _mm_storeu_pd(out, lerp(lerp(x00, x10, v), lerp(x01, x11, v), w));
+    }
+#endif
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    // Public so scene files can store and restore the tables.
+    alignas(64) float gradients[point_count][4];
+    alignas(64) std::uint8_t perm[2 * point_count];
+};
+
+#endif
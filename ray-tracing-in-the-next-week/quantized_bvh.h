@@ -0,0 +1,462 @@
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "flat_bvh.h"
+
+// A compact copy of a flat_bvh for traversal only. Each node holds the boxes
+// of both its children as 8- or 16-bit grid coordinates inside the node's own
+// box, instead of a node per box with six doubles: 24 or 36 bytes per pair of
+// children against 112 in the flat_bvh (with motion, 36 or 60 against 208). Leaves keep their
+// ranges of the source tree's primitive_indices, so owners test leaves the
+// same way for either tree.
+//
+// Boxes are rounded outwards: every quantized box contains the exact one, so
+// the tree finds the same hits and only visits a few more nodes. A child's grid
+// is derived from its grid box in the parent's (quantization_frame::child),
+// by the same code during build and traversal, and the build checks that each
+// stored box really contains the exact one with the grids traversal will use.
+template <typename T>
+struct quantized_node
+{
+    T minimum[2][3];
+    T maximum[2][3];
+    std::uint32_t child[2]; // interior child: its node index; leaf: first entry in primitive_indices
+    std::uint8_t count[2];  // primitives in a leaf child, 0 for an interior child
+    std::uint8_t axis{ 0 }; // the source node's split axis, for near-first order
+    std::uint8_t flags{ 0 };
+};
+static_assert(sizeof(quantized_node<std::uint8_t>) == 24);
+static_assert(sizeof(quantized_node<std::uint16_t>) == 36);
+
+// A motion node's children's boxes at shutter close, on the same grid.
+template <typename T>
+struct quantized_end_bounds
+{
+    T minimum[2][3];
+    T maximum[2][3];
+};
+
+// The grid a node's children are stored on: coordinate q on axis a stands for
+// origin[a] + q * step[a], for q from 0 to the largest T.
+struct quantization_frame
+{
+    double origin[3];
+    double step[3];
+
+    [[nodiscard]] double coordinate(int a, unsigned q) const { return origin[a] + static_cast<double>(q) * step[a]; }
+
+    template <typename T>
+    [[nodiscard]] static quantization_frame around(const aabb& box)
+    {
+        constexpr double levels = std::numeric_limits<T>::max();
+        quantization_frame frame{};
+        for (int a = 0; a < 3; ++a)
+        {
+            frame.origin[a] = box.minimum.e[a];
+            frame.step[a] = (box.maximum.e[a] - box.minimum.e[a]) * (widening / levels);
+        }
+        return frame;
+    }
+
+    // The grid of a child stored as the grid box [low, high] of this one: a
+    // few multiplies, cheap enough to redo for every node a ray visits.
+    template <typename T>
+    [[nodiscard]] quantization_frame child(const unsigned (&low)[3], const unsigned (&high)[3]) const
+    {
+        constexpr double levels = std::numeric_limits<T>::max();
+        quantization_frame frame{};
+        for (int a = 0; a < 3; ++a)
+        {
+            frame.origin[a] = coordinate(a, low[a]);
+            frame.step[a] = static_cast<double>(high[a] - low[a]) * step[a] * (widening / levels);
+        }
+        return frame;
+    }
+
+    // Grids reach slightly past the box they are made for, so that rounding
+    // does not leave the last grid line short of it.
+    static constexpr double widening = 1.0 + 0x1p-30;
+
+    // The smallest grid box containing `box`. Returns false if there is none:
+    // the box reaches past the grid, which rounding could only cause for a
+    // box tiny next to its distance from the origin.
+    template <typename T>
+    bool quantize(const aabb& box, T (&minimum)[3], T (&maximum)[3]) const
+    {
+        bool contained = true;
+        constexpr auto levels = std::numeric_limits<T>::max();
+        for (int a = 0; a < 3; ++a)
+        {
+            unsigned low = 0, high = 0;
+            if (step[a] > 0.0)
+            {
+                low = static_cast<unsigned>(std::clamp(std::floor((box.minimum.e[a] - origin[a]) / step[a]), 0.0, double{ levels }));
+                high = static_cast<unsigned>(std::clamp(std::ceil((box.maximum.e[a] - origin[a]) / step[a]), 0.0, double{ levels }));
+            }
+            while (low > 0 && coordinate(a, low) > box.minimum.e[a])
+                --low;
+            while (high < levels && coordinate(a, high) < box.maximum.e[a])
+                ++high;
+            minimum[a] = static_cast<T>(low);
+            maximum[a] = static_cast<T>(high);
+            contained = contained && coordinate(a, low) <= box.minimum.e[a] && coordinate(a, high) >= box.maximum.e[a];
+        }
+        return contained;
+    }
+};
+
+class quantized_bvh
+{
+public:
+    // Copies `source` in `format`. Returns false, leaving this tree empty, for
+    // bvh_node_format::full and for trees it cannot hold: unbounded boxes,
+    // leaves of more than 255 primitives, or boxes too small to quantize.
+    bool build(const flat_bvh& source, bvh_node_format format);
+
+    void clear();
+
+    [[nodiscard]] bool empty() const { return format == bvh_node_format::full; }
+    [[nodiscard]] bool has_motion() const { return !end_bounds8.empty() || !end_bounds16.empty(); }
+    [[nodiscard]] aabb bounds() const
+    {
+        aabb box = root_box;
+        if (has_motion())
+            grow(box, root_end_box);
+        return box;
+    }
+
+    // Bytes of node data, for comparison with flat_bvh_memory_bytes().
+    [[nodiscard]] size_t memory_bytes() const
+    {
+        return nodes8.size() * sizeof(nodes8[0]) + nodes16.size() * sizeof(nodes16[0])
+             + end_bounds8.size() * sizeof(end_bounds8[0]) + end_bounds16.size() * sizeof(end_bounds16[0]);
+    }
+
+    // Same contract as flat_bvh::traverse().
+    template <typename LeafHit>
+    bool traverse(const ray& r, double t_min, double t_max, LeafHit&& hit_leaf) const;
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    bvh_node_format format{ bvh_node_format::full };
+    std::vector<quantized_node<std::uint8_t>> nodes8;
+    std::vector<quantized_node<std::uint16_t>> nodes16;
+    std::vector<quantized_end_bounds<std::uint8_t>> end_bounds8;
+    std::vector<quantized_end_bounds<std::uint16_t>> end_bounds16;
+    // The root box in full, and a root that is itself a leaf (count > 0).
+    aabb root_box;
+    aabb root_end_box;
+    std::uint32_t root_first{ 0 };
+    std::uint32_t root_count{ 0 };
+    quantization_frame root_frame{};
+    double shutter_open{ 0 };
+    double inverse_shutter_length{ 0 };
+
+private:
+    template <typename T>
+    bool build_as(const flat_bvh& source, std::vector<quantized_node<T>>& nodes,
+        std::vector<quantized_end_bounds<T>>& end_bounds);
+
+    template <typename T>
+    bool emit(const flat_bvh& source, std::uint32_t i, const quantization_frame& frame,
+        std::vector<quantized_node<T>>& nodes, std::vector<quantized_end_bounds<T>>& end_bounds);
+
+    // The grid box child c of node i spans over the whole shutter.
+    template <typename T>
+    static void child_grid_box(const quantized_node<T>& node, const quantized_end_bounds<T>* end, int c,
+        unsigned (&low)[3], unsigned (&high)[3])
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            low[a] = node.minimum[c][a];
+            high[a] = node.maximum[c][a];
+            if (end != nullptr)
+            {
+                low[a] = std::min<unsigned>(low[a], end->minimum[c][a]);
+                high[a] = std::max<unsigned>(high[a], end->maximum[c][a]);
+            }
+        }
+    }
+
+    template <typename T, bool moving, typename LeafHit>
+    bool traverse_as(const std::vector<quantized_node<T>>& nodes, const std::vector<quantized_end_bounds<T>>& end_bounds,
+        const ray& r, double t_min, double t_max, LeafHit& hit_leaf) const;
+};
+
+// Node bytes of a flat_bvh, for comparison with quantized_bvh::memory_bytes().
+inline size_t flat_bvh_memory_bytes(const flat_bvh& bvh)
+{
+    return bvh.nodes.size() * sizeof(flat_bvh_node) + bvh.end_boxes.size() * sizeof(aabb);
+}
+
+inline void quantized_bvh::clear()
+{
+    format = bvh_node_format::full;
+    nodes8.clear();
+    nodes16.clear();
+    end_bounds8.clear();
+    end_bounds16.clear();
+    root_count = 0;
+}
+
+inline bool quantized_bvh::build(const flat_bvh& source, bvh_node_format node_format)
+{
+    clear();
+    if (node_format == bvh_node_format::full || source.empty())
+        return false;
+    const aabb whole = source.bounds();
+    for (int a = 0; a < 3; ++a)
+    {
+        if (!std::isfinite(whole.minimum.e[a]) || !std::isfinite(whole.maximum.e[a]))
+            return false;
+    }
+    for (const flat_bvh_node& node : source.nodes)
+    {
+        if (node.count > std::numeric_limits<std::uint8_t>::max())
+            return false;
+    }
+
+    const bool ok = node_format == bvh_node_format::quantized8 ? build_as(source, nodes8, end_bounds8)
+                                                               : build_as(source, nodes16, end_bounds16);
+    if (!ok)
+    {
+        clear();
+        return false;
+    }
+    format = node_format;
+    return true;
+}
+
+template <typename T>
+bool quantized_bvh::build_as(const flat_bvh& source, std::vector<quantized_node<T>>& nodes,
+    std::vector<quantized_end_bounds<T>>& end_bounds)
+{
+    root_box = source.nodes[0].box;
+    root_end_box = source.has_motion() ? source.end_boxes[0] : root_box;
+    shutter_open = source.shutter_open;
+    inverse_shutter_length = source.inverse_shutter_length;
+    if (source.nodes[0].count > 0)
+    {
+        root_first = source.nodes[0].offset;
+        root_count = source.nodes[0].count;
+        return true;
+    }
+
+    // One node per interior node of the source.
+    const size_t interior_count = source.nodes.size() / 2;
+    nodes.reserve(interior_count);
+    if (source.has_motion())
+        end_bounds.reserve(interior_count);
+    root_frame = quantization_frame::around<T>(bounds());
+    return emit<T>(source, 0, root_frame, nodes, end_bounds);
+}
+
+template <typename T>
+bool quantized_bvh::emit(const flat_bvh& source, std::uint32_t i, const quantization_frame& frame,
+    std::vector<quantized_node<T>>& nodes, std::vector<quantized_end_bounds<T>>& end_bounds)
+{
+    const bool motion = source.has_motion();
+    const auto index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+    if (motion)
+        end_bounds.emplace_back();
+    nodes[index].axis = source.nodes[i].axis;
+
+    const std::uint32_t children[2] = { i + 1, source.nodes[i].offset };
+    for (int c = 0; c < 2; ++c)
+    {
+        const flat_bvh_node& child = source.nodes[children[c]];
+        if (!frame.quantize(child.box, nodes[index].minimum[c], nodes[index].maximum[c]))
+            return false;
+        if (motion && !frame.quantize(source.end_boxes[children[c]], end_bounds[index].minimum[c], end_bounds[index].maximum[c]))
+            return false;
+
+        if (child.count > 0)
+        {
+            nodes[index].child[c] = child.offset;
+            nodes[index].count[c] = static_cast<std::uint8_t>(child.count);
+            continue;
+        }
+
+        // Children follow their parent, so the next node is this child's.
+        unsigned low[3], high[3];
+        child_grid_box(nodes[index], motion ? &end_bounds[index] : nullptr, c, low, high);
+        nodes[index].child[c] = static_cast<std::uint32_t>(nodes.size());
+        nodes[index].count[c] = 0;
+        if (!emit<T>(source, children[c], frame.child<T>(low, high), nodes, end_bounds))
+            return false;
+    }
+    return true;
+}
+
+template <typename LeafHit>
+bool quantized_bvh::traverse(const ray& r, double t_min, double t_max, LeafHit&& hit_leaf) const
+{
+    // One instantiation per format and motion, so the inner loop never asks.
+    const bool moving = has_motion();
+    if (format == bvh_node_format::quantized8)
+    {
+        return moving ? traverse_as<std::uint8_t, true>(nodes8, end_bounds8, r, t_min, t_max, hit_leaf)
+                      : traverse_as<std::uint8_t, false>(nodes8, end_bounds8, r, t_min, t_max, hit_leaf);
+    }
+    if (format == bvh_node_format::quantized16)
+    {
+        return moving ? traverse_as<std::uint16_t, true>(nodes16, end_bounds16, r, t_min, t_max, hit_leaf)
+                      : traverse_as<std::uint16_t, false>(nodes16, end_bounds16, r, t_min, t_max, hit_leaf);
+    }
+    return false;
+}
+
+template <typename T, bool moving, typename LeafHit>
+bool quantized_bvh::traverse_as(const std::vector<quantized_node<T>>& nodes,
+    const std::vector<quantized_end_bounds<T>>& end_bounds, const ray& r, double t_min, double t_max,
+    LeafHit& hit_leaf) const
+{
+    const point3 origin = r.origin();
+    const vec3 inverse_direction(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+    const double s = (r.time() - shutter_open) * inverse_shutter_length;
+    // Per axis, whether the ray enters a box through its maximum.
+    const int backwards[3] = { inverse_direction.x() < 0.0, inverse_direction.y() < 0.0, inverse_direction.z() < 0.0 };
+
+    RT_COUNT(bvh_nodes);
+    aabb root = root_box;
+    if (moving)
+    {
+        root.minimum += s * (root_end_box.minimum - root_box.minimum);
+        root.maximum += s * (root_end_box.maximum - root_box.maximum);
+    }
+    if (!root.hit(origin, inverse_direction, t_min, t_max))
+        return false;
+    if (root_count > 0)
+        return hit_leaf(root_first, root_count, t_max);
+
+    // Children are tested when their parent is visited, so an entry keeps
+    // where its box starts: a closer hit found meanwhile can skip it. Leaf
+    // entries (count > 0) wait their turn too rather than being tested early.
+    struct stack_entry
+    {
+        std::uint32_t child;
+        std::uint32_t count;
+        double entry_t;
+        quantization_frame frame;
+    };
+    stack_entry stack[flat_bvh::max_depth];
+    int stack_size = 0;
+    std::uint32_t current = 0;
+    quantization_frame frame = root_frame;
+    bool hit_anything = false;
+
+    while (true)
+    {
+        const quantized_node<T>& node = nodes[current];
+        RT_COUNT_N(bvh_nodes, 2); // both children's boxes
+
+        // Grid coordinate q on axis a meets the ray at base[a] + q * scale[a],
+        // so each slab costs one multiply-add per bound. With motion, the
+        // coordinate itself is interpolated over the shutter first.
+        double base[3], scale[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            base[a] = (frame.origin[a] - origin.e[a]) * inverse_direction.e[a];
+            scale[a] = frame.step[a] * inverse_direction.e[a];
+        }
+        auto hits_child = [&](int c, double& entry_t) {
+            const T* bounds_start[2] = { node.minimum[c], node.maximum[c] };
+            const T* bounds_end[2] = { nullptr, nullptr };
+            if constexpr (moving)
+            {
+                bounds_end[0] = end_bounds[current].minimum[c];
+                bounds_end[1] = end_bounds[current].maximum[c];
+            }
+            double near = t_min, far = t_max;
+            for (int a = 0; a < 3; ++a)
+            {
+                double entry_q = bounds_start[backwards[a]][a], exit_q = bounds_start[1 - backwards[a]][a];
+                if constexpr (moving)
+                {
+                    entry_q += s * (bounds_end[backwards[a]][a] - entry_q);
+                    exit_q += s * (bounds_end[1 - backwards[a]][a] - exit_q);
+                }
+                const double t0 = base[a] + entry_q * scale[a];
+                const double t1 = base[a] + exit_q * scale[a];
+                near = t0 > near ? t0 : near;
+                far = t1 < far ? t1 : far;
+            }
+            entry_t = near;
+            return near <= far;
+        };
+
+        // The same grids emit() quantized the child's children on.
+        auto child_frame = [&](int c) {
+            unsigned low[3], high[3];
+            child_grid_box(node, moving ? &end_bounds[current] : nullptr, c, low, high);
+            return frame.child<T>(low, high);
+        };
+
+        // Of the children the ray enters, the farther waits on the stack and
+        // the nearer is visited now: a leaf is tested, a node descended into.
+        int visit[2];
+        double visit_t[2];
+        int visit_count = 0;
+        for (int c = 0; c < 2; ++c)
+        {
+            if (hits_child(c, visit_t[visit_count]))
+                visit[visit_count++] = c;
+        }
+        if (visit_count == 2)
+        {
+            if (visit_t[1] < visit_t[0])
+            {
+                std::swap(visit[0], visit[1]);
+                std::swap(visit_t[0], visit_t[1]);
+            }
+            const int c = visit[1];
+            stack_entry& entry = stack[stack_size++];
+            entry.child = node.child[c];
+            entry.count = node.count[c];
+            entry.entry_t = visit_t[1];
+            if (node.count[c] == 0)
+                entry.frame = child_frame(c);
+        }
+        if (visit_count > 0)
+        {
+            const int c = visit[0];
+            if (node.count[c] == 0)
+            {
+                frame = child_frame(c);
+                current = node.child[c];
+                continue;
+            }
+            if (hit_leaf(node.child[c], static_cast<std::uint32_t>(node.count[c]), t_max))
+                hit_anything = true;
+        }
+
+        bool descend = false;
+        while (stack_size > 0 && !descend)
+        {
+            const stack_entry& entry = stack[--stack_size];
+            if (entry.entry_t > t_max)
+                continue;
+            if (entry.count > 0)
+            {
+                if (hit_leaf(entry.child, entry.count, t_max))
+                    hit_anything = true;
+                continue;
+            }
+            current = entry.child;
+            frame = entry.frame;
+            descend = true;
+        }
+        if (!descend)
+            break;
+    }
+    return hit_anything;
+}
+
+#endif
@@ -20,12 +20,26 @@ public:
 		return orig + t * dir;
 	}
 
+	// Offset rays one pixel over in x and y, used to estimate texture footprints.
+	void set_differentials(const point3& x_origin, const vec3& x_direction,
+		const point3& y_origin, const vec3& y_direction)
+	{
+		rx_origin = x_origin;
+		rx_direction = x_direction;
+		ry_origin = y_origin;
+		ry_direction = y_direction;
+		has_differentials = true;
+	}
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
 	point3 orig;
 	vec3 dir;
 	double tm{};
 
+	bool has_differentials{ false };
+	point3 rx_origin, ry_origin;
+	vec3 rx_direction, ry_direction;
 };
 
 #endif
@@ -0,0 +1,200 @@
+#ifndef RENDER_BENCHMARK_H
+#define RENDER_BENCHMARK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "hittable.h"
+
+// The process's peak resident set so far, in bytes (0 if unknown).
+inline std::size_t peak_resident_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Forwards to a scene and counts the rays traced through it: ray_color()
+// calls world.hit() once per ray, camera and scattered rays alike, and
+// world.occluded() once per shadow ray when it samples lights. Counts are
+// per thread and folded into the total as each thread exits, which
+// parallel_for's workers do before it returns; total() adds the calling
+// thread's own count. Costs one extra virtual call per ray, so it is only put
+// around the scene when rays are to be counted.
+class ray_counting_world final : public hittable
+{
+public:
+    explicit ray_counting_world(const hittable& inner) : inner(inner) {}
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override
+    {
+        ++local_count().rays;
+        return inner.hit(r, t_min, t_max, rec);
+    }
+
+    bool occluded(const ray& r, double t_min, double t_max) const override
+    {
+        ++local_count().rays;
+        return inner.occluded(r, t_min, t_max);
+    }
+
+    bool bounding_box(double time0, double time1, aabb& output_box) const override
+    {
+        return inner.bounding_box(time0, time1, output_box);
+    }
+
+    [[nodiscard]] static std::uint64_t total() { return retired() + local_count().rays; }
+
+    static void reset()
+    {
+        retired() = 0;
+        local_count().rays = 0;
+    }
+
+private:
+    struct thread_count
+    {
+        std::uint64_t rays{ 0 };
+        ~thread_count() { retired() += rays; }
+    };
+
+    static std::atomic<std::uint64_t>& retired()
+    {
+        static std::atomic<std::uint64_t> count{ 0 };
+        return count;
+    }
+
+    static thread_count& local_count()
+    {
+        thread_local thread_count count;
+        return count;
+    }
+
+    const hittable& inner;
+};
+
+// One render of a --thread-sweep. idle_seconds[t] is how long worker t of
+// the render's parallel_for spent outside tiles: starting up, and waiting at
+// the end for the last tiles of the others.
+struct thread_scaling_point
+{
+    unsigned threads{ 0 };
+    double seconds{ 0 };
+    std::uint64_t rays{ 0 };
+    std::vector<double> idle_seconds;
+
+    [[nodiscard]] double mrays_per_second() const { return seconds > 0 ? rays / seconds / 1e6 : 0.0; }
+
+    [[nodiscard]] double idle_fraction() const
+    {
+        double idle = 0;
+        for (const double s : idle_seconds)
+            idle += s;
+        return seconds > 0 && !idle_seconds.empty() ? idle / (seconds * idle_seconds.size()) : 0.0;
+    }
+};
+
+// One --benchmark run: its settings, where the time went, and throughput.
+struct render_benchmark_report
+{
+    int image_width{ 0 };
+    int image_height{ 0 };
+    int samples_per_pixel{ 0 };
+    int max_depth{ 0 };
+    unsigned threads{ 0 };
+    int scene_size{ 0 };
+    double max_rise{ 0 };
+    std::string accelerator;
+    std::string bvh_builder;
+    std::string bvh_nodes;
+    std::string pinning;
+    size_t replicas{ 0 };          // per-node scene copies (--numa-replicate), 0 for one shared scene
+    double replicate_seconds{ 0 }; // making all of them
+
+    std::size_t objects{ 0 };
+    double scene_seconds{ 0 };  // making the objects
+    double build_seconds{ 0 };  // building the acceleration structure
+    double render_seconds{ 0 };
+    double output_seconds{ 0 }; // writing the image
+    std::uint64_t primary_rays{ 0 };
+    std::uint64_t rays{ 0 };    // primary and scattered
+    std::size_t peak_rss_bytes{ 0 };
+    std::vector<thread_scaling_point> scaling; // --thread-sweep, in the order run
+
+    [[nodiscard]] double mrays_per_second() const { return render_seconds > 0 ? rays / render_seconds / 1e6 : 0.0; }
+};
+
+inline void write_json(std::ostream& out, const render_benchmark_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(6);
+    out << "{\n"
+        << "  \"settings\": { \"width\": " << report.image_width << ", \"height\": " << report.image_height
+        << ", \"samples_per_pixel\": " << report.samples_per_pixel << ", \"max_depth\": " << report.max_depth
+        << ", \"threads\": " << report.threads << ", \"scene_size\": " << report.scene_size
+        << ", \"max_rise\": " << report.max_rise << ", \"accelerator\": \"" << report.accelerator
+        << "\", \"bvh_builder\": \"" << report.bvh_builder << "\", \"bvh_nodes\": \"" << report.bvh_nodes
+        << "\", \"pinning\": \"" << report.pinning << "\", \"replicas\": " << report.replicas << " },\n"
+        << "  \"objects\": " << report.objects << ",\n"
+        << "  \"seconds\": { \"scene\": " << report.scene_seconds << ", \"bvh_build\": " << report.build_seconds
+        << ", \"replicate\": " << report.replicate_seconds << ", \"render\": " << report.render_seconds << ", \"output\": " << report.output_seconds << " },\n"
+        << "  \"primary_rays\": " << report.primary_rays << ",\n"
+        << "  \"rays\": " << report.rays << ",\n"
+        << "  \"mrays_per_second\": " << report.mrays_per_second() << ",\n"
+        << "  \"peak_rss_bytes\": " << report.peak_rss_bytes;
+
+    // Speedup and efficiency are against the first point's throughput per
+    // thread, so a sweep that starts at one thread gives the usual curves.
+    if (!report.scaling.empty())
+    {
+        const thread_scaling_point& base = report.scaling.front();
+        const double base_per_thread = base.mrays_per_second() / base.threads;
+        out << ",\n  \"scaling\": [";
+        for (size_t i = 0; i < report.scaling.size(); ++i)
+        {
+            const thread_scaling_point& point = report.scaling[i];
+            const double speedup = base_per_thread > 0 ? point.mrays_per_second() / base_per_thread : 0.0;
+            out << (i == 0 ? "\n" : ",\n") << "    { \"threads\": " << point.threads << ", \"seconds\": " << point.seconds
+                << ", \"mrays_per_second\": " << point.mrays_per_second() << ", \"speedup\": " << speedup
+                << ", \"efficiency\": " << speedup / point.threads << ", \"idle_fraction\": " << point.idle_fraction()
+                << ", \"idle_seconds\": [";
+            for (size_t t = 0; t < point.idle_seconds.size(); ++t)
+                out << (t == 0 ? "" : ", ") << point.idle_seconds[t];
+            out << "] }";
+        }
+        out << "\n  ]";
+    }
+    out << "\n}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif
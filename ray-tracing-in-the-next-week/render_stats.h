@@ -0,0 +1,150 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Counters of what a render does: rays, BVH nodes, primitive tests, and how
+// paths end. Only builds with RT_ENABLE_STATS defined count anything; in every
+// other build RT_COUNT() expands to nothing and the render loops carry no
+// counter code at all.
+//
+// Each thread counts into its own block (thread_local, no atomics, no shared
+// cache lines). A block is added to the process totals when its thread exits,
+// which for parallel_for's workers is at the end of every parallel_for, so
+// totals() is exact once rendering has returned.
+namespace stats
+{
+
+#ifdef RT_ENABLE_STATS
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+enum counter : int
+{
+    primary_rays,      // camera rays
+    secondary_rays,    // scattered rays traced on from a hit
+    shadow_rays,       // occlusion tests towards sampled lights
+    bvh_nodes,         // BVH nodes visited (boxes tested)
+    primitive_tests,   // ray-primitive intersection tests (a triangle packet counts its lanes)
+    bounces,           // hits whose material scattered
+    paths_escaped,     // paths that left the scene
+    paths_absorbed,    // paths whose material absorbed the ray
+    paths_depth_limit, // paths cut off at max_depth
+    counter_count
+};
+
+inline const char* counter_name(int c)
+{
+    static const char* const names[counter_count] = { "primary_rays", "secondary_rays", "shadow_rays", "bvh_nodes", "primitive_tests",
+        "bounces", "paths_escaped", "paths_absorbed", "paths_depth_limit" };
+    return names[c];
+}
+
+struct counters
+{
+    std::uint64_t value[counter_count]{};
+
+    counters& operator+=(const counters& other)
+    {
+        for (int c = 0; c < counter_count; ++c)
+            value[c] += other.value[c];
+        return *this;
+    }
+};
+
+class registry
+{
+public:
+    static registry& global()
+    {
+        static registry instance;
+        return instance;
+    }
+
+    // Totals over exited threads plus the live ones. Live blocks are read
+    // without synchronization, so call this when no render is running.
+    [[nodiscard]] counters totals()
+    {
+        std::lock_guard lock(mutex);
+        counters sum = retired;
+        for (const counters* block : live)
+            sum += *block;
+        return sum;
+    }
+
+    void reset()
+    {
+        std::lock_guard lock(mutex);
+        retired = {};
+        for (counters* block : live)
+            *block = {};
+    }
+
+    void attach(counters* block)
+    {
+        std::lock_guard lock(mutex);
+        live.push_back(block);
+    }
+
+    void detach(counters* block)
+    {
+        std::lock_guard lock(mutex);
+        retired += *block;
+        live.erase(std::find(live.begin(), live.end(), block));
+    }
+
+private:
+    std::mutex mutex;
+    counters retired;
+    std::vector<counters*> live;
+};
+
+// The calling thread's block, registered on first use.
+inline counters& local()
+{
+    struct thread_block
+    {
+        counters block;
+        thread_block() { registry::global().attach(&block); }
+        ~thread_block() { registry::global().detach(&block); }
+    };
+    thread_local thread_block instance;
+    return instance.block;
+}
+
+// The counters, plus per-ray ratios and rates, as one JSON object.
+inline void write_json(std::ostream& out, const counters& totals, double seconds)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(6);
+    const auto rays = static_cast<double>(totals.value[primary_rays] + totals.value[secondary_rays] + totals.value[shadow_rays]);
+    auto per_ray = [&](counter c) { return rays > 0 ? static_cast<double>(totals.value[c]) / rays : 0.0; };
+
+    out << "{\n  \"seconds\": " << seconds << ",\n  \"counters\": {";
+    for (int c = 0; c < counter_count; ++c)
+        out << (c == 0 ? "\n" : ",\n") << "    \"" << counter_name(c) << "\": " << totals.value[c];
+    out << "\n  },\n  \"rays_per_second\": " << (seconds > 0 ? rays / seconds : 0.0)
+        << ",\n  \"bvh_nodes_per_ray\": " << per_ray(bvh_nodes)
+        << ",\n  \"primitive_tests_per_ray\": " << per_ray(primitive_tests) << "\n}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+} // namespace stats
+
+#ifdef RT_ENABLE_STATS
+#define RT_COUNT(name) (++stats::local().value[stats::name])
+#define RT_COUNT_N(name, n) (stats::local().value[stats::name] += static_cast<std::uint64_t>(n))
+#else
+#define RT_COUNT(name) ((void)0)
+#define RT_COUNT_N(name, n) ((void)0)
+#endif
+
+#endif
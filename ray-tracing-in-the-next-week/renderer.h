@@ -0,0 +1,435 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "color.h"
+#include "heatmap.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "parallel.h"
+#include "render_stats.h"
+#include "scene_bvh.h"
+
+inline color sky_color(const ray& r)
+{
+    const vec3 unit_direction = unit_vector(r.direction());
+    const auto t = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+// Pure BSDF sampling: lights are found only by scattered rays that happen to
+// hit them. Without the sky, paths that escape bring back nothing.
+inline color ray_color(const ray& r, const hittable& world, int depth, bool sky = true)
+{
+    hit_record record;
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+    {
+        RT_COUNT(paths_depth_limit);
+        return color{ 0, 0, 0 };
+    }
+
+    if (world.hit(r, 0.001, infinity, record))
+    {
+        record.finish_shading(r);
+        ray scattered;
+        color attenuation;
+        if (record.hit_material->scatter(r, record, attenuation, scattered))
+        {
+            RT_COUNT(bounces);
+            if (depth > 1)
+                RT_COUNT(secondary_rays);
+            return record.hit_material->emitted(record) + attenuation * ray_color(scattered, world, depth - 1, sky);
+        }
+        RT_COUNT(paths_absorbed);
+        return record.hit_material->emitted(record);
+    }
+    RT_COUNT(paths_escaped);
+    return sky ? sky_color(r) : color{ 0, 0, 0 };
+}
+
+// Power heuristic (beta = 2): the weight of a sample taken with density
+// pdf_a that another strategy would have taken with density pdf_b.
+inline double power_heuristic(double pdf_a, double pdf_b)
+{
+    const double a = pdf_a * pdf_a;
+    const double b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+// Path tracing with next-event estimation: at every hit on a material with a
+// scattering density (lambertian), one light is also sampled directly and
+// tested with a shadow ray. Light reached both ways, by the shadow ray and by
+// the scattered ray hitting an emitter, is weighted with multiple importance
+// sampling, so small lights converge quickly without the large ones (which
+// scattered rays find well) getting noisier.
+inline color ray_color(const ray& camera_ray, const hittable& world, const light_list& lights, int max_depth, bool sky)
+{
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    ray r = camera_ray;
+    double scatter_pdf = 0; // density with which scatter() picked r; 0 for camera and specular rays
+    point3 scatter_origin;
+    vec3 scatter_normal;
+
+    for (int depth = max_depth;; --depth)
+    {
+        if (depth <= 0)
+        {
+            RT_COUNT(paths_depth_limit);
+            break;
+        }
+
+        hit_record record;
+        if (!world.hit(r, 0.001, infinity, record))
+        {
+            RT_COUNT(paths_escaped);
+            if (sky)
+                radiance += throughput * sky_color(r);
+            break;
+        }
+        record.finish_shading(r);
+        const material& surface = *record.hit_material;
+
+        const color emitted = surface.emitted(record);
+        if (!emitted.near_zero())
+        {
+            // The previous hit may have sampled this light directly as well.
+            const double weight = scatter_pdf > 0 ? power_heuristic(scatter_pdf, lights.pdf(scatter_origin, scatter_normal, r.time(), record)) : 1.0;
+            radiance += weight * throughput * emitted;
+        }
+
+        light_sample light;
+        if (lights.sample(record.hit_point, record.normal_vec_of_hit, r.time(), light))
+        {
+            const color f = surface.scattering(r, record, light.direction);
+            if (!f.near_zero())
+            {
+                RT_COUNT(shadow_rays);
+                if (!world.occluded(ray(record.hit_point, light.direction, r.time()), 0.001, light.distance - 0.001))
+                {
+                    const double weight = power_heuristic(light.pdf, surface.scattering_pdf(record, light.direction));
+                    radiance += throughput * f * light.radiance * (weight / light.pdf);
+                }
+            }
+        }
+
+        ray scattered;
+        color attenuation;
+        if (!surface.scatter(r, record, attenuation, scattered))
+        {
+            RT_COUNT(paths_absorbed);
+            break;
+        }
+        RT_COUNT(bounces);
+        if (depth > 1)
+            RT_COUNT(secondary_rays);
+        throughput = throughput * attenuation;
+        scatter_pdf = surface.scattering_pdf(record, unit_vector(scattered.direction()));
+        scatter_origin = record.hit_point;
+        scatter_normal = record.normal_vec_of_hit;
+        r = scattered;
+    }
+    return radiance;
+}
+
+struct render_settings
+{
+    int image_width{ 400 };
+    int image_height{ 225 };
+    int samples_per_pixel{ 100 };
+    int max_depth{ 50 };
+    unsigned thread_count{ 0 }; // 0 = one per hardware thread
+    bool show_progress{ false };
+    bool sky{ true };                    // the sky gradient lights the scene
+    const light_list* lights{ nullptr }; // sampled directly when set; see ray_color()
+};
+
+// One camera ray's radiance, traced the way `settings` asks for.
+inline color trace(const ray& r, const hittable& world, const render_settings& settings)
+{
+    if (settings.lights)
+        return ray_color(r, world, *settings.lights, settings.max_depth, settings.sky);
+    return ray_color(r, world, settings.max_depth, settings.sky);
+}
+
+// Sums of the samples taken in each pixel. Row 0 is the bottom of the image,
+// as in the original scan-line loop.
+struct frame_image
+{
+    int width{ 0 };
+    int height{ 0 };
+    int samples_per_pixel{ 0 };
+    std::vector<color> pixels;
+
+    void resize(int image_width, int image_height, int samples)
+    {
+        width = image_width;
+        height = image_height;
+        samples_per_pixel = samples;
+        pixels.assign(static_cast<size_t>(width) * height, color(0, 0, 0));
+    }
+
+    color& at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+    [[nodiscard]] const color& at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+};
+
+// Every pixel reseeds the thread's generator from (frame, pixel), so an image
+// does not depend on the thread count or on which thread rendered which tile.
+inline std::uint64_t pixel_seed(std::uint64_t frame, std::uint64_t pixel)
+{
+    // splitmix64 finalizer over the combined key.
+    std::uint64_t z = (frame << 32 ^ pixel) + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Renders pixels [x0, x1) x [y0, y1) of the image on settings.thread_count
+// threads, in 16x16 tiles handed out dynamically so expensive regions (glass,
+// deep bounces) still balance. `image` must already have the full image size.
+// With `costs` (also full size), each pixel's BVH nodes, primitive tests and
+// wall time are recorded as well; see heatmap.h.
+inline void render_region(const hittable& world, const camera& cam, const render_settings& settings,
+    std::uint64_t frame, int x0, int y0, int x1, int y1, frame_image& image, pixel_costs* costs = nullptr)
+{
+    constexpr int tile_size = 16;
+    const int width = settings.image_width;
+    const int height = settings.image_height;
+
+    const int tiles_x = (x1 - x0 + tile_size - 1) / tile_size;
+    const int tiles_y = (y1 - y0 + tile_size - 1) / tile_size;
+    const size_t tile_count = static_cast<size_t>(tiles_x) * tiles_y;
+
+    std::atomic<size_t> tiles_done{ 0 };
+    std::mutex progress_mutex;
+
+    parallel_for(tile_count, [&](size_t tile) {
+        const int tile_x = x0 + static_cast<int>(tile % tiles_x) * tile_size;
+        const int tile_y = y0 + static_cast<int>(tile / tiles_x) * tile_size;
+        for (int j = tile_y; j < std::min(tile_y + tile_size, y1); ++j)
+        {
+            for (int i = tile_x; i < std::min(tile_x + tile_size, x1); ++i)
+            {
+                pixel_cost_meter meter;
+                if (costs)
+                    meter.start();
+                seed_random(pixel_seed(frame, static_cast<std::uint64_t>(j) * width + i));
+                color pixel_color(0, 0, 0);
+                for (int s = 0; s < settings.samples_per_pixel; ++s)
+                {
+                    const double u = (i + random_double()) / (width - 1);
+                    const double v = (j + random_double()) / (height - 1);
+                    RT_COUNT(primary_rays);
+                    pixel_color += trace(cam.get_ray(u, v), world, settings);
+                }
+                image.at(i, j) = pixel_color;
+                if (costs)
+                    meter.stop(*costs, i, j);
+            }
+        }
+
+        const size_t done = ++tiles_done;
+        if (settings.show_progress && (done % 16 == 0 || done == tile_count))
+        {
+            std::lock_guard lock(progress_mutex);
+            std::cerr << "\rTiles remaining: " << tile_count - done << ' ' << std::flush;
+        }
+    }, settings.thread_count);
+}
+
+inline void render_frame(const hittable& world, const camera& cam, const render_settings& settings,
+    std::uint64_t frame, frame_image& image, pixel_costs* costs = nullptr)
+{
+    image.resize(settings.image_width, settings.image_height, settings.samples_per_pixel);
+    if (costs)
+        costs->resize(settings.image_width, settings.image_height);
+    render_region(world, cam, settings, frame, 0, 0, settings.image_width, settings.image_height, image, costs);
+}
+
+inline bool write_ppm(const std::string& path, const frame_image& image)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write image '" << path << "'.\n";
+        return false;
+    }
+    out << "P3\n" << image.width << " " << image.height << "\n255\n";
+    for (int j = image.height - 1; j >= 0; --j)
+    {
+        for (int i = 0; i < image.width; ++i)
+            write_color(out, image.at(i, j), image.samples_per_pixel);
+    }
+    return static_cast<bool>(out);
+}
+
+// A scene that changes from frame to frame. render_sequence() keeps two of
+// them, so one can be moved to frame N+1 while the other renders frame N.
+class animated_scene
+{
+public:
+    virtual ~animated_scene() = default;
+
+    // Moves everything to `frame` and brings the acceleration structure up to date.
+    virtual bvh_update_report set_frame(int frame) = 0;
+
+    [[nodiscard]] virtual const hittable& world() const = 0;
+    [[nodiscard]] virtual camera frame_camera() const = 0;
+
+    // The lights ray_color() may sample directly, if the scene has any.
+    [[nodiscard]] virtual const light_list* lights() const { return nullptr; }
+};
+
+// Parses "0-99", "5", or comma-separated lists of those ("0-9,20-29") into
+// frame numbers, in the order given.
+inline bool parse_frame_ranges(const std::string& text, std::vector<int>& frames)
+{
+    frames.clear();
+    size_t begin = 0;
+    while (begin <= text.size())
+    {
+        size_t end = text.find(',', begin);
+        if (end == std::string::npos)
+            end = text.size();
+        const std::string range = text.substr(begin, end - begin);
+
+        int first = 0, last = 0;
+        char extra = 0;
+        const int fields = std::sscanf(range.c_str(), "%d-%d%c", &first, &last, &extra);
+        if (fields == 1 && range.find('-', 1) == std::string::npos)
+            last = first;
+        else if (fields != 2)
+        {
+            std::cerr << "ERROR: Bad frame range '" << range << "'.\n";
+            return false;
+        }
+        if (last < first)
+        {
+            std::cerr << "ERROR: Frame range '" << range << "' runs backwards.\n";
+            return false;
+        }
+        for (int frame = first; frame <= last; ++frame)
+            frames.push_back(frame);
+        begin = end + 1;
+    }
+    return !frames.empty();
+}
+
+inline std::string frame_path(const std::string& prefix, int frame)
+{
+    char number[16];
+    std::snprintf(number, sizeof number, "%04d", frame);
+    return prefix + number + ".ppm";
+}
+
+// Renders `frames` to prefix0000.ppm, prefix0001.ppm, ... as a three-stage
+// pipeline. While frame N renders on every core, frame N+1's scene update
+// (object motion and BVH refit) runs on the other scene copy and frame N-1's
+// image is written out, so neither serial step leaves the cores idle between
+// frames. Each frame's report is printed once its image is on disk.
+inline void render_sequence(const std::vector<int>& frames,
+    const std::function<std::unique_ptr<animated_scene>()>& create_scene,
+    const render_settings& settings, const std::string& output_prefix)
+{
+    using clock = std::chrono::steady_clock;
+    auto milliseconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    struct frame_stage
+    {
+        bvh_update_report bvh;
+        double update_ms{ 0 };
+        double render_ms{ 0 };
+        double encode_ms{ 0 };
+    };
+
+    if (frames.empty())
+        return;
+
+    std::unique_ptr<animated_scene> scenes[2] = { create_scene(), create_scene() };
+    frame_image images[2];
+    frame_stage stages[2];   // per image, until its report is printed
+    frame_stage updated[2];  // per scene, filled in by its update
+    std::future<void> updates[2];
+    std::future<void> encodes[2];
+    int encoding_frame[2] = { 0, 0 };
+
+    auto start_update = [&](int slot, int frame) {
+        updates[slot] = std::async(std::launch::async, [&, slot, frame]() {
+            const auto start = clock::now();
+            updated[slot].bvh = scenes[slot]->set_frame(frame);
+            updated[slot].update_ms = milliseconds_since(start);
+        });
+    };
+
+    auto finish_encode = [&](int slot) {
+        if (!encodes[slot].valid())
+            return;
+        encodes[slot].get();
+        const frame_stage& stage = stages[slot];
+        const auto flags = std::cerr.flags();
+        const auto precision = std::cerr.precision(2);
+        std::cerr << std::fixed << "frame " << encoding_frame[slot] << ": update " << stage.update_ms << " ms (" << stage.bvh
+                  << "), render " << stage.render_ms << " ms, encode " << stage.encode_ms << " ms\n";
+        std::cerr.flags(flags);
+        std::cerr.precision(precision);
+    };
+
+    const auto sequence_start = clock::now();
+    start_update(0, frames[0]);
+    for (size_t n = 0; n < frames.size(); ++n)
+    {
+        const int slot = static_cast<int>(n % 2);
+        updates[slot].get();
+
+        // The other scene copy rendered frame N-1, which is done, so it can
+        // move on to frame N+1 now.
+        const camera base_camera = scenes[slot]->frame_camera();
+        if (n + 1 < frames.size())
+            start_update(slot ^ 1, frames[n + 1]);
+
+        // This slot's image was frame N-2's; it has to be on disk before reuse.
+        finish_encode(slot);
+        stages[slot] = updated[slot];
+
+        camera cam = base_camera;
+        cam.set_image_size(settings.image_width, settings.image_height, settings.samples_per_pixel);
+        const auto render_start = clock::now();
+        render_frame(scenes[slot]->world(), cam, settings, static_cast<std::uint64_t>(frames[n]), images[slot]);
+        stages[slot].render_ms = milliseconds_since(render_start);
+
+        encoding_frame[slot] = frames[n];
+        encodes[slot] = std::async(std::launch::async, [&, slot, path = frame_path(output_prefix, frames[n])]() {
+            const auto start = clock::now();
+            write_ppm(path, images[slot]);
+            stages[slot].encode_ms = milliseconds_since(start);
+        });
+    }
+
+    // Oldest first, so reports stay in frame order.
+    const int last_slot = static_cast<int>((frames.size() - 1) % 2);
+    finish_encode(last_slot ^ 1);
+    finish_encode(last_slot);
+
+    const double total_ms = milliseconds_since(sequence_start);
+    std::cerr << frames.size() << " frames in " << total_ms / 1000.0 << " s ("
+              << 1000.0 * frames.size() / total_ms << " frames/s)\n";
+}
+
+#endif
@@ -3,6 +3,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 
@@ -20,10 +21,52 @@ const double pi = 3.1415926535897932385;
 
 // Utility Functions
 
+// PCG32 (O'Neill 2014). std::rand() is one locked generator shared by every
+// thread, which serializes a parallel render and makes its output depend on
+// scheduling; this one is per thread and can be reseeded per pixel.
+class pcg32
+{
+public:
+    void seed(std::uint64_t seed, std::uint64_t sequence = 0)
+    {
+        state = 0;
+        increment = (sequence << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    std::uint32_t next()
+    {
+        const std::uint64_t old_state = state;
+        state = old_state * 6364136223846793005ull + increment;
+        const auto xorshifted = static_cast<std::uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+        const auto rotation = static_cast<std::uint32_t>(old_state >> 59u);
+        return (xorshifted >> rotation) | (xorshifted << ((0u - rotation) & 31u));
+    }
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::uint64_t state{ 0x853c49e6748fea9bull };
+    std::uint64_t increment{ 0xda3e39cb94b95bdbull };
+};
+
+inline pcg32& thread_random()
+{
+    thread_local pcg32 generator;
+    return generator;
+}
+
+// Restarts the calling thread's random_double() sequence.
+inline void seed_random(std::uint64_t seed, std::uint64_t sequence = 0)
+{
+    thread_random().seed(seed, sequence);
+}
+
 inline double random_double()
 {
     // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    return thread_random().next() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max)
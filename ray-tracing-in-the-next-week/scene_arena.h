@@ -0,0 +1,278 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <typeinfo>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+#include "hittable.h"
+
+// Per concrete type: how many objects a scene_arena made, and what they cost.
+struct arena_pool_report
+{
+    std::string type;
+    size_t count{ 0 };
+    size_t object_size{ 0 };
+    size_t reserved_bytes{ 0 }; // pool chunks (pooled), or the heap estimate below
+};
+
+struct scene_arena_report
+{
+    bool pooled{ true };
+    std::vector<arena_pool_report> pools;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const scene_arena_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(1);
+    size_t count = 0, bytes = 0;
+    out << std::fixed << (report.pooled ? "arena pools:" : "heap objects (estimated):");
+    for (const auto& pool : report.pools)
+    {
+        out << "\n  " << pool.type << ": " << pool.count << " x " << pool.object_size << " B, "
+            << pool.reserved_bytes / 1024.0 << " KiB";
+        count += pool.count;
+        bytes += pool.reserved_bytes;
+    }
+    out << "\n  total: " << count << " objects, " << bytes / 1024.0 << " KiB";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+// type_info::name() is already readable on MSVC and mangled elsewhere.
+inline std::string readable_type_name(const std::type_info& type)
+{
+#if defined(__GNUG__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    if (status == 0 && demangled)
+    {
+        std::string name(demangled);
+        std::free(demangled);
+        return name;
+    }
+#endif
+    return type.name();
+}
+
+// Where a list of objects lies in memory, visited in list order (for a
+// scene_bvh, leaf order: the order traversal meets them).
+struct object_layout_report
+{
+    size_t objects{ 0 };
+    size_t span_bytes{ 0 };       // lowest to highest object address
+    size_t pages{ 0 };            // distinct 4 KiB pages the objects touch
+    size_t cache_lines{ 0 };      // distinct 64-byte lines the objects touch
+    double same_page_neighbours{ 0 }; // share of list neighbours on the same page
+};
+
+inline std::ostream& operator<<(std::ostream& out, const object_layout_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(1);
+    out << std::fixed << "layout: " << report.objects << " objects over " << report.span_bytes / 1024.0
+        << " KiB, " << report.pages << " pages, " << report.cache_lines << " cache lines, "
+        << 100.0 * report.same_page_neighbours << "% of neighbours on one page";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+inline object_layout_report measure_layout(const std::vector<shared_ptr<hittable>>& objects)
+{
+    object_layout_report report;
+    report.objects = objects.size();
+    if (objects.empty())
+        return report;
+
+    std::unordered_set<std::uintptr_t> pages, lines;
+    std::uintptr_t lowest = UINTPTR_MAX, highest = 0, previous = 0;
+    size_t same_page = 0;
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        // Objects start with their vtable pointer; the first line is the one
+        // every hit() call reads.
+        const auto address = reinterpret_cast<std::uintptr_t>(objects[i].get());
+        pages.insert(address >> 12);
+        lines.insert(address >> 6);
+        lowest = std::min(lowest, address);
+        highest = std::max(highest, address);
+        if (i > 0)
+            same_page += (address >> 12) == (previous >> 12);
+        previous = address;
+    }
+    report.span_bytes = highest - lowest;
+    report.pages = pages.size();
+    report.cache_lines = lines.size();
+    report.same_page_neighbours = objects.size() > 1 ? static_cast<double>(same_page) / static_cast<double>(objects.size() - 1) : 0.0;
+    return report;
+}
+
+// Owns a scene's hittables, materials and textures in contiguous pools, one
+// pool per concrete type, and frees them all at once with the scene. make()
+// hands out ordinary shared_ptrs so the rest of the code is unchanged, but
+// they own nothing (no control block, no reference counting): the pools are
+// kept alive by storage(), which the scene holds (hittable_list::storage,
+// scene_bvh::storage). Objects in the pools point at each other freely; owning
+// pointers back into the arena would form a cycle and never free it. A
+// scene_arena is a cheap handle; copies refer to the same pools. Not
+// thread-safe: scenes are built by one thread.
+//
+// scene_arena::heap() makes an arena that allocates every object with
+// make_shared instead, the layout the scenes used before, for comparison.
+class scene_arena
+{
+public:
+    scene_arena() : state(std::make_shared<pools>()) {}
+
+    [[nodiscard]] static scene_arena heap()
+    {
+        scene_arena arena;
+        arena.state->pooled = false;
+        return arena;
+    }
+
+    template <class T, class... Args>
+    shared_ptr<T> make(Args&&... args);
+
+    [[nodiscard]] bool pooled() const { return state->pooled; }
+
+    // Keeps every pooled object alive; the pools go with the last copy.
+    [[nodiscard]] std::shared_ptr<const void> storage() const { return state; }
+
+    [[nodiscard]] scene_arena_report report() const;
+
+    static constexpr size_t chunk_bytes = 64 * 1024;
+
+private:
+    struct pool_base
+    {
+        virtual ~pool_base() = default;
+        const std::type_info* type{ nullptr };
+        std::string name;
+        size_t count{ 0 };
+        size_t object_size{ 0 };
+        size_t reserved_bytes{ 0 };
+    };
+
+    // Chunks filled in order, each twice the size of the last up to
+    // chunk_bytes; objects never move once made.
+    template <class T>
+    struct typed_pool final : pool_base
+    {
+        static constexpr size_t alignment = std::max(alignof(T), size_t{ 64 });
+        static constexpr size_t first_chunk = 16;
+        static constexpr size_t largest_chunk = std::max(chunk_bytes / sizeof(T), first_chunk);
+
+        struct chunk
+        {
+            T* objects;
+            size_t capacity;
+            size_t used;
+        };
+
+        ~typed_pool() override
+        {
+            for (size_t c = chunks.size(); c-- > 0;)
+            {
+                for (size_t i = chunks[c].used; i-- > 0;)
+                    chunks[c].objects[i].~T();
+                ::operator delete(chunks[c].objects, std::align_val_t(alignment));
+            }
+        }
+
+        // A slot for the next object; commit() once it is constructed.
+        T* allocate()
+        {
+            if (chunks.empty() || chunks.back().used == chunks.back().capacity)
+            {
+                const size_t capacity = chunks.empty() ? first_chunk : std::min(2 * chunks.back().capacity, largest_chunk);
+                chunks.push_back({ static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(alignment))),
+                    capacity, 0 });
+                reserved_bytes += capacity * sizeof(T);
+            }
+            return chunks.back().objects + chunks.back().used;
+        }
+
+        void commit()
+        {
+            ++chunks.back().used;
+            ++count;
+        }
+
+        std::vector<chunk> chunks;
+    };
+
+    struct pools
+    {
+        bool pooled{ true };
+        std::vector<std::unique_ptr<pool_base>> by_type; // in order of first use
+    };
+
+    template <class T>
+    typed_pool<T>& pool_for();
+
+    std::shared_ptr<pools> state;
+};
+
+template <class T>
+scene_arena::typed_pool<T>& scene_arena::pool_for()
+{
+    for (const auto& pool : state->by_type)
+    {
+        if (*pool->type == typeid(T))
+            return static_cast<typed_pool<T>&>(*pool);
+    }
+    auto pool = std::make_unique<typed_pool<T>>();
+    pool->type = &typeid(T);
+    pool->name = readable_type_name(typeid(T));
+    pool->object_size = sizeof(T);
+    state->by_type.push_back(std::move(pool));
+    return static_cast<typed_pool<T>&>(*state->by_type.back());
+}
+
+template <class T, class... Args>
+shared_ptr<T> scene_arena::make(Args&&... args)
+{
+    auto& pool = pool_for<T>();
+    if (!state->pooled)
+    {
+        // make_shared's one allocation: the object, a control block (two
+        // counts and a vtable pointer) and, typically, a 16-byte malloc header.
+        ++pool.count;
+        pool.reserved_bytes += (sizeof(T) + 16 + 16 + 15) / 16 * 16;
+        return make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    T* object = pool.allocate();
+    ::new (static_cast<void*>(object)) T(std::forward<Args>(args)...);
+    pool.commit(); // only once constructed, so the destructor never sees a half-made object
+    return shared_ptr<T>(shared_ptr<void>(), object);
+}
+
+inline scene_arena_report scene_arena::report() const
+{
+    scene_arena_report report;
+    report.pooled = state->pooled;
+    for (const auto& pool : state->by_type)
+        report.pools.push_back({ pool->name, pool->count, pool->object_size, pool->reserved_bytes });
+    return report;
+}
+
+#endif
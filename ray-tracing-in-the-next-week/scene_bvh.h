@@ -0,0 +1,276 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "bvh_cache.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "parallel.h"
+#include "quantized_bvh.h"
+
+// What scene_bvh::update() did for one frame, and how long each step took.
+struct bvh_update_report
+{
+    bool rebuilt{ false };
+    double bounds_ms{ 0 };  // querying the objects' new bounding boxes
+    double refit_ms{ 0 };
+    double rebuild_ms{ 0 };
+    double built_sah{ 0 };  // SAH cost right after the last full build
+    double refit_sah{ 0 };  // SAH cost of the refit tree
+};
+
+inline std::ostream& operator<<(std::ostream& out, const bvh_update_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(2);
+    out << std::fixed << "bvh: bounds " << report.bounds_ms << " ms, refit " << report.refit_ms
+        << " ms, sah " << report.refit_sah << " (built " << report.built_sah << ")";
+    if (report.rebuilt)
+        out << ", rebuilt in " << report.rebuild_ms << " ms";
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+// Top-level acceleration structure: a flat_bvh over whole hittables, usually
+// instances of shared bottom-level geometry (meshes, BVHs) plus loose
+// primitives such as the spheres of random_scene(). Objects are stored in
+// leaf order so a leaf is a contiguous run of the objects array. When the
+// shutter is open (time0 < time1) and anything moves, nodes carry bounds at
+// both ends of the shutter (flat_bvh::build_motion). With a quantized
+// build_options.node_format, rays traverse a quantized_bvh copy instead; the
+// flat_bvh stays for refitting.
+class scene_bvh final : public hittable
+{
+public:
+    scene_bvh() = default;
+    scene_bvh(const hittable_list& list, double time0, double time1, const bvh_build_options& options = {})
+        : scene_bvh(list.hit_objects, time0, time1, options)
+    {
+        storage = list.storage;
+    }
+    scene_bvh(const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+        const bvh_build_options& options = {});
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
+    // Brings the tree up to date after objects moved (new moving_sphere
+    // centers, new instance transforms) without changing which objects exist.
+    // Refits in place, and rebuilds only if the refit tree's SAH cost has
+    // degraded past rebuild_threshold times the cost of the last build.
+    bvh_update_report update(double time0, double time1);
+
+    void rebuild(double time0, double time1);
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::vector<shared_ptr<hittable>> objects;
+    flat_bvh bvh;
+    quantized_bvh compact;
+    double rebuild_threshold{ 1.5 };
+    double built_sah{ 0 };
+    bvh_build_options build_options; // for the first build and every rebuild
+    std::shared_ptr<const void> storage; // the list's scene_arena, if any
+
+private:
+    void gather_boxes(double time0, double time1);
+    void build_from_boxes(bool cached);
+
+    // Per object, in objects order: bounds at shutter open, or over the whole
+    // shutter for a static tree, and bounds at shutter close for a motion tree.
+    std::vector<aabb> boxes;
+    std::vector<aabb> close_boxes;
+    double shutter_open{ 0 };
+    double shutter_close{ 0 };
+};
+
+inline scene_bvh::scene_bvh(const std::vector<shared_ptr<hittable>>& src_objects, double time0, double time1,
+    const bvh_build_options& options)
+    : objects(src_objects), build_options(options)
+{
+    // Only the initial build goes through the BVH cache: rebuilds during
+    // animation would fill it with trees no later run asks for.
+    gather_boxes(time0, time1);
+    build_from_boxes(true);
+}
+
+inline void scene_bvh::gather_boxes(double time0, double time1)
+{
+    shutter_open = time0;
+    shutter_close = time1;
+    const bool shutter = time1 > time0;
+    boxes.resize(objects.size());
+    close_boxes.resize(shutter ? objects.size() : 0);
+
+    std::atomic<bool> moving{ false };
+    parallel_for((objects.size() + 4095) / 4096, [&](size_t block) {
+        const size_t end = std::min(objects.size(), (block + 1) * 4096);
+        bool block_moving = false;
+        for (size_t i = block * 4096; i < end; ++i)
+        {
+            bool ok = shutter ? objects[i]->bounding_box(time0, time0, boxes[i])
+                                && objects[i]->bounding_box(time1, time1, close_boxes[i])
+                              : objects[i]->bounding_box(time0, time1, boxes[i]);
+            if (!ok)
+                std::cerr << "No bounding box in scene_bvh.\n";
+            for (int a = 0; a < 3 && shutter; ++a)
+            {
+                if (boxes[i].minimum.e[a] != close_boxes[i].minimum.e[a] || boxes[i].maximum.e[a] != close_boxes[i].maximum.e[a])
+                    block_moving = true;
+            }
+        }
+        if (block_moving)
+            moving = true;
+    });
+
+    // Nothing moves: a plain tree is as tight and cheaper to traverse.
+    if (shutter && !moving)
+        close_boxes.clear();
+}
+
+inline void scene_bvh::rebuild(double time0, double time1)
+{
+    gather_boxes(time0, time1);
+    build_from_boxes(false);
+}
+
+inline void scene_bvh::build_from_boxes(bool cached)
+{
+    if (cached)
+    {
+        if (close_boxes.empty())
+            bvh_cache::global().build(bvh, boxes, build_options);
+        else
+            bvh_cache::global().build_motion(bvh, boxes, close_boxes, shutter_open, shutter_close, build_options);
+    }
+    else if (close_boxes.empty())
+        bvh.build(boxes, build_options);
+    else
+        bvh.build_motion(boxes, close_boxes, shutter_open, shutter_close, build_options);
+
+    // Store objects (and their boxes) in leaf order.
+    std::vector<shared_ptr<hittable>> ordered_objects;
+    std::vector<aabb> ordered_boxes, ordered_close_boxes;
+    ordered_objects.reserve(objects.size());
+    ordered_boxes.reserve(objects.size());
+    ordered_close_boxes.reserve(close_boxes.size());
+    for (const std::uint32_t index : bvh.primitive_indices)
+    {
+        ordered_objects.push_back(std::move(objects[index]));
+        ordered_boxes.push_back(boxes[index]);
+        if (!close_boxes.empty())
+            ordered_close_boxes.push_back(close_boxes[index]);
+    }
+    objects = std::move(ordered_objects);
+    boxes = std::move(ordered_boxes);
+    close_boxes = std::move(ordered_close_boxes);
+    for (std::uint32_t i = 0; i < bvh.primitive_indices.size(); ++i)
+        bvh.primitive_indices[i] = i;
+
+    built_sah = bvh.sah_cost();
+    compact.build(bvh, build_options.node_format);
+}
+
+inline bvh_update_report scene_bvh::update(double time0, double time1)
+{
+    using clock = std::chrono::steady_clock;
+    auto milliseconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    bvh_update_report report;
+    report.built_sah = built_sah;
+
+    auto start = clock::now();
+    gather_boxes(time0, time1);
+    report.bounds_ms = milliseconds_since(start);
+
+    auto leaf_bounds = [](const std::vector<aabb>& leaf_boxes) {
+        return [&leaf_boxes](std::uint32_t first, std::uint32_t count) {
+            aabb box = leaf_boxes[first];
+            for (std::uint32_t i = first + 1; i < first + count; ++i)
+                grow(box, leaf_boxes[i]);
+            return box;
+        };
+    };
+
+    // Objects that start or stop moving change the kind of tree needed.
+    const bool needs_rebuild = close_boxes.empty() == bvh.has_motion();
+
+    start = clock::now();
+    if (!needs_rebuild)
+    {
+        if (bvh.has_motion())
+        {
+            bvh.set_shutter(time0, time1);
+            bvh.refit_motion(leaf_bounds(boxes), leaf_bounds(close_boxes));
+        }
+        else
+            bvh.refit(leaf_bounds(boxes));
+        report.refit_sah = bvh.sah_cost();
+        compact.build(bvh, build_options.node_format);
+    }
+    report.refit_ms = milliseconds_since(start);
+
+    if (needs_rebuild || report.refit_sah > rebuild_threshold * built_sah)
+    {
+        start = clock::now();
+        build_from_boxes(false);
+        report.rebuilt = true;
+        report.rebuild_ms = milliseconds_since(start);
+    }
+    return report;
+}
+
+inline bool scene_bvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    auto hit_leaf = [&](std::uint32_t first, std::uint32_t count, double& closest) {
+        bool hit_any = false;
+        for (std::uint32_t i = first; i < first + count; ++i)
+        {
+            if (objects[i]->hit(r, t_min, closest, rec))
+            {
+                closest = rec.t_of_ray;
+                hit_any = true;
+            }
+        }
+        return hit_any;
+    };
+    return compact.empty() ? bvh.traverse(r, t_min, t_max, hit_leaf) : compact.traverse(r, t_min, t_max, hit_leaf);
+}
+
+inline bool scene_bvh::occluded(const ray& r, double t_min, double t_max) const
+{
+    // The first blocker ends the traversal: a limit below t_min stops the
+    // flat traversal outright and fails every box still on the quantized stack.
+    auto blocked_leaf = [&](std::uint32_t first, std::uint32_t count, double& limit) {
+        for (std::uint32_t i = first; i < first + count; ++i)
+        {
+            if (objects[i]->occluded(r, t_min, limit))
+            {
+                limit = -infinity;
+                return true;
+            }
+        }
+        return false;
+    };
+    return compact.empty() ? bvh.traverse(r, t_min, t_max, blocked_leaf) : compact.traverse(r, t_min, t_max, blocked_leaf);
+}
+
+inline bool scene_bvh::bounding_box(double time0, double time1, aabb& output_box) const
+{
+    if (bvh.empty())
+        return false;
+    output_box = bvh.bounds();
+    return true;
+}
+
+#endif
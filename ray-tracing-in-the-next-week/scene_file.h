@@ -0,0 +1,682 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "image_texture.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "scene_bvh.h"
+#include "sphere.h"
+#include "sphere_array.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+// Binary scene files (.rts). A header and a section table are followed by
+// sections of fixed-size plain records, each 64-byte aligned, so loading is
+// a memory mapping plus pointer casts: spheres are read in place by a
+// sphere_array, mesh buffers are copied once, and only the few textures and
+// materials become objects. The file may also carry the sphere BVH, which is
+// then taken as is instead of being rebuilt. Records are in host byte order.
+namespace scene_file {
+
+constexpr char magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '1' };
+constexpr std::uint32_t version = 1;
+constexpr std::uint32_t no_index = ~0u;
+
+enum class section_kind : std::uint32_t
+{
+    textures = 1,
+    materials,
+    spheres,
+    mesh_vertices,
+    mesh_indices,
+    meshes,
+    instances,
+    camera,
+    perlin_tables,
+    strings,
+    sphere_bvh_info,
+    sphere_bvh_nodes,
+    sphere_bvh_end_boxes,
+    sphere_bvh_indices,
+};
+
+struct file_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t section_count;
+};
+
+struct section_entry
+{
+    section_kind kind;
+    std::uint32_t record_size;
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+enum class texture_type : std::uint32_t { solid, checker, noise, image };
+
+struct texture_record
+{
+    texture_type type;
+    std::uint32_t a; // checker: even texture; noise: perlin table; image: string offset
+    std::uint32_t b; // checker: odd texture; image: string length
+    std::uint32_t padding;
+    double color[3];
+    double scale;
+};
+
+enum class material_type : std::uint32_t { lambertian, metal, dielectric };
+
+struct material_record
+{
+    material_type type;
+    std::uint32_t texture; // lambertian: texture index, or no_index for a plain color
+    double color[3];       // lambertian color or metal albedo
+    double fuzz;
+    double refraction_index;
+};
+
+struct mesh_record
+{
+    std::uint64_t first_vertex;
+    std::uint64_t vertex_count;
+    std::uint64_t first_index;
+    std::uint64_t index_count;
+    std::uint32_t material;
+    std::uint32_t padding;
+};
+
+struct instance_record
+{
+    double object_to_world[3][4];
+    std::uint32_t mesh;
+    std::uint32_t padding;
+};
+
+struct camera_record
+{
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double vertical_fov;
+    double aspect_ratio;
+    double aperture;
+    double focus_distance;
+    double time0;
+    double time1;
+};
+
+struct perlin_record
+{
+    float gradients[perlin::point_count][4];
+    std::uint8_t perm[2 * perlin::point_count];
+};
+
+struct sphere_bvh_info_record
+{
+    double shutter_open;
+    double shutter_close;
+    std::uint32_t has_motion;
+    std::uint32_t padding;
+};
+
+inline camera make_camera(const camera_record& c)
+{
+    return camera(point3(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]), point3(c.lookat[0], c.lookat[1], c.lookat[2]),
+        vec3(c.vup[0], c.vup[1], c.vup[2]), c.vertical_fov, c.aspect_ratio, c.aperture, c.focus_distance, c.time0, c.time1);
+}
+
+// ---------------------------------------------------------------------------
+// Export
+
+class writer
+{
+public:
+    bool add_object(const shared_ptr<hittable>& object);
+    bool write(const std::string& path, const camera_record& view, bool include_bvh);
+
+private:
+    std::uint32_t add_texture(const shared_ptr<texture>& t);
+    std::uint32_t add_material(const shared_ptr<material>& m);
+    std::uint32_t add_mesh(const triangle_mesh& mesh);
+
+    std::vector<texture_record> textures;
+    std::vector<material_record> materials;
+    std::vector<sphere_record> spheres;
+    std::vector<mesh_vertex> vertices;
+    std::vector<std::uint32_t> indices;
+    std::vector<mesh_record> meshes;
+    std::vector<instance_record> instances;
+    std::vector<perlin_record> perlin_tables;
+    std::string strings;
+
+    std::map<const texture*, std::uint32_t> texture_ids;
+    std::map<const material*, std::uint32_t> material_ids;
+    std::map<const triangle_mesh*, std::uint32_t> mesh_ids;
+};
+
+inline std::uint32_t writer::add_texture(const shared_ptr<texture>& t)
+{
+    if (const auto found = texture_ids.find(t.get()); found != texture_ids.end())
+        return found->second;
+
+    texture_record record{};
+    if (const auto checker = std::dynamic_pointer_cast<checker_texture>(t))
+    {
+        record.type = texture_type::checker;
+        record.a = add_texture(checker->even);
+        record.b = add_texture(checker->odd);
+    }
+    else if (const auto noise = std::dynamic_pointer_cast<noise_texture>(t))
+    {
+        record.type = texture_type::noise;
+        record.a = static_cast<std::uint32_t>(perlin_tables.size());
+        record.scale = noise->scale;
+        perlin_record tables{};
+        std::memcpy(tables.gradients, noise->noise.gradients, sizeof tables.gradients);
+        std::memcpy(tables.perm, noise->noise.perm, sizeof tables.perm);
+        perlin_tables.push_back(tables);
+    }
+    else if (const auto image = std::dynamic_pointer_cast<image_texture>(t))
+    {
+        record.type = texture_type::image;
+        record.a = static_cast<std::uint32_t>(strings.size());
+        record.b = static_cast<std::uint32_t>(image->path.size());
+        strings += image->path;
+    }
+    else
+    {
+        // Solid colors, and any other texture baked to its color at the origin.
+        record.type = texture_type::solid;
+        const color c = t->value(0, 0, point3(0, 0, 0));
+        for (int a = 0; a < 3; ++a)
+            record.color[a] = c[a];
+    }
+
+    const auto id = static_cast<std::uint32_t>(textures.size());
+    textures.push_back(record);
+    texture_ids.emplace(t.get(), id);
+    return id;
+}
+
+inline std::uint32_t writer::add_material(const shared_ptr<material>& m)
+{
+    if (const auto found = material_ids.find(m.get()); found != material_ids.end())
+        return found->second;
+
+    material_record record{};
+    record.texture = no_index;
+    if (const auto diffuse = std::dynamic_pointer_cast<lambertian>(m))
+    {
+        record.type = material_type::lambertian;
+        if (diffuse->albedo.source)
+            record.texture = add_texture(diffuse->albedo.source);
+        for (int a = 0; a < 3; ++a)
+            record.color[a] = diffuse->albedo.constant_value[a];
+    }
+    else if (const auto shiny = std::dynamic_pointer_cast<metal>(m))
+    {
+        record.type = material_type::metal;
+        for (int a = 0; a < 3; ++a)
+            record.color[a] = shiny->albedo[a];
+        record.fuzz = shiny->fuzziness;
+    }
+    else if (const auto glass = std::dynamic_pointer_cast<dielectric>(m))
+    {
+        record.type = material_type::dielectric;
+        record.refraction_index = glass->refraction_index;
+    }
+    else
+    {
+        std::cerr << "ERROR: Scene export does not support this material type.\n";
+        return no_index;
+    }
+
+    const auto id = static_cast<std::uint32_t>(materials.size());
+    materials.push_back(record);
+    material_ids.emplace(m.get(), id);
+    return id;
+}
+
+inline std::uint32_t writer::add_mesh(const triangle_mesh& mesh)
+{
+    if (const auto found = mesh_ids.find(&mesh); found != mesh_ids.end())
+        return found->second;
+
+    const std::uint32_t material = add_material(mesh.mat_ptr);
+    if (material == no_index)
+        return no_index;
+
+    mesh_record record{ vertices.size(), mesh.vertices.size(), indices.size(), mesh.indices.size(), material, 0 };
+    vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+    indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+    const auto id = static_cast<std::uint32_t>(meshes.size());
+    meshes.push_back(record);
+    mesh_ids.emplace(&mesh, id);
+    return id;
+}
+
+inline bool writer::add_object(const shared_ptr<hittable>& object)
+{
+    if (const auto list = std::dynamic_pointer_cast<hittable_list>(object))
+    {
+        for (const auto& child : list->hit_objects)
+        {
+            if (!add_object(child))
+                return false;
+        }
+        return true;
+    }
+
+    if (const auto ball = std::dynamic_pointer_cast<sphere>(object))
+    {
+        sphere_record record{};
+        for (int a = 0; a < 3; ++a)
+            record.center[a] = ball->center[a];
+        record.radius = ball->radius;
+        record.material = add_material(ball->object_material);
+        spheres.push_back(record);
+        return record.material != no_index;
+    }
+
+    if (const auto mover = std::dynamic_pointer_cast<moving_sphere>(object))
+    {
+        sphere_record record{};
+        for (int a = 0; a < 3; ++a)
+        {
+            record.center[a] = mover->center0[a];
+            record.motion[a] = mover->center1[a] - mover->center0[a];
+        }
+        record.radius = mover->radius;
+        record.time0 = mover->time0;
+        record.time1 = mover->time1;
+        record.flags = sphere_record_moving;
+        record.material = add_material(mover->mat_ptr);
+        spheres.push_back(record);
+        return record.material != no_index;
+    }
+
+    const triangle_mesh* mesh = nullptr;
+    affine_transform object_to_world;
+    if (const auto placed = std::dynamic_pointer_cast<instance>(object))
+    {
+        mesh = dynamic_cast<const triangle_mesh*>(placed->object_ptr.get());
+        object_to_world = placed->world_to_object.inverse();
+    }
+    else
+        mesh = dynamic_cast<const triangle_mesh*>(object.get());
+
+    if (mesh == nullptr)
+    {
+        std::cerr << "ERROR: Scene export supports spheres, moving spheres, triangle meshes and mesh instances only.\n";
+        return false;
+    }
+
+    instance_record record{};
+    std::memcpy(record.object_to_world, object_to_world.m, sizeof record.object_to_world);
+    record.mesh = add_mesh(*mesh);
+    instances.push_back(record);
+    return record.mesh != no_index;
+}
+
+inline bool writer::write(const std::string& path, const camera_record& view, bool include_bvh)
+{
+    // The sphere BVH is built here and the spheres written in its leaf order,
+    // so the loader's primitive indices are the identity.
+    sphere_array ordered(spheres, {});
+    if (include_bvh && !spheres.empty())
+    {
+        ordered.build_bvh();
+        std::vector<sphere_record> leaf_order;
+        leaf_order.reserve(spheres.size());
+        for (const std::uint32_t index : ordered.bvh.primitive_indices)
+            leaf_order.push_back(spheres[index]);
+        spheres = std::move(leaf_order);
+        for (std::uint32_t i = 0; i < ordered.bvh.primitive_indices.size(); ++i)
+            ordered.bvh.primitive_indices[i] = i;
+    }
+    const flat_bvh& bvh = ordered.bvh;
+    const sphere_bvh_info_record bvh_info{ bvh.shutter_open,
+        bvh.has_motion() ? bvh.shutter_open + 1.0 / bvh.inverse_shutter_length : bvh.shutter_open,
+        bvh.has_motion() ? 1u : 0u, 0 };
+
+    struct pending_section
+    {
+        section_kind kind;
+        std::uint32_t record_size;
+        const void* data;
+        std::uint64_t count;
+    };
+    std::vector<pending_section> sections = {
+        { section_kind::camera, sizeof(camera_record), &view, 1 },
+        { section_kind::textures, sizeof(texture_record), textures.data(), textures.size() },
+        { section_kind::materials, sizeof(material_record), materials.data(), materials.size() },
+        { section_kind::spheres, sizeof(sphere_record), spheres.data(), spheres.size() },
+        { section_kind::mesh_vertices, sizeof(mesh_vertex), vertices.data(), vertices.size() },
+        { section_kind::mesh_indices, sizeof(std::uint32_t), indices.data(), indices.size() },
+        { section_kind::meshes, sizeof(mesh_record), meshes.data(), meshes.size() },
+        { section_kind::instances, sizeof(instance_record), instances.data(), instances.size() },
+        { section_kind::perlin_tables, sizeof(perlin_record), perlin_tables.data(), perlin_tables.size() },
+        { section_kind::strings, 1, strings.data(), strings.size() },
+    };
+    if (!bvh.empty())
+    {
+        sections.push_back({ section_kind::sphere_bvh_info, sizeof(sphere_bvh_info_record), &bvh_info, 1 });
+        sections.push_back({ section_kind::sphere_bvh_nodes, sizeof(flat_bvh_node), bvh.nodes.data(), bvh.nodes.size() });
+        sections.push_back({ section_kind::sphere_bvh_indices, sizeof(std::uint32_t), bvh.primitive_indices.data(), bvh.primitive_indices.size() });
+        if (bvh.has_motion())
+            sections.push_back({ section_kind::sphere_bvh_end_boxes, sizeof(aabb), bvh.end_boxes.data(), bvh.end_boxes.size() });
+    }
+
+    auto align = [](std::uint64_t offset) { return (offset + 63) & ~std::uint64_t{ 63 }; };
+    file_header header{};
+    std::memcpy(header.magic, magic, sizeof header.magic);
+    header.version = version;
+    header.section_count = static_cast<std::uint32_t>(sections.size());
+
+    std::vector<section_entry> table;
+    std::uint64_t offset = align(sizeof header + sections.size() * sizeof(section_entry));
+    for (const auto& s : sections)
+    {
+        table.push_back({ s.kind, s.record_size, offset, s.count });
+        offset = align(offset + s.record_size * s.count);
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write scene file '" << path << "'.\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof header);
+    out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(section_entry)));
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        const std::uint64_t position = static_cast<std::uint64_t>(out.tellp());
+        const std::vector<char> padding(table[i].offset - position, 0);
+        out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        out.write(static_cast<const char*>(sections[i].data), static_cast<std::streamsize>(sections[i].record_size * sections[i].count));
+    }
+    return static_cast<bool>(out);
+}
+
+// Writes every object of `world` (spheres, moving spheres, triangle meshes and
+// instances of meshes, through nested hittable_lists) and the camera.
+inline bool export_scene(const std::string& path, const hittable_list& world, const camera_record& view,
+    bool include_bvh = true)
+{
+    writer w;
+    for (const auto& object : world.hit_objects)
+    {
+        if (!w.add_object(object))
+            return false;
+    }
+    return w.write(path, view, include_bvh);
+}
+
+// ---------------------------------------------------------------------------
+// Load
+
+struct load_report
+{
+    double map_ms{ 0 };
+    double materials_ms{ 0 };
+    double spheres_ms{ 0 };   // sphere BVH, built or taken from the file
+    double meshes_ms{ 0 };    // mesh copies and their BVH builds
+    double top_level_ms{ 0 };
+    double total_ms{ 0 };
+    size_t sphere_count{ 0 };
+    size_t triangle_count{ 0 };
+    size_t instance_count{ 0 };
+    bool prebuilt_bvh{ false };
+    size_t sphere_bvh_bytes{ 0 }; // node data of the sphere BVH as traversed
+    bool quantized_bvh{ false };
+};
+
+inline std::ostream& operator<<(std::ostream& out, const load_report& report)
+{
+    const auto flags = out.flags();
+    const auto precision = out.precision(2);
+    out << std::fixed << "scene: " << report.sphere_count << " spheres, " << report.triangle_count << " triangles, "
+        << report.instance_count << " instances loaded in " << report.total_ms << " ms (map " << report.map_ms
+        << ", materials " << report.materials_ms << ", spheres " << report.spheres_ms
+        << (report.prebuilt_bvh ? " with stored BVH" : " without stored BVH") << ", meshes " << report.meshes_ms
+        << ", top level " << report.top_level_ms << ")";
+    if (report.sphere_count > 0)
+        out << ", sphere BVH " << report.sphere_bvh_bytes / (1024.0 * 1024.0) << " MiB"
+            << (report.quantized_bvh ? " quantized" : "");
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+
+struct loaded_scene
+{
+    camera_record view{};
+    scene_bvh world;
+    load_report report;
+};
+
+template <typename Record>
+const Record* section_data(const mapped_file& file, const std::vector<section_entry>& table, section_kind kind,
+    std::uint64_t& count)
+{
+    count = 0;
+    for (const auto& entry : table)
+    {
+        if (entry.kind != kind)
+            continue;
+        if (entry.record_size != sizeof(Record) || entry.offset % alignof(Record) != 0
+            || entry.offset > file.size() || entry.count > (file.size() - entry.offset) / sizeof(Record))
+            return nullptr;
+        count = entry.count;
+        return reinterpret_cast<const Record*>(file.data() + entry.offset);
+    }
+    return nullptr;
+}
+
+// A quantized `sphere_nodes` format swaps the spheres' BVH for a
+// quantized_bvh once it is built or read.
+inline bool load_scene(const std::string& path, loaded_scene& scene,
+    bvh_node_format sphere_nodes = bvh_node_format::full)
+{
+    using clock = std::chrono::steady_clock;
+    auto milliseconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    auto fail = [&](const char* what) {
+        std::cerr << "ERROR: Scene file '" << path << "' " << what << ".\n";
+        return false;
+    };
+
+    const auto load_start = clock::now();
+    auto start = load_start;
+    auto file = std::make_shared<mapped_file>();
+    if (!file->open(path))
+        return fail("could not be opened");
+
+    file_header header{};
+    if (file->size() < sizeof header)
+        return fail("is truncated");
+    std::memcpy(&header, file->data(), sizeof header);
+    if (std::memcmp(header.magic, magic, sizeof header.magic) != 0 || header.version != version)
+        return fail("is not a version 1 scene file");
+    if (file->size() < sizeof header + header.section_count * sizeof(section_entry))
+        return fail("is truncated");
+    std::vector<section_entry> table(header.section_count);
+    std::memcpy(table.data(), file->data() + sizeof header, table.size() * sizeof(section_entry));
+    scene.report = {};
+    scene.report.map_ms = milliseconds_since(start);
+
+    std::uint64_t camera_count, texture_count, material_count, sphere_count, vertex_count, index_count;
+    std::uint64_t mesh_count, instance_count, perlin_count, string_count;
+    const auto* camera_records = section_data<camera_record>(*file, table, section_kind::camera, camera_count);
+    const auto* texture_records = section_data<texture_record>(*file, table, section_kind::textures, texture_count);
+    const auto* material_records = section_data<material_record>(*file, table, section_kind::materials, material_count);
+    const auto* sphere_records = section_data<sphere_record>(*file, table, section_kind::spheres, sphere_count);
+    const auto* vertex_records = section_data<mesh_vertex>(*file, table, section_kind::mesh_vertices, vertex_count);
+    const auto* index_records = section_data<std::uint32_t>(*file, table, section_kind::mesh_indices, index_count);
+    const auto* mesh_records = section_data<mesh_record>(*file, table, section_kind::meshes, mesh_count);
+    const auto* instance_records = section_data<instance_record>(*file, table, section_kind::instances, instance_count);
+    const auto* perlin_records = section_data<perlin_record>(*file, table, section_kind::perlin_tables, perlin_count);
+    const auto* string_data = section_data<char>(*file, table, section_kind::strings, string_count);
+    if (camera_count != 1)
+        return fail("has no camera");
+    scene.view = camera_records[0];
+
+    // Textures and materials: the only records that become objects one by one.
+    // Checker children always come before their parent.
+    start = clock::now();
+    std::vector<shared_ptr<texture>> textures(texture_count);
+    for (std::uint64_t i = 0; i < texture_count; ++i)
+    {
+        const texture_record& t = texture_records[i];
+        switch (t.type)
+        {
+        case texture_type::solid:
+            textures[i] = make_shared<solid_color>(color(t.color[0], t.color[1], t.color[2]));
+            break;
+        case texture_type::checker:
+            if (t.a >= i || t.b >= i)
+                return fail("has a bad texture reference");
+            textures[i] = make_shared<checker_texture>(textures[t.a], textures[t.b]);
+            break;
+        case texture_type::noise:
+        {
+            if (t.a >= perlin_count)
+                return fail("has a bad noise table reference");
+            auto noise = make_shared<noise_texture>(t.scale);
+            std::memcpy(noise->noise.gradients, perlin_records[t.a].gradients, sizeof noise->noise.gradients);
+            std::memcpy(noise->noise.perm, perlin_records[t.a].perm, sizeof noise->noise.perm);
+            textures[i] = noise;
+            break;
+        }
+        case texture_type::image:
+            if (static_cast<std::uint64_t>(t.a) + t.b > string_count)
+                return fail("has a bad image path");
+            textures[i] = make_shared<image_texture>(std::string(string_data + t.a, t.b));
+            break;
+        default:
+            return fail("has an unknown texture type");
+        }
+    }
+
+    std::vector<shared_ptr<material>> materials(material_count);
+    for (std::uint64_t i = 0; i < material_count; ++i)
+    {
+        const material_record& m = material_records[i];
+        const color c(m.color[0], m.color[1], m.color[2]);
+        switch (m.type)
+        {
+        case material_type::lambertian:
+            if (m.texture != no_index && m.texture >= texture_count)
+                return fail("has a bad material texture");
+            materials[i] = m.texture == no_index ? make_shared<lambertian>(c) : make_shared<lambertian>(textures[m.texture]);
+            break;
+        case material_type::metal:
+            materials[i] = make_shared<metal>(c, m.fuzz);
+            break;
+        case material_type::dielectric:
+            materials[i] = make_shared<dielectric>(m.refraction_index);
+            break;
+        default:
+            return fail("has an unknown material type");
+        }
+    }
+    scene.report.materials_ms = milliseconds_since(start);
+
+    // Spheres stay in the mapping; the sphere_array holds on to the file.
+    start = clock::now();
+    std::vector<shared_ptr<hittable>> objects;
+    for (std::uint64_t i = 0; i < sphere_count; ++i)
+    {
+        if (sphere_records[i].material >= material_count)
+            return fail("has a bad sphere material");
+    }
+    if (sphere_count > 0)
+    {
+        auto spheres = make_shared<sphere_array>(sphere_records, sphere_count, materials, file);
+
+        std::uint64_t info_count, node_count, bvh_index_count, end_box_count;
+        const auto* info = section_data<sphere_bvh_info_record>(*file, table, section_kind::sphere_bvh_info, info_count);
+        const auto* nodes = section_data<flat_bvh_node>(*file, table, section_kind::sphere_bvh_nodes, node_count);
+        const auto* bvh_indices = section_data<std::uint32_t>(*file, table, section_kind::sphere_bvh_indices, bvh_index_count);
+        const auto* end_boxes = section_data<aabb>(*file, table, section_kind::sphere_bvh_end_boxes, end_box_count);
+        // A tree that does not fit the spheres is rebuilt rather than trusted.
+        const bool usable = info_count == 1 && node_count > 0 && bvh_index_count == sphere_count
+                            && (info->has_motion == 0 || end_box_count == node_count)
+                            && flat_bvh::valid_layout(nodes, node_count, bvh_indices, bvh_index_count, sphere_count);
+        if (usable)
+        {
+            spheres->bvh.assign(nodes, node_count, bvh_indices, bvh_index_count,
+                info->has_motion ? end_boxes : nullptr, info->shutter_open, info->shutter_close);
+            scene.report.prebuilt_bvh = true;
+        }
+        else
+            spheres->build_bvh();
+        scene.report.quantized_bvh = spheres->compress_bvh(sphere_nodes);
+        scene.report.sphere_bvh_bytes = scene.report.quantized_bvh ? spheres->compact.memory_bytes()
+                                                                   : flat_bvh_memory_bytes(spheres->bvh);
+        objects.push_back(spheres);
+    }
+    scene.report.sphere_count = sphere_count;
+    scene.report.spheres_ms = milliseconds_since(start);
+
+    start = clock::now();
+    std::vector<shared_ptr<triangle_mesh>> meshes(mesh_count);
+    for (std::uint64_t i = 0; i < mesh_count; ++i)
+    {
+        const mesh_record& m = mesh_records[i];
+        if (m.material >= material_count || m.first_vertex + m.vertex_count > vertex_count
+            || m.first_index + m.index_count > index_count)
+            return fail("has a bad mesh record");
+        std::vector<mesh_vertex> mesh_vertices(vertex_records + m.first_vertex, vertex_records + m.first_vertex + m.vertex_count);
+        std::vector<std::uint32_t> mesh_indices(index_records + m.first_index, index_records + m.first_index + m.index_count);
+        for (const std::uint32_t index : mesh_indices)
+        {
+            if (index >= m.vertex_count)
+                return fail("has a mesh index out of range");
+        }
+        meshes[i] = make_shared<triangle_mesh>(std::move(mesh_vertices), std::move(mesh_indices), materials[m.material]);
+        scene.report.triangle_count += meshes[i]->triangle_count();
+    }
+    for (std::uint64_t i = 0; i < instance_count; ++i)
+    {
+        const instance_record& record = instance_records[i];
+        if (record.mesh >= mesh_count)
+            return fail("has a bad instance record");
+        affine_transform object_to_world;
+        std::memcpy(object_to_world.m, record.object_to_world, sizeof object_to_world.m);
+        objects.push_back(make_shared<instance>(meshes[record.mesh], object_to_world));
+    }
+    scene.report.instance_count = instance_count;
+    scene.report.meshes_ms = milliseconds_since(start);
+
+    start = clock::now();
+    scene.world = scene_bvh(objects, scene.view.time0, scene.view.time1);
+    scene.report.top_level_ms = milliseconds_since(start);
+    scene.report.total_ms = milliseconds_since(load_start);
+    return true;
+}
+
+} // namespace scene_file
+
+#endif
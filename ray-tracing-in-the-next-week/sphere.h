@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "render_stats.h"
 #include "vec3.h"
 
 class sphere final : public hittable
@@ -18,6 +19,14 @@ public:
 
 	bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+	// The whole hit test for a sphere given by value, for containers that store
+	// spheres as plain records (sphere_array) rather than as sphere objects.
+	static bool intersect(const point3& center, double radius, const shared_ptr<material>& m,
+		const ray& r, double min_t_of_ray, double max_t_of_ray, hit_record& record);
+
+	// The (u,v) and differentials of a hit, left pending by intersect().
+	static void finish_shading(const ray& r, hit_record& record);
+
 private:
 	static void get_sphere_uv(const point3& p, double& u, double& v)
 	{
@@ -34,6 +43,21 @@ private:
 		v = theta / pi;
 	}
 
+	// (u,v) change per pixel, by mapping the differential hit points back onto the sphere.
+	static void set_uv_differentials(const point3& center, hit_record& record)
+	{
+		auto uv_delta = [&](const vec3& dp, double& du, double& dv) {
+			double u, v;
+			get_sphere_uv(unit_vector(record.hit_point + dp - center), u, v);
+			du = u - record.u;
+			dv = v - record.v;
+			if (du > 0.5) du -= 1.0; // u wraps around at phi = 0
+			if (du < -0.5) du += 1.0;
+		};
+		uv_delta(record.dpdx, record.dudx, record.dvdx);
+		uv_delta(record.dpdy, record.dudy, record.dvdy);
+	}
+
 // ReSharper disable once CppRedundantAccessSpecifier
 public:
 	point3 center;
@@ -43,6 +67,16 @@ public:
 
 inline bool sphere::hit(const ray& r, double min_t_of_ray, double max_t_of_ray, hit_record& record) const
 {
+	if (!intersect(center, radius, object_material, r, min_t_of_ray, max_t_of_ray, record))
+		return false;
+	record.hit_object = this;
+	return true;
+}
+
+inline bool sphere::intersect(const point3& center, double radius, const shared_ptr<material>& m,
+	const ray& r, double min_t_of_ray, double max_t_of_ray, hit_record& record)
+{
+	RT_COUNT(primitive_tests);
 	const vec3 oc = r.origin() - center;
 	const double half_b = dot(oc, r.direction());
 	const double a = r.direction().length_squared();
@@ -70,12 +104,30 @@ inline bool sphere::hit(const ray& r, double min_t_of_ray, double max_t_of_ray,
 
 	const vec3 outward_normal = (record.hit_point - center) / radius;
 	record.set_face_normal(r, outward_normal);
-	get_sphere_uv(outward_normal, record.u, record.v);
-	record.hit_material = object_material;
+	record.hit_material = m.get();
+	record.hit_object = nullptr; // sphere::hit() fills in the sphere; array elements have no object
+
+	record.has_differentials = false;
+	record.shape_center = center;
+	record.shape_radius = radius;
+	record.pending_shading = &finish_shading;
 
 	return true;
 }
 
+inline void sphere::finish_shading(const ray& r, hit_record& record)
+{
+	get_sphere_uv((record.hit_point - record.shape_center) / record.shape_radius, record.u, record.v);
+	if (record.set_differentials(r))
+	{
+		// The outward normal (p - center) / radius moves by dp / radius.
+		const double side = record.is_front_face ? 1.0 : -1.0;
+		record.dndx = side * record.dpdx / record.shape_radius;
+		record.dndy = side * record.dpdy / record.shape_radius;
+		set_uv_differentials(record.shape_center, record);
+	}
+}
+
 inline bool sphere::bounding_box(double time0, double time1, aabb& output_box) const
 {
 	output_box = aabb(
@@ -0,0 +1,179 @@
+#ifndef SPHERE_ARRAY_H
+#define SPHERE_ARRAY_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bvh_cache.h"
+#include "flat_bvh.h"
+#include "hittable.h"
+#include "quantized_bvh.h"
+#include "sphere.h"
+
+// One sphere, static or moving linearly between time0 and time1, as stored in
+// a scene file. Plain data, so a sphere_array can read it where it lies.
+struct sphere_record
+{
+    double center[3]; // at time0
+    double radius;
+    double motion[3]; // center at time1 minus center at time0
+    double time0;
+    double time1;
+    std::uint32_t material;
+    std::uint32_t flags;
+};
+static_assert(sizeof(sphere_record) == 80);
+
+constexpr std::uint32_t sphere_record_moving = 1;
+
+// Many spheres as one hittable: an array of sphere_records (owned, or borrowed
+// from a mapped scene file) and a flat_bvh over them, instead of one heap
+// object and one shared_ptr per sphere. Moving spheres put the tree into
+// motion mode (flat_bvh::build_motion) over [shutter_open, shutter_close].
+// compress_bvh() swaps the tree for a quantized_bvh to save memory.
+class sphere_array final : public hittable
+{
+public:
+    sphere_array(std::vector<sphere_record> records, std::vector<shared_ptr<material>> sphere_materials)
+        : materials(std::move(sphere_materials)), owned(std::move(records))
+    {
+        spheres = owned.data();
+        sphere_count = owned.size();
+    }
+
+    // Reads `count` records at `records` in place; `keep_alive` owns that memory.
+    sphere_array(const sphere_record* records, size_t count, std::vector<shared_ptr<material>> sphere_materials,
+        std::shared_ptr<const void> keep_alive)
+        : spheres(records), sphere_count(count), materials(std::move(sphere_materials)), storage(std::move(keep_alive))
+    {}
+
+    sphere_array(const sphere_array&) = delete;
+    sphere_array& operator=(const sphere_array&) = delete;
+
+    void build_bvh();
+
+    // Replaces the flat_bvh's nodes with a quantized copy in `format`, keeping
+    // its primitive_indices. Returns false and keeps the flat tree if the
+    // format is full or the tree cannot be quantized.
+    bool compress_bvh(bvh_node_format format);
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
+    [[nodiscard]] static point3 center_at(const sphere_record& s, double time)
+    {
+        const point3 center(s.center[0], s.center[1], s.center[2]);
+        if (!(s.flags & sphere_record_moving))
+            return center;
+        return center + ((time - s.time0) / (s.time1 - s.time0)) * vec3(s.motion[0], s.motion[1], s.motion[2]);
+    }
+
+    [[nodiscard]] static aabb box_at(const sphere_record& s, double time)
+    {
+        const point3 center = center_at(s, time);
+        const vec3 extent(s.radius, s.radius, s.radius);
+        return aabb(center - extent, center + extent);
+    }
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    const sphere_record* spheres{ nullptr };
+    size_t sphere_count{ 0 };
+    std::vector<shared_ptr<material>> materials;
+    flat_bvh bvh;
+    quantized_bvh compact;
+
+private:
+    std::vector<sphere_record> owned;
+    std::shared_ptr<const void> storage;
+};
+
+inline void sphere_array::build_bvh()
+{
+    // The shutter spans every moving sphere's own time range.
+    double shutter_open = infinity, shutter_close = -infinity;
+    for (size_t i = 0; i < sphere_count; ++i)
+    {
+        if (spheres[i].flags & sphere_record_moving)
+        {
+            shutter_open = fmin(shutter_open, spheres[i].time0);
+            shutter_close = fmax(shutter_close, spheres[i].time1);
+        }
+    }
+
+    std::vector<aabb> open_boxes(sphere_count);
+    for (size_t i = 0; i < sphere_count; ++i)
+        open_boxes[i] = box_at(spheres[i], shutter_open);
+    if (shutter_open > shutter_close)
+    {
+        bvh_cache::global().build(bvh, open_boxes);
+        return;
+    }
+
+    std::vector<aabb> close_boxes(sphere_count);
+    for (size_t i = 0; i < sphere_count; ++i)
+        close_boxes[i] = box_at(spheres[i], shutter_close);
+    bvh_cache::global().build_motion(bvh, open_boxes, close_boxes, shutter_open, shutter_close);
+}
+
+inline bool sphere_array::compress_bvh(bvh_node_format format)
+{
+    if (!compact.build(bvh, format))
+        return false;
+    bvh.nodes = {};
+    bvh.end_boxes = {};
+    return true;
+}
+
+inline bool sphere_array::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    auto hit_leaf = [&](std::uint32_t first, std::uint32_t count, double& closest) {
+        bool hit_any = false;
+        for (std::uint32_t i = first; i < first + count; ++i)
+        {
+            const sphere_record& s = spheres[bvh.primitive_indices[i]];
+            if (sphere::intersect(center_at(s, r.time()), s.radius, materials[s.material], r, t_min, closest, rec))
+            {
+                closest = rec.t_of_ray;
+                hit_any = true;
+            }
+        }
+        return hit_any;
+    };
+    return compact.empty() ? bvh.traverse(r, t_min, t_max, hit_leaf) : compact.traverse(r, t_min, t_max, hit_leaf);
+}
+
+inline bool sphere_array::occluded(const ray& r, double t_min, double t_max) const
+{
+    hit_record rec;
+    auto blocked_leaf = [&](std::uint32_t first, std::uint32_t count, double& limit) {
+        for (std::uint32_t i = first; i < first + count; ++i)
+        {
+            const sphere_record& s = spheres[bvh.primitive_indices[i]];
+            if (sphere::intersect(center_at(s, r.time()), s.radius, materials[s.material], r, t_min, limit, rec))
+            {
+                limit = -infinity; // any hit will do; ends the traversal
+                return true;
+            }
+        }
+        return false;
+    };
+    return compact.empty() ? bvh.traverse(r, t_min, t_max, blocked_leaf) : compact.traverse(r, t_min, t_max, blocked_leaf);
+}
+
+inline bool sphere_array::bounding_box(double time0, double time1, aabb& output_box) const
+{
+    if (!compact.empty())
+    {
+        output_box = compact.bounds();
+        return true;
+    }
+    if (bvh.empty())
+        return false;
+    output_box = bvh.bounds();
+    return true;
+}
+
+#endif
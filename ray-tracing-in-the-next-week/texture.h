@@ -1,15 +1,143 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <cstdint>
+#include <vector>
+
+#include "perlin.h"
 #include "rtweekend.h"
 
+class texture_program;
+
 class texture
 {
 public:
 	virtual ~texture() = default;
 	virtual color value(double u, double v, const point3& p) const = 0;
+
+    // Lookup averaged over a footprint of the given width in (u,v) space.
+    // Only textures with prefiltered data need to override this.
+    virtual color filtered_value(double u, double v, const point3& p, double footprint) const
+    {
+        return value(u, v, p);
+    }
+
+    // Appends this texture's instructions to the program. Textures that have no
+    // compiled form fall back to a single call back into filtered_value().
+    virtual void compile(texture_program& program) const;
 };
 
+// A texture tree flattened at scene-build time. Instructions are stored in
+// pre-order: a branch's "even" subtree starts right after it and its "odd"
+// subtree starts at `alternate`. Evaluation walks the array without recursion.
+enum class texture_opcode : std::uint8_t
+{
+    constant,       // return value_a
+    checker,        // branch to pc + 1 or to alternate
+    checker_const,  // checker whose both children folded to constants
+    marble,         // noise_texture, evaluated inline through noise
+    call            // fall back to callee->filtered_value()
+};
+
+struct texture_instruction
+{
+    texture_opcode op{ texture_opcode::constant };
+    std::uint32_t alternate{ 0 };
+    color value_a;
+    color value_b;
+    const texture* callee{ nullptr };
+    const perlin* noise{ nullptr };
+    double scale{ 0.0 };
+};
+
+inline color marble_value(const perlin& noise, double scale, const point3& p)
+{
+    return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p)));
+}
+
+// 3D checker parity: the sign of sin(10x)*sin(10y)*sin(10z), computed from
+// the half-period index of each factor instead of three sin() calls.
+inline bool checker_is_odd(const point3& p)
+{
+    const double frequency = 10.0 / pi;
+    const auto cells = static_cast<long long>(std::floor(frequency * p.x()))
+                     + static_cast<long long>(std::floor(frequency * p.y()))
+                     + static_cast<long long>(std::floor(frequency * p.z()));
+    return (cells & 1) != 0;
+}
+
+class texture_program
+{
+public:
+    texture_program() = default;
+
+    // A solid color compiles to no instructions at all.
+    texture_program(const color& c) : constant_value(c) {}
+
+    texture_program(shared_ptr<texture> root) : source(std::move(root))
+    {
+        source->compile(*this);
+        if (code.size() == 1 && code[0].op == texture_opcode::constant)
+        {
+            constant_value = code[0].value_a;
+            code.clear();
+        }
+        code.shrink_to_fit();
+    }
+
+    [[nodiscard]] color value(double u, double v, const point3& p, double footprint = 0.0) const
+    {
+        if (code.empty())
+            return constant_value;
+
+        std::uint32_t pc = 0;
+        while (true)
+        {
+            const texture_instruction& instruction = code[pc];
+            switch (instruction.op)
+            {
+            case texture_opcode::constant:
+                return instruction.value_a;
+            case texture_opcode::checker:
+                pc = checker_is_odd(p) ? instruction.alternate : pc + 1;
+                break;
+            case texture_opcode::checker_const:
+                return checker_is_odd(p) ? instruction.value_b : instruction.value_a;
+            case texture_opcode::marble:
+                return marble_value(*instruction.noise, instruction.scale, p);
+            case texture_opcode::call:
+            default:
+                return instruction.callee->filtered_value(u, v, p, footprint);
+            }
+        }
+    }
+
+    [[nodiscard]] bool is_constant() const { return code.empty(); }
+
+    // Appends an instruction and returns its index.
+    std::uint32_t emit(const texture_instruction& instruction)
+    {
+        code.push_back(instruction);
+        return static_cast<std::uint32_t>(code.size() - 1);
+    }
+
+    [[nodiscard]] std::uint32_t size() const { return static_cast<std::uint32_t>(code.size()); }
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::vector<texture_instruction> code;
+    color constant_value;
+    shared_ptr<texture> source; // keeps call targets alive
+};
+
+inline void texture::compile(texture_program& program) const
+{
+    texture_instruction instruction;
+    instruction.op = texture_opcode::call;
+    instruction.callee = this;
+    program.emit(instruction);
+}
+
 class solid_color : public texture
 {
 public:
@@ -25,6 +153,13 @@ public:
         return color_value;
     }
 
+    void compile(texture_program& program) const override
+    {
+        texture_instruction instruction;
+        instruction.value_a = color_value;
+        program.emit(instruction);
+    }
+
 private:
     color color_value;
 };
@@ -35,25 +170,73 @@ public:
     checker_texture() = default;
 
     checker_texture(shared_ptr<texture> _even, shared_ptr<texture> _odd)
-        : even(_even), odd(_odd)
+        : odd(_odd), even(_even)
     {}
 
     checker_texture(color c1, color c2)
-        : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2))
+        : odd(make_shared<solid_color>(c2)), even(make_shared<solid_color>(c1))
     {}
 
     [[nodiscard]] color value(double u, double v, const point3& p) const override
     {
-        auto sines = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-        if (sines < 0)
+        if (checker_is_odd(p))
             return odd->value(u, v, p);
         else
             return even->value(u, v, p);
     }
 
+    void compile(texture_program& program) const override
+    {
+        texture_instruction instruction;
+        instruction.op = texture_opcode::checker;
+        const std::uint32_t branch = program.emit(instruction);
+        even->compile(program);
+        const std::uint32_t odd_start = program.size();
+        odd->compile(program);
+
+        // Constant folding: two constant leaves collapse into one instruction.
+        if (program.size() == branch + 3
+            && program.code[branch + 1].op == texture_opcode::constant
+            && program.code[branch + 2].op == texture_opcode::constant)
+        {
+            texture_instruction& folded = program.code[branch];
+            folded.op = texture_opcode::checker_const;
+            folded.value_a = program.code[branch + 1].value_a;
+            folded.value_b = program.code[branch + 2].value_a;
+            program.code.resize(branch + 1);
+            return;
+        }
+        program.code[branch].alternate = odd_start;
+    }
+
 public:
     shared_ptr<texture> odd;
     shared_ptr<texture> even;
 };
 
-#endif
\ No newline at end of file
+class noise_texture : public texture
+{
+public:
+    noise_texture() = default;
+    noise_texture(double sc) : scale(sc) {}
+
+    [[nodiscard]] color value(double u, double v, const point3& p) const override
+    {
+        return marble_value(noise, scale, p);
+    }
+
+    void compile(texture_program& program) const override
+    {
+        texture_instruction instruction;
+        instruction.op = texture_opcode::marble;
+        instruction.noise = &noise;
+        instruction.scale = scale;
+        program.emit(instruction);
+    }
+
+public:
+    perlin noise;
+    double scale{ 1.0 };
+};
+
+#endif
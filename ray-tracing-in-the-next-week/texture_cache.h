@@ -0,0 +1,383 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+// On-disk tiled texture (.rtt):
+//   tiled_texture_header
+//   tiled_texture_level[level_count]
+//   tile data, level by level, tiles in row-major order.
+// Every tile is tile_size x tile_size RGB8 texels; edge tiles are padded by
+// repeating the last row/column so lookups never need bounds checks.
+
+constexpr char tiled_texture_magic[8] = { 'R', 'T', 'T', 'I', 'L', 'E', '0', '1' };
+constexpr std::uint32_t tiled_texture_version = 2;
+
+struct tiled_texture_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tile_size;
+    std::uint32_t level_count;
+    std::uint32_t channels;
+    std::uint32_t reserved;
+    // Size and modification time of the image the tiles were made from (0 if
+    // written from memory), so a converted texture is redone when it changes.
+    std::uint64_t source_size;
+    std::int64_t source_time;
+};
+
+// The size and modification time of `path`, as stored in a tiled texture.
+inline bool source_stamp(const std::string& path, std::uint64_t& size, std::int64_t& time)
+{
+    std::error_code error;
+    size = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    time = static_cast<std::int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+    return !error;
+}
+
+struct tiled_texture_level
+{
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tiles_x;
+    std::uint32_t tiles_y;
+    std::uint64_t offset; // byte offset of the level's first tile
+};
+
+// Reads a binary (P6) or ASCII (P3) PPM with maxval 255 into packed RGB8.
+inline bool load_ppm(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    std::string format;
+    in >> format;
+    auto next_int = [&in]() {
+        while (in >> std::ws && in.peek() == '#')
+        {
+            std::string comment;
+            std::getline(in, comment);
+        }
+        int value = 0;
+        in >> value;
+        return value;
+    };
+    width = next_int();
+    height = next_int();
+    const int max_value = next_int();
+    if ((format != "P3" && format != "P6") || width <= 0 || height <= 0 || max_value != 255)
+        return false;
+
+    rgb.resize(static_cast<size_t>(width) * height * 3);
+    if (format == "P6")
+    {
+        in.get(); // single whitespace after the header
+        in.read(reinterpret_cast<char*>(rgb.data()), static_cast<std::streamsize>(rgb.size()));
+    }
+    else
+    {
+        for (auto& channel : rgb)
+            channel = static_cast<unsigned char>(next_int());
+    }
+    return static_cast<bool>(in);
+}
+
+// Builds the mip chain with a 2x2 box filter and writes it in tiled form.
+inline bool write_tiled_texture(
+    const std::string& path, int width, int height, const std::vector<unsigned char>& rgb,
+    std::uint32_t tile_size = 64, std::uint64_t source_size = 0, std::int64_t source_time = 0)
+{
+    std::vector<std::vector<unsigned char>> levels{ rgb };
+    std::vector<std::array<int, 2>> sizes{ { width, height } };
+    while (sizes.back()[0] > 1 || sizes.back()[1] > 1)
+    {
+        const auto& src = levels.back();
+        const int sw = sizes.back()[0], sh = sizes.back()[1];
+        const int dw = std::max(1, sw / 2), dh = std::max(1, sh / 2);
+        std::vector<unsigned char> dst(static_cast<size_t>(dw) * dh * 3);
+        for (int y = 0; y < dh; ++y)
+            for (int x = 0; x < dw; ++x)
+                for (int c = 0; c < 3; ++c)
+                {
+                    int sum = 0;
+                    for (int dy = 0; dy < 2; ++dy)
+                        for (int dx = 0; dx < 2; ++dx)
+                        {
+                            const int sx = std::min(2 * x + dx, sw - 1);
+                            const int sy = std::min(2 * y + dy, sh - 1);
+                            sum += src[(static_cast<size_t>(sy) * sw + sx) * 3 + c];
+                        }
+                    dst[(static_cast<size_t>(y) * dw + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+        levels.push_back(std::move(dst));
+        sizes.push_back({ dw, dh });
+    }
+
+    tiled_texture_header header{};
+    std::memcpy(header.magic, tiled_texture_magic, sizeof(header.magic));
+    header.version = tiled_texture_version;
+    header.width = static_cast<std::uint32_t>(width);
+    header.height = static_cast<std::uint32_t>(height);
+    header.tile_size = tile_size;
+    header.level_count = static_cast<std::uint32_t>(levels.size());
+    header.channels = 3;
+    header.source_size = source_size;
+    header.source_time = source_time;
+
+    const std::uint64_t tile_bytes = static_cast<std::uint64_t>(tile_size) * tile_size * 3;
+    std::vector<tiled_texture_level> table(levels.size());
+    std::uint64_t offset = sizeof(header) + sizeof(tiled_texture_level) * table.size();
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        table[l].width = static_cast<std::uint32_t>(sizes[l][0]);
+        table[l].height = static_cast<std::uint32_t>(sizes[l][1]);
+        table[l].tiles_x = (table[l].width + tile_size - 1) / tile_size;
+        table[l].tiles_y = (table[l].height + tile_size - 1) / tile_size;
+        table[l].offset = offset;
+        offset += tile_bytes * table[l].tiles_x * table[l].tiles_y;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(sizeof(tiled_texture_level) * table.size()));
+
+    std::vector<unsigned char> tile(tile_bytes);
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        const auto& level = table[l];
+        for (std::uint32_t ty = 0; ty < level.tiles_y; ++ty)
+            for (std::uint32_t tx = 0; tx < level.tiles_x; ++tx)
+            {
+                for (std::uint32_t y = 0; y < tile_size; ++y)
+                    for (std::uint32_t x = 0; x < tile_size; ++x)
+                    {
+                        const std::uint32_t sx = std::min(tx * tile_size + x, level.width - 1);
+                        const std::uint32_t sy = std::min(ty * tile_size + y, level.height - 1);
+                        std::memcpy(&tile[(static_cast<size_t>(y) * tile_size + x) * 3],
+                            &levels[l][(static_cast<size_t>(sy) * level.width + sx) * 3], 3);
+                    }
+                out.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+    }
+    return static_cast<bool>(out);
+}
+
+// Converts a PPM to a tiled texture next to it, unless one made from the PPM
+// as it is now (same size and modification time) already exists. Returns the
+// path of the tiled texture, or an empty string on failure.
+inline std::string make_tiled_texture(const std::string& ppm_path)
+{
+    const std::string tiled_path = ppm_path + ".rtt";
+    std::uint64_t source_size = 0;
+    std::int64_t source_time = 0;
+    const bool stamped = source_stamp(ppm_path, source_size, source_time);
+
+    tiled_texture_header existing{};
+    std::ifstream previous(tiled_path, std::ios::binary);
+    if (previous.read(reinterpret_cast<char*>(&existing), sizeof(existing))
+        && std::memcmp(existing.magic, tiled_texture_magic, sizeof(existing.magic)) == 0
+        && existing.version == tiled_texture_version
+        && (!stamped || (existing.source_size == source_size && existing.source_time == source_time)))
+        return tiled_path;
+    previous.close();
+
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;
+    if (!load_ppm(ppm_path, width, height, rgb)
+        || !write_tiled_texture(tiled_path, width, height, rgb, 64, source_size, source_time))
+    {
+        std::cerr << "Could not convert texture image file '" << ppm_path << "'.\n";
+        return {};
+    }
+    return tiled_path;
+}
+
+// One decoded tile: tile_size * tile_size RGB texels in [0,1].
+struct texture_tile
+{
+    std::vector<float> texels;
+};
+
+// Process-wide cache of decoded tiles with a fixed byte budget. Least recently
+// used tiles are evicted first; tiles still referenced by a lookup stay alive
+// through their shared_ptr until the caller drops them. The key space is split
+// over independently locked shards so render threads rarely contend, and each
+// thread keeps the last tiles it fetched in a small table of its own, so the
+// common lookup (a tile the thread used a moment ago) takes no lock at all.
+class tile_cache
+{
+public:
+    static constexpr size_t shard_count = 16;
+
+    static tile_cache& global()
+    {
+        static tile_cache cache;
+        return cache;
+    }
+
+    void set_budget(size_t bytes) { budget_bytes = bytes; }
+    [[nodiscard]] size_t budget() const { return budget_bytes; }
+
+    [[nodiscard]] std::uint32_t register_texture() { return next_texture_id++; }
+
+    // Keys are never reused (texture ids only grow) and tiles never change,
+    // so a tile in a thread's table stays valid however long it sits there.
+    template <typename Loader>
+    std::shared_ptr<const texture_tile> get(std::uint64_t key, size_t tile_bytes, Loader&& load)
+    {
+        thread_tiles& local = local_tiles();
+        const size_t slot = (key ^ (key >> 13)) % thread_tiles::slot_count;
+        if (local.tiles[slot] && local.keys[slot] == key)
+        {
+            local.hits.store(local.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return local.tiles[slot];
+        }
+
+        auto tile = shared_get(key, tile_bytes, load);
+        local.keys[slot] = key;
+        local.tiles[slot] = tile;
+        return tile;
+    }
+
+    // Totals over the shards and the threads' own tables. Each counter is
+    // written by one shard's lock holder or one thread only, so no cache line
+    // is shared between threads that look up different tiles.
+    [[nodiscard]] std::uint64_t hit_count() const
+    {
+        std::uint64_t total = sum(&shard::hits);
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        total += retired_hits;
+        for (const thread_tiles* local : threads)
+            total += local->hits.load(std::memory_order_relaxed);
+        return total;
+    }
+    [[nodiscard]] std::uint64_t miss_count() const { return sum(&shard::misses); }
+
+private:
+    tile_cache() = default;
+
+    // A thread's recently used tiles, direct-mapped by key. They hold their
+    // tiles alive past eviction from the shards, so the cache may exceed its
+    // budget by slot_count tiles per rendering thread.
+    struct thread_tiles
+    {
+        static constexpr size_t slot_count = 16;
+
+        explicit thread_tiles(tile_cache& owner) : cache(owner)
+        {
+            std::lock_guard<std::mutex> lock(cache.threads_mutex);
+            cache.threads.push_back(this);
+        }
+        ~thread_tiles()
+        {
+            std::lock_guard<std::mutex> lock(cache.threads_mutex);
+            cache.retired_hits += hits.load(std::memory_order_relaxed);
+            cache.threads.erase(std::find(cache.threads.begin(), cache.threads.end(), this));
+        }
+        thread_tiles(const thread_tiles&) = delete;
+        thread_tiles& operator=(const thread_tiles&) = delete;
+
+        tile_cache& cache;
+        std::array<std::uint64_t, slot_count> keys{};
+        std::array<std::shared_ptr<const texture_tile>, slot_count> tiles;
+        std::atomic<std::uint64_t> hits{ 0 }; // atomic only so hit_count() may read it
+    };
+
+    thread_tiles& local_tiles()
+    {
+        thread_local thread_tiles local(*this);
+        return local;
+    }
+
+    template <typename Loader>
+    std::shared_ptr<const texture_tile> shared_get(std::uint64_t key, size_t tile_bytes, Loader& load)
+    {
+        shard& s = shards[(key ^ (key >> 17)) % shard_count];
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            const auto found = s.index.find(key);
+            if (found != s.index.end())
+            {
+                s.lru.splice(s.lru.begin(), s.lru, found->second);
+                ++s.hits;
+                return found->second->second;
+            }
+        }
+
+        // Decode outside the lock; a racing thread may decode the same tile once more.
+        auto tile = std::make_shared<texture_tile>();
+        load(*tile);
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        ++s.misses;
+        const auto found = s.index.find(key);
+        if (found != s.index.end())
+            return found->second->second;
+
+        s.lru.emplace_front(key, tile);
+        s.index.emplace(key, s.lru.begin());
+        s.bytes += tile_bytes;
+        const size_t shard_budget = budget_bytes / shard_count;
+        while (s.bytes > shard_budget && s.lru.size() > 1)
+        {
+            s.index.erase(s.lru.back().first);
+            s.lru.pop_back();
+            s.bytes -= tile_bytes;
+        }
+        return tile;
+    }
+
+    // Each on its own cache lines, so locking one does not disturb its neighbors.
+    struct alignas(64) shard
+    {
+        mutable std::mutex mutex;
+        std::list<std::pair<std::uint64_t, std::shared_ptr<const texture_tile>>> lru;
+        std::unordered_map<std::uint64_t, decltype(lru)::iterator> index;
+        size_t bytes{ 0 };
+        std::uint64_t hits{ 0 };
+        std::uint64_t misses{ 0 };
+    };
+
+    [[nodiscard]] std::uint64_t sum(std::uint64_t shard::* counter) const
+    {
+        std::uint64_t total = 0;
+        for (const shard& s : shards)
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            total += s.*counter;
+        }
+        return total;
+    }
+
+    std::array<shard, shard_count> shards;
+    mutable std::mutex threads_mutex;
+    std::vector<thread_tiles*> threads;
+    std::uint64_t retired_hits{ 0 }; // from threads that have exited
+    std::atomic<size_t> budget_bytes{ size_t{ 256 } << 20 };
+    std::atomic<std::uint32_t> next_texture_id{ 0 };
+};
+
+#endif
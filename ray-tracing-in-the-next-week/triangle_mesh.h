@@ -0,0 +1,324 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "flat_bvh.h"
+#include "hittable.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_TRIANGLE_SSE 1
+#include <emmintrin.h>
+#endif
+
+struct mesh_vertex
+{
+    float x, y, z;
+};
+
+// Four triangles in structure-of-arrays form (vertex 0 and both edges per
+// lane), so one SSE instruction advances the Moller-Trumbore test for all four.
+// Unused lanes are padded with degenerate triangles, which never hit.
+struct alignas(16) triangle_packet
+{
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    std::uint32_t triangle[4];
+};
+
+// An indexed triangle mesh: one shared vertex buffer and one index buffer
+// (three indices per triangle) with no per-triangle objects. It owns a
+// flat_bvh whose leaves point at runs of triangle_packets.
+class triangle_mesh final : public hittable
+{
+public:
+    triangle_mesh() = default;
+    triangle_mesh(std::vector<mesh_vertex> mesh_vertices, std::vector<std::uint32_t> mesh_indices,
+        shared_ptr<material> m)
+        : vertices(std::move(mesh_vertices)), indices(std::move(mesh_indices)), mat_ptr(std::move(m))
+    {
+        build();
+    }
+
+    bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    bool occluded(const ray& r, double t_min, double t_max) const override;
+
+    [[nodiscard]] size_t triangle_count() const { return indices.size() / 3; }
+
+    // The nearest hit in (t_min, t_max) from testing every triangle in double
+    // precision, without the BVH or the packets: a reference to check hit() by.
+    [[nodiscard]] bool brute_force_hit(const ray& r, double t_min, double t_max, double& t) const;
+
+// ReSharper disable once CppRedundantAccessSpecifier
+public:
+    std::vector<mesh_vertex> vertices;
+    std::vector<std::uint32_t> indices;
+    shared_ptr<material> mat_ptr;
+
+    flat_bvh bvh;
+    std::vector<triangle_packet> packets;
+
+private:
+    void build();
+
+    [[nodiscard]] point3 vertex(std::uint32_t triangle, int corner) const
+    {
+        const mesh_vertex& v = vertices[indices[3 * triangle + corner]];
+        return point3(v.x, v.y, v.z);
+    }
+
+    // Tests the packet and returns the lane of the closest hit inside (t_min, t_max), or -1.
+    static int intersect_packet(const triangle_packet& packet, const float origin[3], const float direction[3],
+        float t_min, float t_max, float& t, float& u, float& v);
+};
+
+inline void triangle_mesh::build()
+{
+    const size_t count = triangle_count();
+    std::vector<aabb> boxes(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        aabb box = empty_box();
+        for (int corner = 0; corner < 3; ++corner)
+            grow(box, vertex(static_cast<std::uint32_t>(i), corner));
+        boxes[i] = box;
+    }
+    // One packet test covers four triangles, so a triangle costs a quarter
+    // of a node visit; this keeps leaves close to full packets.
+    bvh_build_options options;
+    options.max_leaf_size = 4;
+    options.intersection_cost = 0.25;
+    bvh.build(boxes, options);
+
+    // Replace each leaf's primitive range with a run of packets.
+    packets.clear();
+    for (auto& node : bvh.nodes)
+    {
+        if (node.count == 0)
+            continue;
+
+        const std::uint32_t first_packet = static_cast<std::uint32_t>(packets.size());
+        for (std::uint32_t i = 0; i < node.count; i += 4)
+        {
+            triangle_packet packet{};
+            for (std::uint32_t lane = 0; lane < 4; ++lane)
+            {
+                const bool used = i + lane < node.count;
+                const std::uint32_t tri = used ? bvh.primitive_indices[node.offset + i + lane] : 0;
+                const point3 p0 = vertex(tri, 0);
+                const vec3 e1 = used ? vertex(tri, 1) - p0 : vec3();
+                const vec3 e2 = used ? vertex(tri, 2) - p0 : vec3();
+                for (int a = 0; a < 3; ++a)
+                {
+                    packet.v0[a][lane] = static_cast<float>(p0.e[a]);
+                    packet.e1[a][lane] = static_cast<float>(e1.e[a]);
+                    packet.e2[a][lane] = static_cast<float>(e2.e[a]);
+                }
+                packet.triangle[lane] = tri;
+            }
+            packets.push_back(packet);
+        }
+        node.offset = first_packet;
+    }
+    bvh.primitive_indices.clear();
+    bvh.primitive_indices.shrink_to_fit();
+}
+
+inline int triangle_mesh::intersect_packet(const triangle_packet& packet, const float origin[3],
+    const float direction[3], float t_min, float t_max, float& t, float& u, float& v)
+{
+#ifdef RT_TRIANGLE_SSE
+    const __m128 dx = _mm_set1_ps(direction[0]), dy = _mm_set1_ps(direction[1]), dz = _mm_set1_ps(direction[2]);
+    const __m128 e1x = _mm_load_ps(packet.e1[0]), e1y = _mm_load_ps(packet.e1[1]), e1z = _mm_load_ps(packet.e1[2]);
+    const __m128 e2x = _mm_load_ps(packet.e2[0]), e2y = _mm_load_ps(packet.e2[1]), e2z = _mm_load_ps(packet.e2[2]);
+
+    // pvec = d x e2, det = e1 . pvec
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // tvec = o - v0, u = (tvec . pvec) / det
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(origin[0]), _mm_load_ps(packet.v0[0]));
+    const __m128 ty = _mm_sub_ps(_mm_set1_ps(origin[1]), _mm_load_ps(packet.v0[1]));
+    const __m128 tz = _mm_sub_ps(_mm_set1_ps(origin[2]), _mm_load_ps(packet.v0[2]));
+    const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+    // qvec = tvec x e1, v = (d . qvec) / det, t = (e2 . qvec) / det
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    __m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(1e-12f));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(uu, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(vv, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(tt, _mm_set1_ps(t_min)));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, _mm_set1_ps(t_max)));
+
+    const int hits = _mm_movemask_ps(mask);
+    if (hits == 0)
+        return -1;
+
+    alignas(16) float lane_t[4], lane_u[4], lane_v[4];
+    _mm_store_ps(lane_t, tt);
+    _mm_store_ps(lane_u, uu);
+    _mm_store_ps(lane_v, vv);
+#else
+    float lane_t[4], lane_u[4], lane_v[4];
+    int hits = 0;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        const float e1[3] = { packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane] };
+        const float e2[3] = { packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane] };
+        const float p[3] = { direction[1] * e2[2] - direction[2] * e2[1],
+                             direction[2] * e2[0] - direction[0] * e2[2],
+                             direction[0] * e2[1] - direction[1] * e2[0] };
+        const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (det > -1e-12f && det < 1e-12f)
+            continue;
+        const float inv_det = 1.0f / det;
+        const float s[3] = { origin[0] - packet.v0[0][lane], origin[1] - packet.v0[1][lane], origin[2] - packet.v0[2][lane] };
+        const float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+        lane_u[lane] = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+        lane_v[lane] = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inv_det;
+        lane_t[lane] = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+        if (lane_u[lane] >= 0 && lane_v[lane] >= 0 && lane_u[lane] + lane_v[lane] <= 1
+            && lane_t[lane] > t_min && lane_t[lane] < t_max)
+            hits |= 1 << lane;
+    }
+    if (hits == 0)
+        return -1;
+#endif
+
+    int best = -1;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if ((hits & (1 << lane)) && (best < 0 || lane_t[lane] < lane_t[best]))
+            best = lane;
+    }
+    t = lane_t[best];
+    u = lane_u[best];
+    v = lane_v[best];
+    return best;
+}
+
+inline bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+{
+    const float origin[3] = { static_cast<float>(r.origin().x()), static_cast<float>(r.origin().y()), static_cast<float>(r.origin().z()) };
+    const float direction[3] = { static_cast<float>(r.direction().x()), static_cast<float>(r.direction().y()), static_cast<float>(r.direction().z()) };
+
+    std::uint32_t hit_triangle = 0;
+    float hit_u = 0, hit_v = 0;
+    double hit_t = t_max;
+
+    const bool hit_anything = bvh.traverse(r, t_min, t_max,
+        [&](std::uint32_t first_packet, std::uint32_t triangle_count, double& closest) {
+            bool hit_leaf = false;
+            const std::uint32_t packet_count = (triangle_count + 3) / 4;
+            for (std::uint32_t p = first_packet; p < first_packet + packet_count; ++p)
+            {
+                float t, u, v;
+                RT_COUNT_N(primitive_tests, std::min(4u, triangle_count - 4 * (p - first_packet)));
+                const int lane = intersect_packet(packets[p], origin, direction,
+                    static_cast<float>(t_min), static_cast<float>(closest), t, u, v);
+                if (lane >= 0)
+                {
+                    closest = t;
+                    hit_t = t;
+                    hit_u = u;
+                    hit_v = v;
+                    hit_triangle = packets[p].triangle[lane];
+                    hit_leaf = true;
+                }
+            }
+            return hit_leaf;
+        });
+
+    if (!hit_anything)
+        return false;
+
+    const point3 p0 = vertex(hit_triangle, 0);
+    const vec3 outward_normal = unit_vector(cross(vertex(hit_triangle, 1) - p0, vertex(hit_triangle, 2) - p0));
+
+    rec.t_of_ray = hit_t;
+    rec.hit_point = r.at(hit_t);
+    rec.set_face_normal(r, outward_normal);
+    rec.u = hit_u;
+    rec.v = hit_v;
+    rec.hit_material = mat_ptr.get();
+    rec.hit_object = this;
+    rec.pending_shading = nullptr;
+    if (rec.set_differentials(r))
+    {
+        rec.dndx = rec.dndy = vec3(0, 0, 0); // flat shading
+    }
+    return true;
+}
+
+inline bool triangle_mesh::occluded(const ray& r, double t_min, double t_max) const
+{
+    const float origin[3] = { static_cast<float>(r.origin().x()), static_cast<float>(r.origin().y()), static_cast<float>(r.origin().z()) };
+    const float direction[3] = { static_cast<float>(r.direction().x()), static_cast<float>(r.direction().y()), static_cast<float>(r.direction().z()) };
+
+    return bvh.traverse(r, t_min, t_max,
+        [&](std::uint32_t first_packet, std::uint32_t triangle_count, double& limit) {
+            const std::uint32_t packet_count = (triangle_count + 3) / 4;
+            for (std::uint32_t p = first_packet; p < first_packet + packet_count; ++p)
+            {
+                float t, u, v;
+                RT_COUNT_N(primitive_tests, std::min(4u, triangle_count - 4 * (p - first_packet)));
+                if (intersect_packet(packets[p], origin, direction, static_cast<float>(t_min), static_cast<float>(limit), t, u, v) >= 0)
+                {
+                    limit = -infinity; // any hit will do; ends the traversal
+                    return true;
+                }
+            }
+            return false;
+        });
+}
+
+inline bool triangle_mesh::brute_force_hit(const ray& r, double t_min, double t_max, double& t) const
+{
+    bool hit_anything = false;
+    for (std::uint32_t triangle = 0; triangle < triangle_count(); ++triangle)
+    {
+        const point3 p0 = vertex(triangle, 0);
+        const vec3 e1 = vertex(triangle, 1) - p0;
+        const vec3 e2 = vertex(triangle, 2) - p0;
+        const vec3 p = cross(r.direction(), e2);
+        const double det = dot(e1, p);
+        if (fabs(det) < 1e-300)
+            continue;
+        const vec3 s = r.origin() - p0;
+        const double u = dot(s, p) / det;
+        const vec3 q = cross(s, e1);
+        const double v = dot(r.direction(), q) / det;
+        const double candidate = dot(e2, q) / det;
+        if (u >= 0 && v >= 0 && u + v <= 1 && candidate > t_min && candidate < t_max)
+        {
+            t_max = candidate;
+            t = candidate;
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+inline bool triangle_mesh::bounding_box(double time0, double time1, aabb& output_box) const
+{
+    if (bvh.empty())
+        return false;
+    output_box = bvh.bounds();
+    return true;
+}
+
+#endif